@@ -1,6 +1,9 @@
 #include "engine.h"
 
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
 
 #include <iostream>
@@ -13,19 +16,32 @@
 #include <include/quadrangle.h>
 #include <include/scene.h>
 
+// Models and textures of the demo, relative to the working directory
+static const std::string MODELS_DIR = "./resources/";
+
 QImage engine(size_t width, size_t height) {
     // Allocating scene
     Color BACKGROUND_COLOR = Color(240, 240, 240);
     Scene * scene = new Scene(BACKGROUND_COLOR);
+    // Threads for loading models, KDTree building and rendering,
+    // 0 - one thread per hardware core
+    scene->set_threads_count(0);
+    // Accelerator::KD_TREE, BVH2, BVH4 or BVH8
+    scene->set_accelerator(Accelerator::KD_TREE);
+    // Built accelerators are kept in the directory of RAYTRACER_CACHE,
+    // if it is set, and read on next runs
+    const char * const cache_directory = getenv("RAYTRACER_CACHE");
+    if (cache_directory) {
+        scene->set_accelerator_cache(cache_directory);
+    }
 
     /// Quadrangle3d 1
-    Object3d* quad = new Quadrangle3d(Point3d(-500, -500, -100),
-                                      Point3d(+800, -0, -100),
-                                      Point3d(+800, -0, +300),
-                                      Point3d(-500, -500, +300),
-                                      Color(255, 0, 0),
-                                      Material(15, 5, 50, 100, 0, 10));
-    scene->add_object(quad);
+    scene->create_object<Quadrangle3d>(Point3d(-500, -500, -100),
+                                       Point3d(+800, -0, -100),
+                                       Point3d(+800, -0, +300),
+                                       Point3d(-500, -500, +300),
+                                       scene->add_material(Color(255, 0, 0),
+                                                           Material(15, 5, 50, 100, 0, 10)));
 
 
     /// Sphere 0
@@ -34,8 +50,8 @@ QImage engine(size_t width, size_t height) {
         Point3d center(50, 100, 0);
         Color sphere_color(100, 200, 30);
         Material sphere_material(1, 5, 5, 0, 50, 10, 0.9);
-        Object3d* sphere = new Sphere(center, radius, sphere_color, sphere_material);
-        scene->add_object(sphere);
+        scene->create_object<Sphere>(center, radius,
+                                     scene->add_material(sphere_color, sphere_material));
     }
 
     /// Sphere 0.5
@@ -44,8 +60,8 @@ QImage engine(size_t width, size_t height) {
         Point3d center(75, 125, -100);
         Color sphere_color(250, 250, 50);
         Material sphere_material(1, 3, 2, 0, 0, 10);
-        Object3d* sphere = new Sphere(center, radius, sphere_color, sphere_material);
-        scene->add_object(sphere);
+        scene->create_object<Sphere>(center, radius,
+                                     scene->add_material(sphere_color, sphere_material));
     }
 
 
@@ -55,8 +71,8 @@ QImage engine(size_t width, size_t height) {
     Point3d center(0, 0, 0);
     Color sphere_color(250, 30, 30);
     Material sphere_material(1, 5, 5, 10, 0, 10);
-    Object3d* sphere = new Sphere(center, radius, sphere_color, sphere_material);
-    scene->add_object(sphere);
+    scene->create_object<Sphere>(center, radius,
+                                 scene->add_material(sphere_color, sphere_material));
     */
 
     /// Sphere 2
@@ -64,25 +80,25 @@ QImage engine(size_t width, size_t height) {
     Point3d center(100, 100, 100);
     Color sphere_color(30, 30, 230);
     Material sphere_material(1, 5, 5, 10, 0, 10);
-    Object3d * sphere = new Sphere(center, radius, sphere_color, sphere_material);
-    scene->add_object(sphere);
+    scene->create_object<Sphere>(center, radius,
+                                 scene->add_material(sphere_color, sphere_material));
 
 
     /// TexturedTriangle3d 1
-    Canvas tex("./models/wall.png");
-    scene->add_object(new TexturedTriangle3d(Point3d(-300-5, -300, -120),
+    Canvas tex((MODELS_DIR + "wall.png").c_str());
+    scene->create_object<TexturedTriangle3d>(Point3d(-300-5, -300, -120),
                                              Point3d(300, -300, -120),
                                              Point3d(300, 300, -120),
                                              Point2d(5, 0),
                                              Point2d(0, 0),
                                              Point2d(0, 5),
                                              &tex,
-                                             Color(55, 255, 55),
-                                             Material(1, 6, 0, 2, 0, 0)));
+                                             scene->add_material(Color(55, 255, 55),
+                                                                 Material(1, 6, 0, 2, 0, 0)));
 /*
     /// TexturedQuadrangle3d 1
     Canvas tex2("./models/skybox/posx.png");
-    scene->add_object(new TexturedQuadrangle3d(Point3d(-300, -120, -300),
+    scene->create_object<TexturedQuadrangle3d>(Point3d(-300, -120, -300),
                                                Point3d(300, -120, -300),
                                                Point3d(300, -120, 300),
                                                Point3d(-300,-120, 300),
@@ -91,17 +107,17 @@ QImage engine(size_t width, size_t height) {
                                                Point2d(0, 5),
                                                Point2d(5, 5),
                                                &tex2,
-                                               Color(55, 255, 55),
-                                               Material(1, 6, 0, 2, 0, 0)));
+                                               scene->add_material(Color(55, 255, 55),
+                                                                   Material(1, 6, 0, 2, 0, 0)));
  */
     /// Triangle3d 2
-    Object3d * triangle = new Triangle3d(Point3d(-700, -700, -130), // vertex 1
-                                       Point3d( 700, -700, -130), // vertex 2
-                                       Point3d(   0,  500, -130), // vertex 3
-                                       Color(255, 100, 30),       // color
-                                       Material(1, 6, 0, 2, 0, 0) // surface params
-                                       );
-    scene->add_object(triangle);
+    scene->create_object<Triangle3d>(Point3d(-700, -700, -130), // vertex 1
+                                     Point3d( 700, -700, -130), // vertex 2
+                                     Point3d(   0,  500, -130), // vertex 3
+                                     scene->add_material(
+                                         Color(255, 100, 30),       // color
+                                         Material(1, 6, 0, 2, 0, 0) // surface params
+                                     ));
 
 
     /// Load Teapot Model
@@ -109,7 +125,12 @@ QImage engine(size_t width, size_t height) {
                            20, 0, 0, -20, 0, 0, 20,
                            Color(220, 220, 220),
                            Material(1, 3, 5, 0, 0, 10));
-    pram1.load_obj("./models/teapot.obj");
+    try {
+        pram1.load_obj((MODELS_DIR + "teapot.obj").c_str());
+    } catch (const std::runtime_error &e) {
+        // The rest of the scene is rendered without the model
+        std::cerr << e.what() << "\n";
+    }
 
 
 
@@ -126,14 +147,29 @@ QImage engine(size_t width, size_t height) {
                                       // surface params
                                       Material(3, 3, 1, 0, 0, 5)
                                       );
-    scene_face_handler.load_obj("./models/lamp.obj");
+    try {
+        scene_face_handler.load_obj((MODELS_DIR + "lamp.obj").c_str());
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << "\n";
+    }
 
 
 
-    /// Build KDTree
+    /// Build accelerator
     scene->prepare_scene();
     std::cout << "\nNumber of polygons:" << scene->get_objects_count() << "\n";
 
+    Accelerator::Statistics kd_stats = scene->get_kd_tree_statistics();
+    std::cout << "Accelerator build time: " << kd_stats.build_time << " s ("
+              << kd_stats.build_threads_count << " threads), "
+              << "nodes: " << kd_stats.nodes << ", "
+              << "leaves: " << kd_stats.leaves
+              << " (empty: " << kd_stats.empty_leaves << "), "
+              << "references: " << kd_stats.references << ", "
+              << "depth: " << kd_stats.depth << ", "
+              << "SAH cost: " << kd_stats.sah_cost << ", "
+              << "memory: " << kd_stats.memory / 1024 << " KB\n";
+
 
 
 
@@ -152,7 +188,17 @@ QImage engine(size_t width, size_t height) {
                   320);
 
     Canvas canvas(width, height);
+    auto render_start = std::chrono::steady_clock::now();
     scene->render(camera, canvas);
+    std::chrono::duration<double> render_time =
+            std::chrono::steady_clock::now() - render_start;
+    std::cout << "Render time: " << render_time.count() << " s\n";
+
+    Scene::RenderStatistics render_stats = scene->get_render_statistics();
+    std::cout << "Shaded points: " << render_stats.shaded_points << ", "
+              << "shadow rays: " << render_stats.shadow_rays << " ("
+              << (Float) render_stats.shadow_rays / std::max<size_t>(render_stats.shaded_points, 1)
+              << " per point)\n";
     canvas.write_png("rendered.png");
 
     QImage ret = canvas.getQImage();
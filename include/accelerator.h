@@ -0,0 +1,338 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include <include/objects.h>
+#include <include/primitives.h>
+#include <include/ray_packet.h>
+#include <include/thread_pool.h>
+#include <include/triangle_mesh.h>
+
+/*
+ * Acceleration structure finding the objects hit by rays: KDTree or BVH.
+ *
+ * Objects are splitted into primitives (meshes into faces), which are kept
+ * by types in contiguous arrays, in the order of the first reference from
+ * leaves. Leaves reference them by tags: Primitive::Type in the low
+ * TYPE_BITS bits, index in the array of the type in the others.
+ * Structures differ only in the hierarchy of leaves.
+ */
+class Accelerator {
+    friend class AcceleratorCache;
+
+public:
+    // BVH2 is the binary BVH, BVH4 and BVH8 are collapsed from it
+    enum Type {KD_TREE, BVH2, BVH4, BVH8};
+
+    class Statistics {
+    public:
+        size_t nodes;
+        size_t leaves;
+        size_t empty_leaves;
+        size_t references; // primitives in all leaves, with duplicates
+        int depth;
+        Float sah_cost;
+        size_t memory; // bytes
+        double build_time; // seconds
+        size_t build_threads_count;
+    };
+
+    // Builds the structure of the type by threads of the pool, the
+    // constructors of KDTree, BVH and WideBVH take the same objects and pool
+    static Accelerator *build(const Type type, std::vector<Object3d *> &objects,
+                              const ThreadPool &pool);
+
+    virtual ~Accelerator();
+
+    // The nearest intersection, hit is updated if it is nearer than hit.t
+    virtual bool find_intersection_tree(const Point3d vector_start,
+                                        const Vector3d vector,
+                                        HitRecord &hit) const = 0;
+    // find_intersection_tree for every ray of coherent packet,
+    // returns lanes of rays intersecting any object
+    virtual int find_intersection_packet(const RayPacket &packet,
+                                         HitRecord hits[]) const = 0;
+    // Any object intersecting the ray vector_start + t * vector at t <= max_t,
+    // the nearest one is not searched
+    virtual bool is_occluded(const Point3d vector_start, const Vector3d vector,
+                             const Float max_t) const = 0;
+    virtual Statistics get_statistics() const = 0;
+    // Updates the structure after objects moved or changed their geometry,
+    // the set of objects must be the same. Returns false if the structure
+    // can't be updated in place or became too slow, then it must be built
+    // again. Threads of the pool update the structure.
+    virtual bool refit(const ThreadPool &pool) = 0;
+
+    // Parallel build: nodes are splitted in parallel while they have more
+    // than PARALLEL_CHUNK objects, then every thread gets about
+    // SUBTREES_PER_THREAD subtrees to build
+    static const size_t PARALLEL_CHUNK = 4096;
+    static const size_t SUBTREES_PER_THREAD = 8;
+
+protected:
+    static const uint32_t NO_REF = UINT32_MAX;
+    static const int TYPE_BITS = 3;
+    static const uint32_t TYPE_MASK = (1 << TYPE_BITS) - 1;
+    // Leaves with so many triangles and faces of meshes test them
+    // by RayPacket::SIZE at once
+    static const uint32_t BATCH_TRIANGLES_COUNT = 3;
+
+    // Primitive while the structure is built: the object or the face of mesh
+    class BuildItem {
+    public:
+        uint32_t object;
+        uint32_t face;
+        const TriangleMesh *mesh; // NULL if the object is not a mesh
+    };
+
+    // Face of mesh referenced from leaves
+    class MeshFace {
+    public:
+        uint32_t mesh; // index in meshes
+        uint32_t face;
+    };
+
+    Accelerator(std::vector<Object3d *> &objects);
+
+    std::vector<Object3d*> objects;
+
+    std::vector<uint32_t> primitive_refs;
+    std::vector<TrianglePrimitive> triangles;
+    std::vector<QuadranglePrimitive> quadrangles;
+    std::vector<SpherePrimitive> spheres;
+    std::vector<MeshFace> mesh_faces;
+    std::vector<const TriangleMesh*> meshes;
+    // Object of every primitive by types, GENERIC ones are intersected
+    // by virtual calls. MESH objects are the ones of meshes, not of faces.
+    std::vector<Object3d*> primitive_objects[Primitive::TYPES_COUNT];
+
+    double build_time;
+    size_t build_threads_count;
+
+    // Every object, every face of meshes
+    std::vector<BuildItem> get_build_items() const;
+    void get_item_bounds(const BuildItem &item, Point3d &min_point, Point3d &max_point) const;
+    // mesh_indexes[i] is the index of objects[i] in meshes, or NO_REF
+    // if it is not added yet
+    std::vector<uint32_t> get_empty_mesh_indexes() const;
+    uint32_t add_primitive(const BuildItem &item, std::vector<uint32_t> &mesh_indexes);
+    void get_primitive_bounds(const uint32_t ref, Point3d &min_point,
+                              Point3d &max_point) const;
+    // Copies of primitives are taken from their objects again
+    void update_primitives();
+    // Bytes of primitives and references to them
+    size_t get_primitives_memory() const;
+
+    bool intersect_primitive(const uint32_t ref, const ShearedRay &ray,
+                             HitRecord &hit) const;
+    int intersect_primitive_packet(const uint32_t ref, const RayPacket &packet,
+                                   const PacketShear &shear, const int lanes,
+                                   HitRecord hits[]) const;
+    // Fills object and normal of the nearest hit of primitive
+    void complete_hit(const uint32_t ref, HitRecord &hit) const;
+
+    // Calls visit_hit(ref, hit) for primitives of the leaf hit by the ray,
+    // batches of triangles report only the nearest hit. visit_hit returns
+    // true to stop.
+    template <class HitVisitor>
+    bool visit_primitives(const uint32_t refs_offset, const uint32_t count,
+                          const ShearedRay &ray, HitVisitor visit_hit) const;
+    // The same, but GENERIC primitives are passed to visit_generic(ref)
+    // instead of being intersected
+    template <class HitVisitor, class GenericVisitor>
+    bool visit_primitives(const uint32_t refs_offset, const uint32_t count,
+                          const ShearedRay &ray, HitVisitor visit_hit,
+                          GenericVisitor visit_generic) const;
+
+    // Searches of structures are made of their traversal and these leaf
+    // visitors. traverse(t_stop, visit_leaf) visits leaves hit by the ray
+    // at t <= t_stop, nearer ones first; visit_leaf(refs_offset, count)
+    // returns true to stop and may decrease t_stop.
+
+    // find_intersection_tree() by the traversal
+    template <class Traversal>
+    bool find_nearest_hit(const Point3d &vector_start, const Vector3d &vector,
+                          HitRecord &hit, Traversal traverse) const;
+    // is_occluded() by the traversal, GENERIC objects are asked by
+    // Object3d::is_occluded()
+    template <class Traversal>
+    bool find_any_hit(const Point3d &vector_start, const Vector3d &vector,
+                      const Float max_t, Traversal traverse) const;
+    // Index of the nearest of count <= RayPacket::SIZE triangles or faces
+    // of meshes hit by the ray, -1 if there is no hit
+    int nearest_triangle(const ShearedRay &ray, const uint32_t refs[], const int count,
+                         Float &t) const;
+
+    // float(x) is the nearest float, it may be on the wrong side of x
+    static float float_below(const Float x);
+    static float float_above(const Float x);
+
+    // Splits [0, count) into ranges of about PARALLEL_CHUNK items
+    static size_t chunks_for(const size_t count, const ThreadPool &pool);
+    static size_t chunk_begin(const size_t count, const size_t chunks, const size_t chunk);
+    // Depth of nodes built as independent subtrees
+    static size_t spawn_depth_for(const size_t threads_count);
+};
+
+inline bool Accelerator::intersect_primitive(const uint32_t ref, const ShearedRay &ray,
+                                             HitRecord &hit) const {
+    const uint32_t index = ref >> TYPE_BITS;
+    switch (ref & TYPE_MASK) {
+    case Primitive::TRIANGLE:
+        return triangles[index].intersect(ray, hit);
+    case Primitive::QUADRANGLE:
+        return quadrangles[index].intersect(ray.start, ray.vector, hit);
+    case Primitive::SPHERE:
+        return spheres[index].intersect(ray.start, ray.vector, hit);
+    case Primitive::MESH:
+        return meshes[mesh_faces[index].mesh]->intersect_face(mesh_faces[index].face, ray, hit);
+    default:
+        return primitive_objects[Primitive::GENERIC][index]->intersect(ray.start, ray.vector,
+                                                                      hit);
+    }
+}
+
+PACKET_INLINE int Accelerator::intersect_primitive_packet(const uint32_t ref,
+                                                          const RayPacket &packet,
+                                                          const PacketShear &shear,
+                                                          const int lanes,
+                                                          HitRecord hits[]) const {
+    const uint32_t index = ref >> TYPE_BITS;
+    switch (ref & TYPE_MASK) {
+    case Primitive::TRIANGLE:
+        return triangles[index].intersect_packet(packet, shear, lanes, hits);
+    case Primitive::QUADRANGLE:
+        return quadrangles[index].intersect_packet(packet, lanes, hits);
+    case Primitive::MESH:
+        return meshes[mesh_faces[index].mesh]->intersect_face_packet(mesh_faces[index].face,
+                                                                    packet, shear, lanes,
+                                                                    hits);
+    default:
+        break;
+    }
+
+    int lane_hits = 0;
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        if (((lanes >> i) & 1)
+                && intersect_primitive(ref, ShearedRay(packet.start, packet.vector(i)),
+                                       hits[i])) {
+            lane_hits |= 1 << i;
+        }
+    }
+    return lane_hits;
+}
+
+template <class HitVisitor>
+inline bool Accelerator::visit_primitives(const uint32_t refs_offset, const uint32_t count,
+                                          const ShearedRay &ray,
+                                          HitVisitor visit_hit) const {
+    return visit_primitives(refs_offset, count, ray, visit_hit, [&](const uint32_t ref) {
+        HitRecord hit;
+        return intersect_primitive(ref, ray, hit) && visit_hit(ref, hit);
+    });
+}
+
+template <class HitVisitor, class GenericVisitor>
+inline bool Accelerator::visit_primitives(const uint32_t refs_offset, const uint32_t count,
+                                          const ShearedRay &ray, HitVisitor visit_hit,
+                                          GenericVisitor visit_generic) const {
+    const uint32_t * const leaf_refs = &primitive_refs[refs_offset];
+    const bool batched = (count >= BATCH_TRIANGLES_COUNT);
+
+    uint32_t batch[RayPacket::SIZE];
+    int batch_size = 0;
+    // the scalar test of the nearest triangle of batch fills the hit,
+    // it gives exactly the same t
+    auto visit_batch = [&]() {
+        Float t;
+        const int nearest = nearest_triangle(ray, batch, batch_size, t);
+        batch_size = 0;
+        HitRecord hit;
+        return (nearest >= 0) && intersect_primitive(batch[nearest], ray, hit)
+                && visit_hit(batch[nearest], hit);
+    };
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t ref = leaf_refs[i];
+        const uint32_t type = ref & TYPE_MASK;
+
+        if (batched && ((type == Primitive::TRIANGLE) || (type == Primitive::MESH))) {
+            batch[batch_size++] = ref;
+            if ((batch_size == RayPacket::SIZE) && visit_batch()) {
+                return true;
+            }
+            continue;
+        }
+
+        if (type == Primitive::GENERIC) {
+            if (visit_generic(ref)) {
+                return true;
+            }
+            continue;
+        }
+
+        HitRecord hit;
+        if (intersect_primitive(ref, ray, hit) && visit_hit(ref, hit)) {
+            return true;
+        }
+    }
+    return batch_size && visit_batch();
+}
+
+template <class Traversal>
+PACKET_INLINE bool Accelerator::find_nearest_hit(const Point3d &vector_start,
+                                                 const Vector3d &vector, HitRecord &hit,
+                                                 Traversal traverse) const {
+    const ShearedRay ray(vector_start, vector);
+    uint32_t nearest_ref = NO_REF;
+    HitRecord nearest_hit;
+
+    traverse(nearest_hit.t, [&](const uint32_t refs_offset, const uint32_t count) {
+        return visit_primitives(refs_offset, count, ray,
+                                [&](const uint32_t ref, const HitRecord &primitive_hit) {
+            if (primitive_hit.t < nearest_hit.t) {
+                nearest_ref = ref;
+                nearest_hit = primitive_hit;
+            }
+            return false;
+        });
+    });
+
+    if (nearest_ref == NO_REF) {
+        return false;
+    }
+
+    if (nearest_hit.t < hit.t) {
+        complete_hit(nearest_ref, nearest_hit);
+        hit = nearest_hit;
+    }
+    return true;
+}
+
+template <class Traversal>
+PACKET_INLINE bool Accelerator::find_any_hit(const Point3d &vector_start,
+                                             const Vector3d &vector, const Float max_t,
+                                             Traversal traverse) const {
+    // Nodes a bit farther than max_t are still visited,
+    // they may hold an occluder exactly at max_t
+    const Float t_stop = max_t + EPSILON;
+
+    const ShearedRay ray(vector_start, vector);
+    bool occluded = false;
+    traverse(t_stop, [&](const uint32_t refs_offset, const uint32_t count) {
+        occluded = visit_primitives(refs_offset, count, ray,
+                                    [&](const uint32_t ref, const HitRecord &hit) {
+            (void)ref;
+            return hit.t <= max_t;
+        }, [&](const uint32_t ref) {
+            return primitive_objects[Primitive::GENERIC][ref >> TYPE_BITS]->is_occluded(
+                    ray.start, ray.vector, max_t);
+        });
+        return occluded;
+    });
+    return occluded;
+}
+
+#endif // ACCELERATOR_H
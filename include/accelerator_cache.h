@@ -0,0 +1,86 @@
+#ifndef ACCELERATOR_CACHE_H
+#define ACCELERATOR_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <include/accelerator.h>
+#include <include/cache_file.h>
+#include <include/wide_bvh.h>
+
+/*
+ * CacheFile of the built Accelerator, so static scenes are built once.
+ * Its arrays are the ones of the structure: its nodes, the references of
+ * leaves, faces of meshes and the indexes in objects of the primitives of
+ * every type. The arrays are copied from the mapped file, so the structure
+ * may be refitted; copies of primitives are taken from the objects.
+ *
+ * The file is valid for the key it was written with: a hash of the type
+ * of the structure and of the types and bounds of all primitives, which
+ * are all the builders see. The references of all nodes and primitives
+ * are checked when it is read, so a broken file is never used.
+ */
+class AcceleratorCache {
+public:
+    static const uint32_t VERSION = 2;
+    static const char * const SUFFIX;
+
+    // Reads the accelerator of objects from the file of their key in
+    // directory, or builds it and writes the file. One directory keeps
+    // accelerators of different scenes, files are never removed.
+    static Accelerator *build(const std::string &directory, const Accelerator::Type type,
+                              std::vector<Object3d *> &objects, const ThreadPool &pool);
+
+    static uint64_t get_key(const Accelerator::Type type,
+                            const std::vector<Object3d *> &objects);
+
+    // Returns false if the file can't be written.
+    // The accelerator must be of the type.
+    static bool write(const std::string &filename, const uint64_t key,
+                      const Accelerator::Type type, const Accelerator &accelerator);
+
+    // NULL if there is no valid cache with the key
+    static Accelerator *read(const std::string &filename, const uint64_t key,
+                             const Accelerator::Type type, std::vector<Object3d *> &objects);
+
+private:
+    enum Array {
+        NODES, PRIMITIVE_REFS, MESH_FACES,
+        // indexes of objects of the primitives, by Primitive::Type
+        PRIMITIVE_OBJECTS,
+        ARRAYS_COUNT = PRIMITIVE_OBJECTS + Primitive::TYPES_COUNT
+    };
+
+    static const char MAGIC[8];
+
+    // Bounds of primitives are hashed by chunks of KEY_CHUNK Floats
+    static const size_t KEY_CHUNK = 4096;
+
+    static size_t element_size(const int array, const Accelerator::Type type);
+    static std::vector<uint64_t> get_element_sizes(const Accelerator::Type type);
+
+    // The structure of the type with nothing built
+    static Accelerator *create(const Accelerator::Type type, std::vector<Object3d *> &objects);
+    static const void *get_nodes(const Accelerator &accelerator, const Accelerator::Type type,
+                                 size_t &count);
+    // Copies the primitives, false if they don't match the objects
+    static bool read_primitives(const std::vector<CacheFile::Array> &arrays,
+                                Accelerator &accelerator);
+    // Copies the nodes, false if they are broken
+    static bool read_nodes(const std::vector<CacheFile::Array> &arrays,
+                           const Accelerator::Type type, Accelerator &accelerator);
+
+    template <class T>
+    static void read_array(const std::vector<CacheFile::Array> &arrays, const int array,
+                           std::vector<T> &elements);
+    // Nodes are stored depth-first, every one is referenced once, leaves
+    // reference primitive_refs, nodes are not deeper than max_depth
+    template <class Node>
+    static bool check_binary_nodes(const std::vector<Node> &nodes, const size_t refs_count,
+                                   const int max_depth);
+    template <int WIDTH>
+    static bool check_wide_nodes(const WideBVH<WIDTH> &tree);
+};
+
+#endif // ACCELERATOR_CACHE_H
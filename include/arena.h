@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Bump allocator for objects released together. Memory is taken from
+ * blocks of BLOCK_SIZE bytes (larger objects get their own block), so
+ * objects created one after another are contiguous. The arena calls
+ * destructors of created objects in the reverse order and frees all
+ * blocks at once when it is destroyed.
+ */
+class Arena {
+public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    Arena();
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(const size_t size, const size_t alignment);
+
+    template <class T, class ... Args>
+    T *create(Args&& ... args) {
+        T * const object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back({&destroy<T>, object});
+        }
+        return object;
+    }
+
+    size_t get_memory() const; // bytes in blocks
+
+private:
+    class Destructor {
+    public:
+        void (*destroy)(void *object);
+        void *object;
+    };
+
+    template <class T>
+    static void destroy(void *object) {
+        static_cast<T *>(object)->~T();
+    }
+
+    std::vector<char *> blocks;
+    std::vector<Destructor> destructors;
+    char *free_begin;
+    char *free_end;
+    size_t memory;
+};
+
+#endif // ARENA_H
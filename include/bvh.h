@@ -0,0 +1,230 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <include/accelerator.h>
+
+/*
+ * Bounding volume hierarchy built by binned Surface Area Heuristic
+ * (see src/bvh_builder.cpp). Every primitive is referenced by exactly one
+ * leaf, so objects are never duplicated as in KDTree, but boxes of
+ * children may overlap.
+ */
+class BVH : public Accelerator {
+    friend class AcceleratorCache;
+
+public:
+    BVH(std::vector<Object3d *> &objects, const ThreadPool &pool);
+    virtual bool find_intersection_tree(const Point3d vector_start,
+                                        const Vector3d vector,
+                                        HitRecord &hit) const;
+    virtual int find_intersection_packet(const RayPacket &packet, HitRecord hits[]) const;
+    virtual bool is_occluded(const Point3d vector_start, const Vector3d vector,
+                             const Float max_t) const;
+    virtual Statistics get_statistics() const;
+    // Boxes are refitted to the moved objects. Subtrees whose boxes grew
+    // too much are built again, if the tree is still too slow, it must
+    // be built again as a whole.
+    virtual bool refit(const ThreadPool &pool);
+    virtual ~BVH();
+
+protected:
+    static const int MAX_TREE_DEPTH = 64;
+    static const int BINS_COUNT = 32;
+    // Nodes with more objects are splitted even if SAH prefers a leaf
+    static const uint32_t MAX_LEAF_OBJECTS = 8;
+    static const uint32_t LEAF = 3;
+
+    // Surface area heuristic costs, the same as the ones of KDTree
+    static constexpr Float TRAVERSAL_COST = 1.;
+    static constexpr Float INTERSECTION_COST = 1.5;
+    // Far distances to boxes are enlarged by it, so rounding errors don't
+    // cull boxes just touched by the ray (see: T. Ize, "Robust BVH Ray
+    // Traversal", 2013)
+    static constexpr Float ROBUST_FACTOR = 1. + 6. * std::numeric_limits<Float>::epsilon();
+    // Refitted trees with higher SAH cost than built_cost * MAX_REFIT_COST_RATIO
+    // must be built again
+    static constexpr Float MAX_REFIT_COST_RATIO = 1.25;
+
+    // Axis-aligned box with float coordinates, empty boxes have min > max
+    class Box {
+    public:
+        Box() {
+            for (int axis = 0; axis < 3; ++axis) {
+                min[axis] = FLT_MAX;
+                max[axis] = -FLT_MAX;
+            }
+        }
+
+        // The smallest box with float coordinates containing the points
+        Box(const Point3d &min_point, const Point3d &max_point) {
+            min[0] = float_below(min_point.x);
+            min[1] = float_below(min_point.y);
+            min[2] = float_below(min_point.z);
+            max[0] = float_above(max_point.x);
+            max[1] = float_above(max_point.y);
+            max[2] = float_above(max_point.z);
+        }
+
+        void extend(const Box &other) {
+            for (int axis = 0; axis < 3; ++axis) {
+                min[axis] = std::min(min[axis], other.min[axis]);
+                max[axis] = std::max(max[axis], other.max[axis]);
+            }
+        }
+
+        Float surface_area() const {
+            if (min[0] > max[0]) {
+                return 0.;
+            }
+            const Float hx = max[0] - min[0];
+            const Float hy = max[1] - min[1];
+            const Float hz = max[2] - min[2];
+            return 2. * (hx * hy + hx * hz + hy * hz);
+        }
+
+        Float centroid(const int axis) const {
+            return 0.5 * ((Float) min[axis] + max[axis]);
+        }
+
+        // The ray start + t * (1 / inv_vector), 0 <= t <= t_stop,
+        // intersects the box
+        bool clip_ray(const Float start[], const Float inv_vector[],
+                      const Float t_stop) const;
+        // clip_ray() for every lane, returns lanes of rays hitting the box
+        int clip_packet(const Float start[], const RayPacket::Lanes inv_vector[],
+                        const RayPacket::Lanes &t_stop) const;
+
+        float min[3];
+        float max[3];
+    };
+
+    // Node of the tree while it is built, leaves reference
+    // the range [begin, end) of the ids of build items
+    class BuildNode {
+    public:
+        BuildNode(const Box &box, const uint32_t begin, const uint32_t end)
+            : box(box), axis(LEAF), begin(begin), end(end), l(NULL), r(NULL) {
+        }
+
+        ~BuildNode();
+        Box box;
+        uint32_t axis;
+        uint32_t begin;
+        uint32_t end;
+        BuildNode *l;
+        BuildNode *r;
+    };
+
+    class Builder;
+
+    // SAH cost of the tree after the build
+    Float built_cost;
+
+    // Nothing is built, for derived classes building other trees
+    explicit BVH(std::vector<Object3d *> &objects);
+
+    // Binary tree of all items, ids are ordered so that leaves
+    // reference their ranges
+    BuildNode *build_tree(const std::vector<BuildItem> &items, std::vector<uint32_t> &ids,
+                          const ThreadPool &pool) const;
+    // Box of count primitives of primitive_refs from offset
+    Box get_refs_box(const uint32_t offset, const uint32_t count) const;
+
+private:
+    // Node of the built tree, 32 bytes. The tree is stored depth-first in
+    // one array, the left child of inner node is the next node after it,
+    // the right one is referenced by index. The left child has lower
+    // centroids along the split axis. Leaves reference a range
+    // of primitive_refs.
+    class FlatNode {
+    public:
+        static FlatNode inner(const Box &box, const uint32_t axis, const uint32_t right) {
+            FlatNode node;
+            node.box = box;
+            node.index = right;
+            node.info = axis;
+            return node;
+        }
+
+        static FlatNode leaf(const Box &box, const uint32_t objects_offset,
+                             const uint32_t objects_count) {
+            FlatNode node;
+            node.box = box;
+            node.index = objects_offset;
+            node.info = (objects_count << 2) | LEAF;
+            return node;
+        }
+
+        uint32_t axis() const {
+            return info & 3;
+        }
+
+        bool is_leaf() const {
+            return axis() == LEAF;
+        }
+
+        uint32_t right() const {
+            return index;
+        }
+
+        uint32_t objects_offset() const {
+            return index;
+        }
+
+        uint32_t objects_count() const {
+            return info >> 2;
+        }
+
+        Box box;
+
+    private:
+        // index of the right child or offset of objects
+        uint32_t index;
+        // 2 low bits - split axis, LEAF for leaves,
+        // the rest - count of objects
+        uint32_t info;
+    };
+
+    // Subtrees of refitted tree whose boxes grew more than
+    // MAX_REFIT_AREA_RATIO times since they were built are built again
+    static constexpr Float MAX_REFIT_AREA_RATIO = 2.;
+
+    std::vector<FlatNode> nodes;
+    // Surface areas of nodes when they were built
+    std::vector<float> built_areas;
+
+    // find_intersection_packet() compiled for the instruction set of
+    // the CPU (PACKET_KERNEL), virtual functions can't be multiversioned
+    int traverse_packet(const RayPacket &packet, HitRecord hits[]) const;
+
+    template <class LeafVisitor>
+    void traverse(const Point3d &vector_start, const Vector3d &vector,
+                  const Float &t_stop, LeafVisitor visit_leaf) const;
+
+    // Tree of the boxes, the root is at depth
+    BuildNode *build_tree(const std::vector<Box> &boxes, std::vector<uint32_t> &ids,
+                          const ThreadPool &pool, const int depth) const;
+    uint32_t flatten(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                     const std::vector<BuildItem> &items, std::vector<uint32_t> &mesh_indexes);
+
+    // The node after the last one of the subtree
+    uint32_t subtree_end(const uint32_t node) const;
+    // Replaces the subtree by a new one built over its primitives
+    void rebuild_subtree(const uint32_t node, const int depth, const ThreadPool &pool);
+    // flatten() of the tree built over refs, nodes go to subtree_nodes,
+    // which will be placed from first_node, refs of leaves are written
+    // to primitive_refs from next_ref
+    uint32_t flatten_refs(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                          const std::vector<uint32_t> &refs, const uint32_t first_node,
+                          uint32_t &next_ref, std::vector<FlatNode> &subtree_nodes);
+
+    void collect_statistics(const uint32_t node, const int depth, Statistics &stats) const;
+};
+
+#endif // BVH_H
@@ -0,0 +1,75 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <include/mapped_file.h>
+
+/*
+ * Binary file of arrays kept between runs: MeshCache and AcceleratorCache.
+ * The file is a Header, the table of arrays and the arrays, every array
+ * starts at ALIGNMENT bytes, so it may be used right from the mapped file.
+ *
+ * The file is valid for the magic of the format, its version and the key
+ * it was written with, for the same byte order and Float. Arrays must fit
+ * in the file and have the element sizes the reader expects.
+ */
+class CacheFile {
+public:
+    static const size_t ALIGNMENT = 64;
+
+    // element_size bytes per element
+    class Array {
+    public:
+        const void *data;
+        uint64_t size;
+        uint64_t element_size;
+    };
+
+    // Writes a temporary file of a unique name and renames it, so the
+    // file is never seen written in part. Returns false if the file
+    // can't be written.
+    static bool write(const std::string &filename, const char magic[8], const uint32_t version,
+                      const uint64_t key, const std::vector<Array> &arrays);
+
+    // NULL if there is no valid file of the format with the key and with
+    // arrays of element_sizes
+    static std::unique_ptr<const MappedFile> open(const std::string &filename,
+                                                  const char magic[8], const uint32_t version,
+                                                  const uint64_t key,
+                                                  const std::vector<uint64_t> &element_sizes);
+
+    // Arrays of the file returned by open(), they are views of the file
+    static std::vector<Array> get_arrays(const MappedFile &file);
+
+private:
+    class Header {
+    public:
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order; // BYTE_ORDER_MARK written on this machine
+        uint32_t float_size; // sizeof(Float)
+        uint32_t arrays_count;
+        uint64_t key;
+    };
+
+    // Entry of the table of arrays, after the header
+    class ArrayEntry {
+    public:
+        uint64_t offset; // from the file start
+        uint64_t size;
+        uint64_t element_size;
+    };
+
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    static uint64_t align(const uint64_t offset);
+    // Unique for every process and thread, so writers of one file don't mix
+    static std::string temp_filename(const std::string &filename);
+};
+
+#endif // CACHE_FILE_H
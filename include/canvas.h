@@ -4,38 +4,81 @@
 #include <QPainter>
 #include <QPicture>
 
+#include <cstdint>
+#include <memory>
+
 #include <include/color.h>
 
+/*
+ * Canvas keeps pixels in its own contiguous buffer, row after row.
+ * Every row starts at a cache line boundary, so threads rendering
+ * different tiles never write the same cache line of a row start and
+ * row(y)[x] is the cheapest possible pixel access.
+ *
+ * Pixel layout is 0xffRRGGBB, the same as QImage::Format_RGB32, so
+ * getQImage() wraps the buffer without copying.
+ */
 class Canvas {
 public:
+    typedef uint32_t Pixel;
+
     Canvas(const char * const file_name);
     Canvas(size_t width, size_t height);
+    Canvas(const Canvas &other);
+    Canvas(Canvas &&other) = default;
+    Canvas &operator=(const Canvas &other);
+    Canvas &operator=(Canvas &&other) = default;
+
     Canvas grayscale() const;
     Canvas detect_edges() const;
 
+    // No bounds checks, (x, y) must be inside of canvas
     void set_pixel(int x, int y, Color c) {
-        img_.setPixelColor(x, y, QColor(c.r(), c.g(), c.b()));
+        row(y)[x] = to_pixel(c);
     }
 
     Color get_pixel(int x, int y) const;
 
-    QImage getQImage() {
-        return img_;
+    Pixel *row(int y) {
+        return data_.get() + y * stride_;
+    }
+
+    const Pixel *row(int y) const {
+        return data_.get() + y * stride_;
+    }
+
+    static Pixel to_pixel(const Color &c) {
+        return 0xff000000u | (c.r() << 16) | (c.g() << 8) | c.b();
+    }
+
+    static Color to_color(const Pixel p) {
+        return Color((p >> 16) & 0xff, (p >> 8) & 0xff, p & 0xff);
     }
 
+    // Shares the buffer with the canvas, the buffer lives
+    // as long as any of them
+    QImage getQImage() const;
+
     size_t width() const {
-        return img_.width();
+        return width_;
     }
 
     size_t height() const {
-        return img_.height();
+        return height_;
     }
 
     void read_png(const char * const file_name);
     void write_png(const char * const file_name) const;
     void clear();
 private:
-    QImage img_;
+    static const size_t ROW_ALIGNMENT = 64; // bytes
+
+    void allocate(size_t width, size_t height);
+
+    size_t width_;
+    size_t height_;
+    size_t stride_; // in pixels
+    std::shared_ptr<Pixel> data_;
 };
 
 #endif //__CANVAS_H__
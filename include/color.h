@@ -5,8 +5,19 @@
 #include <cmath>
 #include <cstdint>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <include/utils.h>
+
 typedef uint8_t Byte;
 
+/*
+ * Operations are inline, they are called several times for every hit.
+ * add() and mix() work on all channels at once: with SSE2 in xmm
+ * registers, otherwise packed into one 32-bit integer.
+ */
 class Color {
 public:
     Color() : Color(0, 0, 0) {
@@ -15,16 +26,40 @@ public:
     Color(Byte r, Byte g, Byte b) : r_(r), g_(g), b_(b) {
     }
 
+    // Channels are added with saturation
     static Color add(const Color& a, const Color& b) {
-        return a.add_(b);
+        const uint32_t x = a.pack();
+        const uint32_t y = b.pack();
+#ifdef __SSE2__
+        return unpack(_mm_cvtsi128_si32(_mm_adds_epu8(_mm_cvtsi32_si128(x),
+                                                      _mm_cvtsi32_si128(y))));
+#else
+        // sums of 7 low bits, then the high bits are added without carry
+        const uint32_t low_sum = (x & 0x7f7f7f) + (y & 0x7f7f7f);
+        const uint32_t sum = low_sum ^ ((x ^ y) & 0x808080);
+        // channels with the carry out of the high bit
+        const uint32_t carry = ((x & y) | ((x | y) & ~sum)) & 0x808080;
+        return unpack(sum | ((carry >> 7) * 0xff));
+#endif
     }
 
+    // r * other.r / 256 and so on
     static Color mix(const Color& a, const Color& b) {
-        return a.mix_(b);
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a.pack()), zero);
+        const __m128i y = _mm_unpacklo_epi8(_mm_cvtsi32_si128(b.pack()), zero);
+        const __m128i product = _mm_srli_epi16(_mm_mullo_epi16(x, y), 8);
+        return unpack(_mm_cvtsi128_si32(_mm_packus_epi16(product, zero)));
+#else
+        return Color((a.r_ * b.r_) >> 8, (a.g_ * b.g_) >> 8, (a.b_ * b.b_) >> 8);
+#endif
     }
 
-    static Color multiply(const Color& c, double k) {
-        return c.multiply_(k);
+    // Channels are truncated, the ones above the maximum are saturated
+    static Color multiply(const Color& c, const Float k) {
+        return Color(multiply(c.r_, k, MAX_R), multiply(c.g_, k, MAX_G),
+                     multiply(c.b_, k, MAX_B));
     }
 
     Color grayscale() const;
@@ -46,9 +81,18 @@ public:
     static const Byte MAX_B = 255;
 
 private:
-    Color mix_(const Color& other) const;
-    Color add_(const Color& other) const;
-    Color multiply_(double k) const;
+    static Byte multiply(const Byte channel, const Float k, const Byte max) {
+        return (Byte)std::min(channel * k, (Float)max);
+    }
+
+    // r, g and b in the low bytes of 32-bit integer
+    uint32_t pack() const {
+        return r_ | (g_ << 8) | (b_ << 16);
+    }
+
+    static Color unpack(const uint32_t channels) {
+        return Color(channels & 0xff, (channels >> 8) & 0xff, (channels >> 16) & 0xff);
+    }
 
     Byte r_;
     Byte g_;
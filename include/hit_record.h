@@ -0,0 +1,35 @@
+#ifndef HIT_RECORD_H
+#define HIT_RECORD_H
+
+#include <cstdint>
+
+#include <include/utils.h>
+
+class Object3d;
+
+/*
+ * Intersection of the ray vector_start + t * vector with the object.
+ * intersect() fills everything it finds on the way, so shading doesn't
+ * compute it again.
+ */
+class HitRecord {
+public:
+    HitRecord() : object(NULL), primitive(0), t(FLOAT_MAX), u(0.), v(0.) {
+    }
+
+    Object3d *object;
+    // Face of the mesh or triangle of the quadrangle (0 - the first one),
+    // 0 for other objects
+    uint32_t primitive;
+    Point3d point;
+    Float t;
+    // Barycentric coordinates of the point in the triangle: weights
+    // of the 2nd and the 3rd vertexes, the 1st one has 1 - u - v
+    Float u;
+    Float v;
+    // Geometric normal, not normalized. Accelerator fills it for the objects
+    // with primitives (see Object3d::get_primitive()).
+    Vector3d normal;
+};
+
+#endif // HIT_RECORD_H
@@ -1,24 +1,47 @@
 #ifndef __KD_TREEE_H__
 #define __KD_TREEE_H__
 
-#include <include/objects.h>
+#include <cstdint>
+#include <vector>
 
+#include <include/accelerator.h>
+
+
+/*
+ * kd-tree built by Surface Area Heuristic (see src/kdtree_builder.cpp).
+ * Objects straddling a split plane are referenced from both children.
+ */
+class KDTree : public Accelerator {
+    friend class AcceleratorCache;
 
-class KDTree {
 public:
-    KDTree(std::vector<Object3d *> &objects);
-    bool find_intersection_tree(const Point3d vector_start,
-                                const Vector3d vector,
-                                Object3d *&nearest_obj_ptr,
-                                Point3d &nearest_intersection_point_ptr,
-                                Float &nearest_intersection_point_dist_ptr);
-    ~KDTree();
+    // SAH_SWEEP evaluates every object boundary as a split candidate,
+    // SAH_BINNED only BINS_COUNT - 1 candidates per axis, but is faster
+    enum BuildMethod {SAH_SWEEP, SAH_BINNED};
+
+    KDTree(std::vector<Object3d *> &objects, const ThreadPool &pool,
+           BuildMethod method = SAH_SWEEP);
+    virtual bool find_intersection_tree(const Point3d vector_start,
+                                        const Vector3d vector,
+                                        HitRecord &hit) const;
+    virtual int find_intersection_packet(const RayPacket &packet, HitRecord hits[]) const;
+    virtual bool is_occluded(const Point3d vector_start, const Vector3d vector,
+                             const Float max_t) const;
+    virtual Statistics get_statistics() const;
+    // Always false: objects are clipped by split planes, the tree
+    // is built again when they move
+    virtual bool refit(const ThreadPool &pool);
+    virtual ~KDTree();
 
 private:
-    static const int MAX_TREE_DEPTH = 20;
-    static const int OBJECTS_IN_LEAF = 1;
-    static const int MAX_SPLITS_OF_VOXEL = 5;
-    static const int SPLIT_COST = 5;
+    static const int MAX_TREE_DEPTH = 40;
+    static const int BINS_COUNT = 32;
+
+    // Surface area heuristic costs
+    static constexpr Float TRAVERSAL_COST = 1.;
+    static constexpr Float INTERSECTION_COST = 1.5;
+    // Cost discount for splits which cut off empty space
+    static constexpr Float EMPTY_BONUS = 0.2;
 
     enum Plane {XY, XZ, YZ, NONE};
 
@@ -34,33 +57,21 @@ private:
 
         Voxel(const std::vector<Object3d*> &objects);
 
-        bool is_in(Object3d * const obj) const;
-        bool is_in(const Point3d p) const;
-
-        int count_objects_in(const std::vector<Object3d*> &objects) const;
+        // Coordinates along the normal of plane
+        Float get_min(const enum Plane p) const;
+        Float get_max(const enum Plane p) const;
 
-        void find_plane(const std::vector<Object3d*> &objects,
-                        const int tree_depth,
-                        enum Plane &p,
-                        Point3d &c) const;
+        Float surface_area() const;
+        Voxel clip(const Voxel &other) const;
+        // The smallest voxel with float coordinates containing this one
+        Voxel round_out_to_float() const;
 
         void split(const enum Plane p, const Point3d c,
                          Voxel &vl, Voxel &vr) const;
 
-        inline bool x_in_voxel(const Float x) const;
-        inline bool y_in_voxel(const Float y) const;
-        inline bool z_in_voxel(const Float z) const;
-        bool intersection(const Vector3d vector,
-                                const Point3d vector_start) const;
-
-
-        static bool vector_plane_intersection(const Vector3d vector,
-                                              const Point3d vector_start,
-                                              const enum Plane plane,
-                                              const Point3d coord,
-                                              Point3d &result);
-
-        std::vector<Object3d*> filter_overlapped_objects(const std::vector<Object3d*> &objects) const;
+        // Interval of the ray inside of the voxel
+        bool clip_ray(const Point3d &vector_start, const Vector3d &vector,
+                      Float &t_min, Float &t_max) const;
 
         Float x_min;
         Float y_min;
@@ -71,38 +82,111 @@ private:
         Float z_max;
     };
 
+    // Node of the tree while it is built
     class KDNode {
     public:
         KDNode(): l(NULL), r(NULL) {
         }
 
-        KDNode(enum Plane plane, const Point3d &coord,
-               const std::vector<Object3d*> &objects, KDNode *l, KDNode *r)
-            : plane(plane), coord(coord), objects(objects), l(l), r(r) {
+        KDNode(enum Plane plane, const Point3d &coord, KDNode *l, KDNode *r)
+            : plane(plane), coord(coord), l(l), r(r) {
         }
 
-        KDNode(const std::vector<Object3d*> &objects);
+        KDNode(const std::vector<uint32_t> &objects);
 
         ~KDNode();
         enum Plane plane;
         Point3d coord;
-        std::vector<Object3d*> objects;
+        std::vector<uint32_t> objects; // indexes of build items
         KDNode *l;
         KDNode *r;
     };
 
-    KDNode * root;
+    // Node of the built tree, 8 bytes. The tree is stored depth-first in
+    // one array, the left child of inner node is the next node after it,
+    // the right one is referenced by index. Leaves reference a range
+    // of primitive_refs.
+    class FlatNode {
+    public:
+        static FlatNode inner(const enum Plane plane, const float split,
+                              const uint32_t right) {
+            FlatNode node;
+            node.split_ = split;
+            node.info = (right << 2) | plane;
+            return node;
+        }
+
+        static FlatNode leaf(const uint32_t objects_offset,
+                             const uint32_t objects_count) {
+            FlatNode node;
+            node.objects_offset_ = objects_offset;
+            node.info = (objects_count << 2) | NONE;
+            return node;
+        }
+
+        enum Plane plane() const {
+            return (enum Plane) (info & 3);
+        }
+
+        bool is_leaf() const {
+            return plane() == NONE;
+        }
+
+        float split() const {
+            return split_;
+        }
+
+        uint32_t right() const {
+            return info >> 2;
+        }
+
+        uint32_t objects_offset() const {
+            return objects_offset_;
+        }
+
+        uint32_t objects_count() const {
+            return info >> 2;
+        }
+
+    private:
+        union {
+            float split_;
+            uint32_t objects_offset_;
+        };
+        // 2 low bits - plane, NONE for leaves,
+        // the rest - index of the right child or count of objects
+        uint32_t info;
+    };
+
+    class SplitEvent;
+    class SweepBuilder;
+    class BinnedBuilder;
+
+    std::vector<FlatNode> nodes;
+
     Voxel bounding_box;
 
-    bool find_intersection_node(KDNode * const node,
-                                const Voxel v,
-                                const Point3d vector_start,
-                                const Vector3d vector,
-                                Object3d *&nearest_obj_ptr,
-                                Point3d &nearest_intersection_point_ptr,
-                                Float &nearest_intersection_point_dist_ptr);
+    // Nothing is built, for AcceleratorCache
+    KDTree(std::vector<Object3d *> &objects, const Voxel &bounding_box);
+
+    static Point3d plane_coord(const enum Plane p, const Float position);
+    static Float split_cost(const Voxel &v, const enum Plane p, const Float position,
+                            const size_t left_count, const size_t right_count);
+    static int max_depth_for(const size_t objects_count);
+
+    // find_intersection_packet() compiled for the instruction set of
+    // the CPU (PACKET_KERNEL), virtual functions can't be multiversioned
+    int traverse_packet(const RayPacket &packet, HitRecord hits[]) const;
+
+    template <class LeafVisitor>
+    void traverse(const Point3d &vector_start, const Vector3d &vector,
+                  const Float &t_stop, LeafVisitor visit_leaf) const;
+
+    uint32_t flatten(const KDNode * const node, const std::vector<BuildItem> &items,
+                     std::vector<uint32_t> &item_refs, std::vector<uint32_t> &mesh_indexes);
 
-    static KDNode* rec_build(std::vector<Object3d*> &objects, Voxel v, int iter);
+    void collect_statistics(const uint32_t node, const Voxel &v, const int depth,
+                            Statistics &stats) const;
 };
 
 
@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only contents of the whole file. The file is memory-mapped where
+ * mmap() is available, so pages are read by the OS when they are touched
+ * and nothing is copied; otherwise the file is read into memory.
+ */
+class MappedFile {
+public:
+    // How the contents are read, a hint to the OS for reading pages ahead
+    enum Access {
+        RANDOM_ACCESS,
+        // from the beginning to the end, once
+        SEQUENTIAL_ACCESS
+    };
+
+    // Throws std::runtime_error if the file can't be opened
+    explicit MappedFile(const std::string &filename, const Access access = RANDOM_ACCESS);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char *data_;
+    size_t size_;
+    bool mapped;
+    // contents if the file is not mapped
+    std::vector<char> buffer;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,83 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <include/color.h>
+#include <include/utils.h>
+
+class Material {
+public:
+    Material() : Material(1., 1., 0., 0., 0., 0.) {
+    }
+
+    Material(const Float &Ka, const Float &Kd, const Float &Ks,
+             const Float &Kr, const Float &Kt, const Float &p) : IOR(1.), p(p) {
+        Float sum = Ka + Kd + Ks + Kr + Kt;
+        this->Ka = Ka / sum;
+        this->Kd = Kd / sum;
+        this->Ks = Ks / sum;
+        this->Kr = Kr / sum;
+        this->Kt = Kt / sum;
+        this->IOR = 1.;
+    }
+
+    Material(const Float &Ka, const Float &Kd, const Float &Ks,
+             const Float &Kr, const Float &Kt, const Float &p, const Float& IOR)
+             : IOR(IOR), p(p) {
+        Float sum = Ka + Kd + Ks + Kr + Kt;
+        this->Ka = Ka / sum;
+        this->Kd = Kd / sum;
+        this->Ks = Ks / sum;
+        this->Kr = Kr / sum;
+        this->Kt = Kt / sum;
+    }
+
+    bool operator==(const Material &other) const {
+        return (Ka == other.Ka) && (Kd == other.Kd) && (Ks == other.Ks)
+                && (Kr == other.Kr) && (Kt == other.Kt) && (IOR == other.IOR)
+                && (p == other.p);
+    }
+
+    Float Ka; // ambient
+    Float Kd; // diffuse
+    Float Ks; // specular
+    Float Kr; // reflection
+    Float Kt; // transparency
+
+    Float IOR; // in_IOR/out_IOR
+
+    Float p; // specular * lisht_source_color * ((cos(..))^p)
+};
+
+typedef uint16_t MaterialId;
+
+/*
+ * Colors and materials of the scene objects. Objects keep only the id
+ * of their color and material, so all objects with the same surface
+ * share one entry and shading reads it without copying.
+ */
+class MaterialTable {
+public:
+    static const size_t MAX_MATERIALS_COUNT = UINT16_MAX + 1;
+
+    // Returns the id of the equal entry if the table has it
+    MaterialId add(const Color &color, const Material &material);
+
+    const Material &get_material(const MaterialId id) const {
+        return materials[id];
+    }
+
+    Color get_color(const MaterialId id) const {
+        return colors[id];
+    }
+
+    size_t size() const;
+
+protected:
+    std::vector<Material> materials;
+    std::vector<Color> colors;
+};
+
+#endif // MATERIAL_TABLE_H
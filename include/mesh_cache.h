@@ -0,0 +1,54 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <include/cache_file.h>
+#include <include/mapped_file.h>
+#include <include/triangle_mesh.h>
+
+/*
+ * CacheFile of the TriangleMesh arrays, so the model is parsed and
+ * transformed once. Arrays of the mesh read from the cache are views of
+ * the mapped file, they are not copied.
+ *
+ * The file is valid for the key it was written with (a hash of the source
+ * file and of the parameters of loading). Sizes of the arrays and all
+ * indexes of faces are checked when it is opened, so a broken file is
+ * never used.
+ */
+class MeshCache {
+public:
+    static const uint32_t VERSION = 2;
+
+    static bool write(const std::string &filename, const uint64_t key,
+                      const TriangleMesh &mesh);
+
+    // NULL if there is no valid cache with the key
+    static std::unique_ptr<const MappedFile> open(const std::string &filename,
+                                                  const uint64_t key);
+
+    // The mesh keeps the file and its arrays become views of it,
+    // the file must be returned by open()
+    static void read(std::unique_ptr<const MappedFile> file, TriangleMesh &mesh);
+
+private:
+    enum Array {
+        XS, YS, ZS, NXS, NYS, NZS, TUS, TVS,
+        VERTEX_INDEXES, NORMAL_INDEXES, TEXTURE_INDEXES,
+        // min and max points of the faces, as doubles
+        BOUNDS, ARRAYS_COUNT
+    };
+
+    static const char MAGIC[8];
+
+    static std::vector<uint64_t> get_element_sizes();
+    // Indexes of faces are less than limit, optional ones may be NO_INDEX
+    static bool check_indexes(const CacheFile::Array &array, const uint64_t limit,
+                              const bool optional);
+};
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,65 @@
+#ifndef MESH_INSTANCE_H
+#define MESH_INSTANCE_H
+
+#include <include/accelerator.h>
+#include <include/objects.h>
+#include <include/transform.h>
+#include <include/triangle_mesh.h>
+
+/*
+ * Copy of the mesh placed in the scene by the transform from object to
+ * world coordinates. All instances of the mesh share it and its
+ * accelerator built in object coordinates (the bottom level), the scene
+ * accelerator has instances as objects (the top level). The ray reaching the instance
+ * is transformed into object coordinates, its vector is not normalized,
+ * so t of the hit is the same in both.
+ *
+ * Hits are the ones of the mesh: hit.primitive is the face, hit.u and
+ * hit.v are its barycentric coordinates, hit.point and hit.normal are
+ * in world coordinates.
+ */
+class MeshInstance : public Object3d {
+public:
+    // Throws std::runtime_error if the transform is degenerate
+    MeshInstance(const TriangleMesh * const mesh, const Transform &transform,
+                 const MaterialId material_id);
+
+    const TriangleMesh *get_mesh() const;
+    // The tree of the mesh must be set before the ray tracing
+    void set_mesh_tree(const Accelerator * const tree);
+    // Moves the instance, Scene::refit_kd_tree() must be called before
+    // the ray tracing. Throws std::runtime_error if the transform is
+    // degenerate, then the instance is not moved.
+    void set_transform(const Transform &transform);
+
+    virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                           HitRecord &hit) const;
+    // Any-hit search of the mesh tree
+    virtual bool is_occluded(const Point3d &vector_start, const Vector3d &vector,
+                             const Float max_t) const;
+
+    // Faces with texture points have the color of the mesh texture
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
+    virtual Point3d get_min_boundary_point() const;
+    virtual Point3d get_max_boundary_point() const;
+    virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
+                                 LightSource3d &ls_secondary) const;
+    // The same as for meshes
+    virtual bool has_secondary_light() const;
+
+protected:
+    const TriangleMesh *mesh;
+    const Accelerator *mesh_tree;
+    Transform to_world;
+    Transform to_object;
+
+    // bounds of the transformed mesh bounds
+    Point3d min_point;
+    Point3d max_point;
+
+    void update_bounds();
+};
+
+#endif // MESH_INSTANCE_H
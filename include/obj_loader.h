@@ -2,28 +2,60 @@
 #define _OBJ_LOADER_H_
 
 #include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <include/canvas.h>
 #include <include/color.h>
-#include <include/queue.h>
+#include <include/mapped_file.h>
 #include <include/scene.h>
-
-#include <fstream>
+#include <include/triangle_mesh.h>
 
 
+/*
+ * Loads the model into one TriangleMesh with default_color and
+ * default_material, textured if the texture is given and faces have
+ * texture points. Vertexes and normals are transformed once, when they
+ * are read.
+ *
+ * The file is memory-mapped and split at line ends into chunks which
+ * are parsed in parallel by the thread pool of the scene. Numbers are
+ * parsed in place with std::from_chars, so nothing is allocated per
+ * token. Negative indexes in faces count back from the last vertex,
+ * texture point or normal read before the face; they are resolved when
+ * the counts in the previous chunks are known.
+ *
+ * The loaded mesh is written to the MeshCache file next to the model
+ * (filename + MESH_CACHE_SUFFIX). Next loads of the same file with the
+ * same transform map the cache instead of parsing.
+ */
 class SceneFaceHandler {
 public:
     SceneFaceHandler(Scene * scene, Float scale,
                      Float dx, Float dy, Float dz,
                      Float al_x, Float al_y, Float al_z,
-                     Color default_color, Material default_material)
+                     Color default_color, Material default_material,
+                     const Canvas *texture = NULL)
         :scene(scene), scale(scale),
          dx(dx), dy(dy), dz(dz),
          sin_al_x(sin(al_x)), cos_al_x(cos(al_x)),
          sin_al_y(sin(al_y)), cos_al_y(cos(al_y)),
          sin_al_z(sin(al_z)), cos_al_z(cos(al_z)),
-         default_color(default_color), default_material(default_material) {
+         default_color(default_color), default_material(default_material),
+         texture(texture), mesh_cache(true) {
     }
 
+    // Throws std::runtime_error if the file can't be read or parsed
     void load_obj(std::string filename);
+    // The same as load_obj(), but the mesh is not added to the scene,
+    // so it can be placed by Scene::add_instance(). NULL if the model
+    // has no faces.
+    TriangleMesh *load_mesh(std::string filename);
+    // The cache is used unless it is disabled
+    void set_mesh_cache(const bool enabled);
+
+    static const char * const MESH_CACHE_SUFFIX;
 protected:
     Scene * scene;
 
@@ -35,17 +67,61 @@ protected:
 
     Color default_color;
     Material default_material;
+    const Canvas *texture;
+    bool mesh_cache;
+
+    // Chunks are not smaller, so small files are parsed by one thread
+    static const size_t MIN_CHUNK_SIZE = 256 * 1024;
+    static const size_t CHUNKS_PER_THREAD = 4;
+
+    // Triangle of the face with 0-based indexes. Negative indexes are
+    // counted from the end of the chunk elements, as unsigned numbers:
+    // adding the count of the elements in the previous chunks gives
+    // the index in the model.
+    class Triangle {
+    public:
+        static const int VERTEXES = 0;
+        static const int TEXTURE_POINTS = 3;
+        static const int NORMALS = 6;
+
+        // 3 vertexes, then 3 texture points and 3 normals,
+        // TriangleMesh::NO_INDEX if the face has no texture points or normals
+        uint32_t indexes[9];
+        // bit i is set if indexes[i] is counted in the chunk
+        uint16_t relative;
+    };
+
+    // Corner of the face being parsed, indexes are the ones of Triangle
+    class Corner {
+    public:
+        uint32_t indexes[3];
+        uint16_t relative;
+    };
 
-    std::vector<Point3d> vertexes;
-    std::vector<Vector3d> norm_vectors;
+    // Lines [begin, end) of the file
+    class Chunk {
+    public:
+        const char *begin;
+        const char *end;
 
-    void scene_face_handler(Queue<Point3d> &vertexes, Queue<Vector3d> &norm_vectors);
+        std::vector<Point3d> vertexes;
+        std::vector<Point2d> texture_points;
+        std::vector<Vector3d> normals;
+        std::vector<Triangle> triangles;
 
-    void parse_face(std::string &str);
-    void parse_vertex(std::ifstream &in);
-    void parse_norm_vector(std::ifstream &in);
-    void parse_face_str(char *str, int * v_index, int * vt_index, int * vn_index);
+        // face being parsed
+        std::vector<Corner> corners;
+    };
 
+    // Hash of the file and of the transform
+    uint64_t get_cache_key(const MappedFile &file) const;
+    void parse_chunk(Chunk &chunk) const;
+    const char *parse_vertex(const char *str, const char *end, Chunk &chunk) const;
+    const char *parse_texture_point(const char *str, const char *end, Chunk &chunk) const;
+    const char *parse_norm_vector(const char *str, const char *end, Chunk &chunk) const;
+    const char *parse_face(const char *str, const char *end, Chunk &chunk) const;
+    // Faces are fans of triangles around the first vertex
+    void add_triangles(Chunk &chunk, const bool textured, const bool normed) const;
 };
 
 
@@ -4,6 +4,9 @@
 #include <include/utils.h>
 #include <include/objects.h>
 #include <include/color.h>
+#include <include/hit_record.h>
+#include <include/material_table.h>
+#include <include/primitives.h>
 
 class LightSource3d {
 public:
@@ -17,59 +20,51 @@ public:
     Color color;
 };
 
-class Material {
+class Object3d {
 public:
-    Material() : Material(1., 1., 0., 0., 0., 0.) {
-    }
-
-    Material(const Float &Ka, const Float &Kd, const Float &Ks,
-             const Float &Kr, const Float &Kt, const Float &p) : IOR(1.), p(p) {
-        Float sum = Ka + Kd + Ks + Kr + Kt;
-        this->Ka = Ka / sum;
-        this->Kd = Kd / sum;
-        this->Ks = Ks / sum;
-        this->Kr = Kr / sum;
-        this->Kt = Kt / sum;
-        this->IOR = 1.;
+    Object3d(const MaterialId material_id) : material_id(material_id) {
     }
 
-    Material(const Float &Ka, const Float &Kd, const Float &Ks,
-             const Float &Kr, const Float &Kt, const Float &p, const Float& IOR)
-             : IOR(IOR), p(p) {
-        Float sum = Ka + Kd + Ks + Kr + Kt;
-        this->Ka = Ka / sum;
-        this->Kd = Kd / sum;
-        this->Ks = Ks / sum;
-        this->Kr = Kr / sum;
-        this->Kt = Kt / sum;
+    virtual ~Object3d() {
     }
 
-    Float Ka; // ambient
-    Float Kd; // diffuse
-    Float Ks; // specular
-    Float Kr; // reflection
-    Float Kt; // transparency
+    // Fills hit.point, hit.t and, for triangles, hit.u and hit.v
+    virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                           HitRecord &hit) const = 0;
 
-    Float IOR; // in_IOR/out_IOR
+    // Any intersection at t <= max_t, the nearest one is not searched
+    virtual bool is_occluded(const Point3d &vector_start, const Vector3d &vector,
+                             const Float max_t) const {
+        HitRecord hit;
+        return intersect(vector_start, vector, hit) && (hit.t <= max_t);
+    }
 
-    Float p; // specular * lisht_source_color * ((cos(..))^p)
-};
+    // Geometry of the object if its intersect() is the one of primitive,
+    // accelerators intersect such objects without virtual calls
+    virtual Primitive get_primitive() const {
+        return Primitive();
+    }
 
-class Object3d {
-public:
-    virtual ~Object3d() {
+    // Entry of the scene material table, the same for all points of the object
+    MaterialId get_material_id() const {
+        return material_id;
     }
 
-    virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
-                           Point3d &intersection_point) const = 0;
-    virtual Color get_color(const Point3d &intersection_point) const = 0;
-    virtual Vector3d get_normal_vector(const Point3d &intersection_point) const = 0;
-    virtual Material get_material(const Point3d &intersection_point) const = 0;
+    // The color of the material unless the object is textured
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const = 0;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const = 0;
     virtual Point3d get_min_boundary_point() const = 0;
     virtual Point3d get_max_boundary_point() const = 0;
-    virtual bool reflects() const = 0;
     virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
                                  LightSource3d &ls_secondary) const = 0;
+    // Reflecting objects are secondary light sources unless it is false
+    virtual bool has_secondary_light() const {
+        return true;
+    }
+
+protected:
+    MaterialId material_id;
 };
 
 #endif // OBJECTS_H
@@ -0,0 +1,448 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <cmath>
+
+#include <include/hit_record.h>
+#include <include/ray_packet.h>
+#include <include/utils.h>
+
+class TriangleMesh;
+
+/*
+ * Plain geometry of objects, without colors and materials. KDTree keeps
+ * primitives of every type in its own contiguous array and intersects
+ * them with inlined non-virtual functions.
+ *
+ * Vector operations are written by components, in the same order
+ * as Vector3d does them, so the results are exactly the same.
+ *
+ * intersect() fills point, t and barycentric coordinates of the hit,
+ * intersect_packet() does it for every lane intersecting the primitive.
+ */
+class TrianglePrimitive {
+public:
+    TrianglePrimitive() {
+    }
+
+    // Inline, TriangleMesh builds faces to get their normals
+    TrianglePrimitive(const Point3d &p1, const Point3d &p2, const Point3d &p3)
+        : p1(p1), p2(p2), p3(p3) {
+        // Vector3d::cross(Vector3d(p1, p3), Vector3d(p3, p2))
+        const Vector3d a(p3.x - p1.x, p3.y - p1.y, p3.z - p1.z);
+        const Vector3d b(p2.x - p3.x, p2.y - p3.y, p2.z - p3.z);
+        norm = Vector3d(a.z * b.y - a.y * b.z,
+                        a.x * b.z - a.z * b.x,
+                        a.y * b.x - a.x * b.y);
+    }
+
+    bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                   HitRecord &hit) const {
+        return intersect(ShearedRay(vector_start, vector), p1, p2, p3, hit);
+    }
+
+    bool intersect(const ShearedRay &ray, HitRecord &hit) const {
+        return intersect(ray, p1, p2, p3, hit);
+    }
+
+    PACKET_INLINE int intersect_packet(const RayPacket &packet, const PacketShear &shear,
+                                       const int lanes, HitRecord hits[]) const {
+        return intersect_packet(packet, shear, lanes, p1, p2, p3, hits);
+    }
+
+    /*
+     * Watertight test of the triangle p1, p2, p3 (see ShearedRay). The ray
+     * hits the triangle if it is on the same side of all edges in the
+     * sheared space. The sign of the edge shared by two triangles is
+     * computed from the same sheared vertexes by the same operations
+     * in both of them, so it is exactly opposite and the ray can't pass
+     * between the triangles. It needs a * b - c * d to be computed
+     * without FMA contraction, which is not used on baseline x86-64
+     * and AVX2 targets.
+     */
+    static bool intersect(const ShearedRay &ray, const Point3d &p1, const Point3d &p2,
+                          const Point3d &p3, HitRecord &hit) {
+        // vertexes relative to the start of ray
+        const Vector3d a(p1.x - ray.start.x, p1.y - ray.start.y, p1.z - ray.start.z);
+        const Vector3d b(p2.x - ray.start.x, p2.y - ray.start.y, p2.z - ray.start.z);
+        const Vector3d c(p3.x - ray.start.x, p3.y - ray.start.y, p3.z - ray.start.z);
+
+        const Float ax = a.*ray.kx - ray.sx * a.*ray.kz;
+        const Float ay = a.*ray.ky - ray.sy * a.*ray.kz;
+        const Float bx = b.*ray.kx - ray.sx * b.*ray.kz;
+        const Float by = b.*ray.ky - ray.sy * b.*ray.kz;
+        const Float cx = c.*ray.kx - ray.sx * c.*ray.kz;
+        const Float cy = c.*ray.ky - ray.sy * c.*ray.kz;
+
+        // doubled signed areas of the ray with edges opposite to p1, p2, p3
+        const Float area1 = cx * by - cy * bx;
+        const Float area2 = ax * cy - ay * cx;
+        const Float area3 = bx * ay - by * ax;
+
+        // both sides of the triangle are hit
+        if (((area1 < 0.) || (area2 < 0.) || (area3 < 0.))
+                && ((area1 > 0.) || (area2 > 0.) || (area3 > 0.))) {
+            return false;
+        }
+
+        const Float area = area1 + area2 + area3;
+        if (area == 0.) {
+            // the ray is parallel to the triangle
+            return false;
+        }
+
+        const Float t = (area1 * (ray.sz * a.*ray.kz) + area2 * (ray.sz * b.*ray.kz)
+                         + area3 * (ray.sz * c.*ray.kz)) / area;
+        if (!(t >= EPSILON)) {
+            // avoid intersection in the opposite direction
+            return false;
+        }
+
+        hit.point = Point3d(ray.start.x + ray.vector.x * t,
+                            ray.start.y + ray.vector.y * t,
+                            ray.start.z + ray.vector.z * t);
+        hit.t = t;
+        hit.u = area2 / area;
+        hit.v = area3 / area;
+        return true;
+    }
+
+    // intersect() for all lanes at once, returns lanes of rays
+    // intersecting the triangle
+    static PACKET_INLINE int intersect_packet(const RayPacket &packet,
+                                              const PacketShear &shear, const int lanes,
+                                              const Point3d &p1, const Point3d &p2,
+                                              const Point3d &p3, HitRecord hits[]) {
+        typedef RayPacket::Lanes Lanes;
+        typedef RayPacket::Mask Mask;
+
+        const Vector3d a(p1.x - packet.start.x, p1.y - packet.start.y, p1.z - packet.start.z);
+        const Vector3d b(p2.x - packet.start.x, p2.y - packet.start.y, p2.z - packet.start.z);
+        const Vector3d c(p3.x - packet.start.x, p3.y - packet.start.y, p3.z - packet.start.z);
+
+        const Lanes ax = a.*shear.kx - shear.sx * a.*shear.kz;
+        const Lanes ay = a.*shear.ky - shear.sy * a.*shear.kz;
+        const Lanes bx = b.*shear.kx - shear.sx * b.*shear.kz;
+        const Lanes by = b.*shear.ky - shear.sy * b.*shear.kz;
+        const Lanes cx = c.*shear.kx - shear.sx * c.*shear.kz;
+        const Lanes cy = c.*shear.ky - shear.sy * c.*shear.kz;
+
+        const Lanes area1 = cx * by - cy * bx;
+        const Lanes area2 = ax * cy - ay * cx;
+        const Lanes area3 = bx * ay - by * ax;
+
+        const Mask negative = (area1 < 0.) | (area2 < 0.) | (area3 < 0.);
+        const Mask positive = (area1 > 0.) | (area2 > 0.) | (area3 > 0.);
+        const Lanes area = area1 + area2 + area3;
+        Mask ok = ~(negative & positive) & (area != 0.);
+        if (!(RayPacket::to_bits(ok) & lanes)) {
+            return 0;
+        }
+
+        const Lanes t = (area1 * (shear.sz * a.*shear.kz) + area2 * (shear.sz * b.*shear.kz)
+                         + area3 * (shear.sz * c.*shear.kz)) / area;
+        ok &= (t >= EPSILON);
+
+        const int lane_hits = RayPacket::to_bits(ok) & lanes;
+        for (int i = 0; i < RayPacket::SIZE; ++i) {
+            if ((lane_hits >> i) & 1) {
+                hits[i].point = Point3d(packet.start.x + packet.x[i] * t[i],
+                                        packet.start.y + packet.y[i] * t[i],
+                                        packet.start.z + packet.z[i] * t[i]);
+                hits[i].t = t[i];
+                hits[i].u = area2[i] / area[i];
+                hits[i].v = area3[i] / area[i];
+            }
+        }
+        return lane_hits;
+    }
+
+    // intersect() of one ray with count <= RayPacket::SIZE triangles,
+    // lanes are triangles. Returns lanes of triangles hit, t of them
+    // is in ts.
+    static PACKET_INLINE int intersect_triangles(const ShearedRay &ray, const Point3d p1[],
+                                                 const Point3d p2[], const Point3d p3[],
+                                                 const int count, Float ts[]) {
+        typedef RayPacket::Lanes Lanes;
+        typedef RayPacket::Mask Mask;
+
+        // sheared vertexes, unused lanes get the empty triangle
+        Lanes ax = {}, ay = {}, az = {}, bx = {}, by = {}, bz = {}, cx = {}, cy = {}, cz = {};
+        for (int i = 0; i < count; ++i) {
+            const Vector3d a(p1[i].x - ray.start.x, p1[i].y - ray.start.y,
+                             p1[i].z - ray.start.z);
+            const Vector3d b(p2[i].x - ray.start.x, p2[i].y - ray.start.y,
+                             p2[i].z - ray.start.z);
+            const Vector3d c(p3[i].x - ray.start.x, p3[i].y - ray.start.y,
+                             p3[i].z - ray.start.z);
+            ax[i] = a.*ray.kx;
+            ay[i] = a.*ray.ky;
+            az[i] = a.*ray.kz;
+            bx[i] = b.*ray.kx;
+            by[i] = b.*ray.ky;
+            bz[i] = b.*ray.kz;
+            cx[i] = c.*ray.kx;
+            cy[i] = c.*ray.ky;
+            cz[i] = c.*ray.kz;
+        }
+        ax -= ray.sx * az;
+        ay -= ray.sy * az;
+        bx -= ray.sx * bz;
+        by -= ray.sy * bz;
+        cx -= ray.sx * cz;
+        cy -= ray.sy * cz;
+
+        const Lanes area1 = cx * by - cy * bx;
+        const Lanes area2 = ax * cy - ay * cx;
+        const Lanes area3 = bx * ay - by * ax;
+
+        const Mask negative = (area1 < 0.) | (area2 < 0.) | (area3 < 0.);
+        const Mask positive = (area1 > 0.) | (area2 > 0.) | (area3 > 0.);
+        const Lanes area = area1 + area2 + area3;
+        Mask ok = ~(negative & positive) & (area != 0.);
+        if (!RayPacket::to_bits(ok)) {
+            return 0;
+        }
+
+        const Lanes t = (area1 * (ray.sz * az) + area2 * (ray.sz * bz)
+                         + area3 * (ray.sz * cz)) / area;
+        ok &= (t >= EPSILON);
+
+        for (int i = 0; i < RayPacket::SIZE; ++i) {
+            ts[i] = t[i];
+        }
+        return RayPacket::to_bits(ok);
+    }
+
+    // vertexes
+    Point3d p1;
+    Point3d p2;
+    Point3d p3;
+
+    Vector3d norm;
+};
+
+/*
+ * Planar quadrangle p1, p2, p3, p4 made of triangles p1, p2, p3 and
+ * p1, p3, p4, the first one is tested first. The ray is intersected with
+ * the plane, barycentric coordinates of the point in the triangles are
+ * dot products with vectors computed once.
+ *
+ * hit.primitive is the index of the triangle hit, hit.u and hit.v are
+ * the weights of its 2nd and 3rd vertexes.
+ */
+class QuadranglePrimitive {
+public:
+    QuadranglePrimitive() {
+    }
+
+    QuadranglePrimitive(const Point3d &p1, const Point3d &p2, const Point3d &p3,
+                        const Point3d &p4)
+        : p1(p1), norm(TrianglePrimitive(p1, p2, p3).norm) {
+        set_barycentric_vectors(p1, p2, p3, a_u, a_v);
+        set_barycentric_vectors(p1, p3, p4, b_u, b_v);
+    }
+
+    bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                   HitRecord &hit) const {
+        const Float denominator = norm.x * vector.x + norm.y * vector.y + norm.z * vector.z;
+        if (denominator == 0.) {
+            // the ray is parallel to the plane
+            return false;
+        }
+
+        const Float t = (norm.x * (p1.x - vector_start.x) + norm.y * (p1.y - vector_start.y)
+                         + norm.z * (p1.z - vector_start.z)) / denominator;
+        if (!(t >= EPSILON)) {
+            return false;
+        }
+
+        const Point3d point(vector_start.x + vector.x * t,
+                            vector_start.y + vector.y * t,
+                            vector_start.z + vector.z * t);
+        const Vector3d w(point.x - p1.x, point.y - p1.y, point.z - p1.z);
+
+        uint32_t primitive = 0;
+        Float u = w.x * a_u.x + w.y * a_u.y + w.z * a_u.z;
+        Float v = w.x * a_v.x + w.y * a_v.y + w.z * a_v.z;
+        if (!inside(u, v)) {
+            primitive = 1;
+            u = w.x * b_u.x + w.y * b_u.y + w.z * b_u.z;
+            v = w.x * b_v.x + w.y * b_v.y + w.z * b_v.z;
+            if (!inside(u, v)) {
+                return false;
+            }
+        }
+
+        hit.point = point;
+        hit.t = t;
+        hit.u = u;
+        hit.v = v;
+        hit.primitive = primitive;
+        return true;
+    }
+
+    PACKET_INLINE int intersect_packet(const RayPacket &packet, const int lanes,
+                                       HitRecord hits[]) const {
+        typedef RayPacket::Lanes Lanes;
+        typedef RayPacket::Mask Mask;
+
+        const Lanes denominator = norm.x * packet.x + norm.y * packet.y + norm.z * packet.z;
+        const Lanes t = (norm.x * (p1.x - packet.start.x) + norm.y * (p1.y - packet.start.y)
+                         + norm.z * (p1.z - packet.start.z)) / denominator;
+        const Mask ok = (denominator != 0.) & (t >= EPSILON);
+        if (!(RayPacket::to_bits(ok) & lanes)) {
+            return 0;
+        }
+
+        const Lanes x = packet.start.x + packet.x * t;
+        const Lanes y = packet.start.y + packet.y * t;
+        const Lanes z = packet.start.z + packet.z * t;
+        const Lanes wx = x - p1.x;
+        const Lanes wy = y - p1.y;
+        const Lanes wz = z - p1.z;
+
+        const Lanes au = wx * a_u.x + wy * a_u.y + wz * a_u.z;
+        const Lanes av = wx * a_v.x + wy * a_v.y + wz * a_v.z;
+        const Lanes bu = wx * b_u.x + wy * b_u.y + wz * b_u.z;
+        const Lanes bv = wx * b_v.x + wy * b_v.y + wz * b_v.z;
+        const Mask a_ok = ok & (au >= 0.) & (av >= 0.) & (au + av <= 1.);
+        const Mask b_ok = ok & ~a_ok & (bu >= 0.) & (bv >= 0.) & (bu + bv <= 1.);
+
+        const int a_hits = RayPacket::to_bits(a_ok) & lanes;
+        const int b_hits = RayPacket::to_bits(b_ok) & lanes;
+        for (int i = 0; i < RayPacket::SIZE; ++i) {
+            if (((a_hits | b_hits) >> i) & 1) {
+                const bool b = (b_hits >> i) & 1;
+                hits[i].point = Point3d(x[i], y[i], z[i]);
+                hits[i].t = t[i];
+                hits[i].u = b ? bu[i] : au[i];
+                hits[i].v = b ? bv[i] : av[i];
+                hits[i].primitive = b;
+            }
+        }
+        return a_hits | b_hits;
+    }
+
+    Point3d p1;
+    Vector3d norm; // the one of the triangle p1, p2, p3
+
+    // u = w.dot(a_u), v = w.dot(a_v) for w from p1 to the point
+    // in the triangle p1, p2, p3, b_u and b_v are the ones of p1, p3, p4
+    Vector3d a_u;
+    Vector3d a_v;
+    Vector3d b_u;
+    Vector3d b_v;
+
+private:
+    static bool inside(const Float u, const Float v) {
+        return (u >= 0.) && (v >= 0.) && (u + v <= 1.);
+    }
+
+    // Vectors dual to the edges e1 = p2 - p1, e2 = p3 - p1 in the plane
+    // of the triangle: w = u * e1 + v * e2 for u = w.dot(to_u), v = w.dot(to_v)
+    static void set_barycentric_vectors(const Point3d &p1, const Point3d &p2,
+                                        const Point3d &p3, Vector3d &to_u, Vector3d &to_v) {
+        const Vector3d e1(p1, p2);
+        const Vector3d e2(p1, p3);
+        // Vector3d::cross(a, b) is b x a
+        const Vector3d n = Vector3d::cross(e2, e1);
+        const Float n2 = n.module2();
+        to_u = Vector3d::cross(n, e2).mul(1. / n2);
+        to_v = Vector3d::cross(e1, n).mul(1. / n2);
+    }
+};
+
+class SpherePrimitive {
+public:
+    SpherePrimitive() : radius(0.) {
+    }
+
+    SpherePrimitive(const Point3d &center, const Float &radius)
+        : center(center), radius(radius) {
+    }
+
+    bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                   HitRecord &hit) const {
+        const Float a = vector.x * vector.x + vector.y * vector.y + vector.z * vector.z;
+
+        const Float b = 2 * (vector.x * (vector_start.x - center.x)
+                             + vector.y * (vector_start.y - center.y)
+                             + vector.z * (vector_start.z - center.z));
+
+        const Float c = (center.x * center.x + center.y * center.y + center.z * center.z)
+                        + (vector_start.x * vector_start.x + vector_start.y * vector_start.y
+                           + vector_start.z * vector_start.z)
+                        - 2 * (vector_start.x * center.x + vector_start.y * center.y
+                               + vector_start.z * center.z)
+                        - radius * radius;
+
+        const Float D = b * b - 4 * a * c;
+
+        if (D < 0.) {
+            return false;
+        }
+
+        const Float sqrt_D = sqrt(D);
+        const Float a_2 = 2 * a;
+
+        const Float t1 = (-b + sqrt_D) / a_2;
+        const Float t2 = (-b - sqrt_D) / a_2;
+
+        const Float min_t = (t1 < t2) ? t1 : t2;
+        const Float max_t = (t1 > t2) ? t1 : t2;
+
+        const Float t = (min_t > EPSILON) ? min_t : max_t;
+
+        if (t < EPSILON) {
+            return false;
+        }
+
+        hit.point = Point3d(vector_start.x + vector.x * t,
+                            vector_start.y + vector.y * t,
+                            vector_start.z + vector.z * t);
+        hit.t = t;
+        return true;
+    }
+
+    Point3d center;
+    Float radius;
+};
+
+/*
+ * Geometry of the object for accelerators. Objects with their own
+ * intersect() are GENERIC, accelerators call their virtual intersect().
+ * MESH objects are splitted by accelerators into faces.
+ */
+class Primitive {
+public:
+    enum Type {TRIANGLE, QUADRANGLE, SPHERE, MESH, GENERIC};
+    static const int TYPES_COUNT = 5;
+
+    Primitive() : type(GENERIC), mesh(NULL) {
+    }
+
+    Primitive(const TrianglePrimitive &triangle)
+        : type(TRIANGLE), triangle(triangle), mesh(NULL) {
+    }
+
+    Primitive(const QuadranglePrimitive &quadrangle)
+        : type(QUADRANGLE), quadrangle(quadrangle), mesh(NULL) {
+    }
+
+    Primitive(const SpherePrimitive &sphere)
+        : type(SPHERE), sphere(sphere), mesh(NULL) {
+    }
+
+    Primitive(const TriangleMesh * const mesh)
+        : type(MESH), mesh(mesh) {
+    }
+
+    Type type;
+    TrianglePrimitive triangle;
+    QuadranglePrimitive quadrangle;
+    SpherePrimitive sphere;
+    const TriangleMesh *mesh;
+};
+
+#endif // PRIMITIVES_H
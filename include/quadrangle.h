@@ -10,35 +10,28 @@
 #include <include/utils.h>
 #include <include/triangle.h>
 
-class Quadrangle3d : public Object3d{
+class Quadrangle3d : public Object3d, protected QuadranglePrimitive {
 public:
     Quadrangle3d(const Point3d &p1, const Point3d &p2, const Point3d &p3, const Point3d &p4,
-             const Color &color, const Material &material);
+             const MaterialId material_id);
 
     virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
-                   Point3d &intersection_point) const;
+                   HitRecord &hit) const;
+    virtual Primitive get_primitive() const;
 
-    virtual Color get_color(const Point3d &intersection_point) const;
-    virtual Vector3d get_normal_vector(const Point3d &intersection_point) const;
-    virtual Material get_material(const Point3d &intersection_point) const;
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
     virtual Point3d get_min_boundary_point() const;
     virtual Point3d get_max_boundary_point() const;
-    virtual bool reflects() const;
     virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
                                  LightSource3d & ls_secondary) const;
 
 protected:
-    // vertexes
-    Point3d p1;
+    // vertexes, p1 and norm are the ones of QuadranglePrimitive
     Point3d p2;
     Point3d p3;
     Point3d p4;
-
-    Vector3d norm;
-
-    // material
-    Color color;
-    Material material;
 };
 
 class TexturedQuadrangle3d : public Quadrangle3d{
@@ -47,16 +40,13 @@ public:
                         const Point3d &p3, const Point3d &p4,
                         const Point2d &t1, const Point2d &t2,
                         const Point2d &t3, const Point2d &t4,
-                        Canvas *texture, const Color &color,
-                        const Material &material);
-
-    virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
-                   Point3d &intersection_point) const;
+                        Canvas *texture, const MaterialId material_id);
 
-    virtual Color get_color(const Point3d &intersection_point) const;
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
 
 
 protected:
+    // triangles of QuadranglePrimitive with texture coordinates
     TexturedTriangle3d a, b;
 };
 
@@ -0,0 +1,181 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include <include/utils.h>
+
+// Functions with PACKET_KERNEL are compiled twice, for AVX2 and for the
+// baseline SSE2, the version is selected once by the CPU at the start.
+// Both versions do the same IEEE operations, so they give the same
+// results as the single ray code.
+//
+// Functions with PACKET_INLINE are always inlined, so inside of kernels
+// they are compiled for the instruction set of the kernel.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PACKET_KERNEL __attribute__((target_clones("avx2", "default")))
+#define PACKET_INLINE inline __attribute__((always_inline))
+#else
+#define PACKET_KERNEL
+#define PACKET_INLINE inline
+#endif
+
+/*
+ * Ray prepared for the watertight triangle test (see: S. Woop, C. Benthin,
+ * I. Wald, "Watertight Ray/Triangle Intersection", 2013). Coordinates
+ * kx, ky, kz are the ones of vector with the largest kz, the space is
+ * sheared so that vector becomes (0, 0, 1):
+ *
+ *     p' = (p.*kx - sx * p.*kz, p.*ky - sy * p.*kz, sz * p.*kz)
+ *
+ * for points p relative to start. kx and ky are swapped if vector.*kz
+ * is negative, so triangles keep their orientation.
+ */
+class ShearedRay {
+public:
+    typedef Float Vector3d::*Coordinate;
+
+    ShearedRay(const Point3d &start, const Vector3d &vector)
+        : start(start), vector(vector) {
+        kz = largest_coordinate(vector);
+        kx = (kz == &Vector3d::x) ? &Vector3d::y
+                                  : ((kz == &Vector3d::y) ? &Vector3d::z : &Vector3d::x);
+        ky = (kz == &Vector3d::x) ? &Vector3d::z
+                                  : ((kz == &Vector3d::y) ? &Vector3d::x : &Vector3d::y);
+        if (vector.*kz < 0.) {
+            std::swap(kx, ky);
+        }
+
+        sz = 1. / vector.*kz;
+        sx = vector.*kx * sz;
+        sy = vector.*ky * sz;
+    }
+
+    static Coordinate largest_coordinate(const Vector3d &v) {
+        const Float x = fabs(v.x);
+        const Float y = fabs(v.y);
+        const Float z = fabs(v.z);
+        if ((x > y) && (x > z)) {
+            return &Vector3d::x;
+        }
+        return (y > z) ? &Vector3d::y : &Vector3d::z;
+    }
+
+    Point3d start;
+    Vector3d vector;
+
+    Coordinate kx;
+    Coordinate ky;
+    Coordinate kz;
+
+    Float sx;
+    Float sy;
+    Float sz;
+};
+
+/*
+ * SIZE rays with the common start, traced together. Rays are the pixels
+ * of 2x2 block, so they mostly visit the same KDTree nodes and hit the
+ * same objects. Coordinates of vectors are kept by lanes (structure of
+ * arrays), operations on Lanes are SIMD instructions.
+ */
+class RayPacket {
+public:
+    static const int SIZE = 4;
+    static const int ALL = (1 << SIZE) - 1;
+
+    typedef Float Lanes __attribute__((vector_size(SIZE * sizeof(Float))));
+    // Result of Lanes comparison, every lane is 0 or -1
+    typedef FloatBits Mask __attribute__((vector_size(SIZE * sizeof(FloatBits))));
+
+    RayPacket(const Point3d &start) : start(start) {
+    }
+
+    void set_vector(const int lane, const Vector3d &vector) {
+        x[lane] = vector.x;
+        y[lane] = vector.y;
+        z[lane] = vector.z;
+    }
+
+    Vector3d vector(const int lane) const {
+        return Vector3d(x[lane], y[lane], z[lane]);
+    }
+
+    // Packet traversal needs all vectors to have the same nonzero
+    // signs of coordinates: then all rays visit children of KDTree
+    // nodes in the same order. Triangle tests need the same largest
+    // coordinate: then all rays are sheared along the same axis.
+    bool is_coherent() const {
+        if (!(same_signs(x) && same_signs(y) && same_signs(z))) {
+            return false;
+        }
+        const ShearedRay::Coordinate kz = ShearedRay::largest_coordinate(vector(0));
+        for (int i = 1; i < SIZE; ++i) {
+            if (ShearedRay::largest_coordinate(vector(i)) != kz) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static PACKET_INLINE int to_bits(const Mask &mask) {
+        int bits = 0;
+        for (int i = 0; i < SIZE; ++i) {
+            bits |= mask[i] ? (1 << i) : 0;
+        }
+        return bits;
+    }
+
+    Point3d start;
+    Lanes x;
+    Lanes y;
+    Lanes z;
+
+private:
+    static bool same_signs(const Lanes &v) {
+        const int positive = to_bits(v > 0.);
+        const int negative = to_bits(v < 0.);
+        return (positive == ALL) || (negative == ALL);
+    }
+};
+
+/*
+ * ShearedRay for every ray of coherent packet, kx, ky and kz
+ * are the same for all of them
+ */
+class PacketShear {
+public:
+    typedef RayPacket::Lanes Lanes;
+
+    PacketShear(const RayPacket &packet) {
+        const ShearedRay ray(packet.start, packet.vector(0));
+        kx = ray.kx;
+        ky = ray.ky;
+        kz = ray.kz;
+
+        const Lanes *coordinates[] = {&packet.x, &packet.y, &packet.z};
+        const Lanes &vx = *coordinates[index(kx)];
+        const Lanes &vy = *coordinates[index(ky)];
+        const Lanes &vz = *coordinates[index(kz)];
+        sz = 1. / vz;
+        sx = vx * sz;
+        sy = vy * sz;
+    }
+
+    ShearedRay::Coordinate kx;
+    ShearedRay::Coordinate ky;
+    ShearedRay::Coordinate kz;
+
+    Lanes sx;
+    Lanes sy;
+    Lanes sz;
+
+private:
+    static int index(const ShearedRay::Coordinate k) {
+        return (k == &Vector3d::x) ? 0 : ((k == &Vector3d::y) ? 1 : 2);
+    }
+};
+
+#endif // RAY_PACKET_H
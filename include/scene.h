@@ -1,45 +1,125 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <map>
+#include <string>
+
+#include <include/arena.h>
 #include <include/objects.h>
-#include <include/kdtree.h>
+#include <include/accelerator.h>
+#include <include/mesh_instance.h>
+#include <include/transform.h>
 #include <include/color.h>
 #include <include/camera.h>
 #include <include/fog.h>
 #include <include/canvas.h>
+#include <include/thread_pool.h>
 
 class Scene {
 public:
+    class RenderStatistics {
+    public:
+        size_t shaded_points; // ray hits, including secondary rays
+        size_t shadow_rays;
+    };
+
     Scene(const Color &background_color);
     ~Scene();
 
+    // Objects are owned by the scene: every asset (a loaded model or
+    // objects created one by one) is allocated in its own arena,
+    // all of them are released together with the scene.
+    Arena &add_asset();
+    // Creates the object in the arena of objects created one by one
+    template <class T, class ... Args>
+    T *create_object(Args&& ... args) {
+        T * const object = assets.front()->create<T>(std::forward<Args>(args)...);
+        add_object(object);
+        return object;
+    }
+    // The object must be allocated in an arena of the scene
+    // and have the material added to the scene. Reflecting objects
+    // are secondary light sources, but meshes and instances are not.
     void add_object(Object3d * const object);
+    // Places a copy of the mesh with its material. The mesh must be
+    // allocated in an arena of the scene and must not be added as an
+    // object; all its instances share its geometry and accelerator.
+    MeshInstance *add_instance(const TriangleMesh * const mesh, const Transform &transform);
+    // Returns the id of the equal material if it was added before
+    MaterialId add_material(const Color &color, const Material &material);
     void prepare_scene();
     void set_exponential_fog(const Float &k);
     void set_no_fog();
     void add_light_source(LightSource3d * const light_source);
+    // KD_TREE by default, takes effect on the next rebuild_kd_tree()
+    void set_accelerator(const Accelerator::Type type);
+    // Accelerators of rebuild_kd_tree() are read from the directory if they
+    // were built before for the same geometry, new ones are written there
+    // (see AcceleratorCache). Disabled if directory is empty (by default).
+    void set_accelerator_cache(const std::string &directory);
+    // Builds the accelerator of the scene and of instanced meshes
     void rebuild_kd_tree();
+    // Updates the accelerator of the scene after objects moved (see
+    // MeshInstance::set_transform()). It is refitted and partially rebuilt
+    // when possible, built again if it became too slow, was never built,
+    // objects were added or it is KD_TREE.
+    void refit_kd_tree();
+    // Threads for rendering and accelerator building,
+    // threads_count == 0 means "one thread per hardware core"
+    void set_threads_count(size_t threads_count);
+    // Model loaders parse files in parallel with it
+    const ThreadPool &get_thread_pool() const;
     void render(const Camera &camera, Canvas& canvas) const;
 
     // Tracer
     Color trace(const Camera &camera, const Vector3d &vector) const;
+    // trace() for RayPacket::SIZE rays of 2x2 pixels block
+    void trace_packet(const Camera &camera, const Vector3d vectors[],
+                      Color colors[]) const;
+    // Faces of meshes and of instances are counted one by one
     size_t get_objects_count() const;
+    Accelerator::Statistics get_kd_tree_statistics() const;
+    // Counters of the last render() call
+    RenderStatistics get_render_statistics() const;
 
 protected:
+    std::vector<Arena*> assets;
+    MaterialTable materials;
     std::vector<Object3d*> objects;
     std::vector<LightSource3d*> light_sources;
     std::vector<Object3d*> reflecting_objects;
+    std::vector<MeshInstance*> instances;
+    // Accelerators of instanced meshes, every one is built once
+    // for mesh_trees_type
+    std::map<const TriangleMesh*, Accelerator*> mesh_trees;
+    Accelerator::Type mesh_trees_type;
     Color background_color;
-    KDTree *kd_tree;
+    Accelerator::Type accelerator_type;
+    std::string accelerator_cache_directory;
+    Accelerator *accelerator;
+    // Objects in the accelerator
+    size_t accelerator_objects_count;
     Fog *fog;
+    ThreadPool thread_pool;
+    mutable RenderStatistics render_statistics;
+
+    // Counters of the tile being traced by this thread
+    static thread_local RenderStatistics tracing_statistics;
 
     static const int INITIAL_RAY_INTENSITY = 100;
     static const int THRESHOLD_RAY_INTENSITY = 10;
     static const int MAX_RAY_RECURSION_LEVEL = 10;
     static const bool SECONDARY_LIGHT = true;
     static const bool ANTIALIASING = true;
+    static const int RENDER_TILE_SIZE = 32;
 
 
+    // The accelerator of the scene is read from the cache if cache_scene,
+    // the ones of meshes always are
+    void rebuild_accelerators(const bool cache_scene);
+    void delete_mesh_trees();
+    Accelerator *build_accelerator(std::vector<Object3d*> &objects, const bool cached) const;
+
     Color trace_recursively(const Point3d &vector_start,
                             const Vector3d &vector, const Float &intensity,
                             const int recursion_level) const;
@@ -47,17 +127,22 @@ protected:
     bool is_viewable(const Point3d &target_point,
                      const Point3d &starting_point) const;
 
-    Color get_lighting_color(const Point3d &point,
-                             const Vector3d &norm_v) const;
-
-    Color get_specular_color(const Point3d &point,
-                             const Vector3d &reflected_ray, const Float &p) const;
+    // front is the geometric normal on the side of the viewer
+    void get_lighting(const Point3d &point, const Vector3d &norm_v,
+                      const Vector3d &front, const Vector3d &reflected_ray,
+                      const Material &material,
+                      Color &diffuse_light, Color &specular_light) const;
 
     Color calculate_color(const Point3d &vector_start,
-                          const Vector3d &vector, const Object3d * const obj,
-                          const Point3d &point, const Float &dist_ptr,
+                          const Vector3d &vector, const HitRecord &hit,
                           const Float &intensity, const int recursion_level) const;
 
+    RenderStatistics render_tile(const Camera &camera, const int tile_x,
+                                 const int tile_y, Canvas &canvas) const;
+    RenderStatistics antialias_tile(const Camera &camera, const int tile_x,
+                                    const int tile_y, const Canvas &edges,
+                                    Canvas &canvas) const;
+
     bool refract(Vector3d& ray_dir, Vector3d a_normal, const Float &a_matIOR) const;
 };
 
@@ -7,26 +7,21 @@
 #include <include/utils.h>
 #include <include/objects.h>
 
-class Sphere : public Object3d {
+class Sphere : public Object3d, protected SpherePrimitive {
 public:
     Sphere(const Point3d &center, const Float &radius,
-           const Color &color, const Material &material);
+           const MaterialId material_id);
 
     virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
-                   Point3d &intersection_point) const;
-    virtual Color get_color(const Point3d &intersection_point) const;
-    virtual Vector3d get_normal_vector(const Point3d &intersection_point) const;
-    virtual Material get_material(const Point3d &intersection_point) const;
+                   HitRecord &hit) const;
+    virtual Primitive get_primitive() const;
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
     virtual Point3d get_min_boundary_point() const;
     virtual Point3d get_max_boundary_point() const;
-    virtual bool reflects() const;
     virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
                                  LightSource3d & ls_secondary) const;
-protected:
-    Point3d center;
-    Float radius;
-    Color color;
-    Material material;
 };
 
 
@@ -0,0 +1,88 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing executor for independent tasks.
+ *
+ * parallel_for(n, task) deals task indexes [0, n) out to per-thread deques
+ * in contiguous ranges. Every thread pops tasks from the front of its own
+ * deque and, once it is empty, steals from the back of the other deques,
+ * so threads that got cheap tasks help the ones that got expensive tasks.
+ *
+ * Worker threads are started once by the constructor and wait for the
+ * next parallel_for() between calls. The calling thread takes part in
+ * the work; the call returns when all tasks are done. The first exception
+ * thrown by a task is rethrown. Calls made while the pool is busy (from
+ * its tasks or from other threads) run their tasks on the calling thread.
+ */
+class ThreadPool {
+public:
+    // threads_count == 0 means "one thread per hardware core"
+    explicit ThreadPool(size_t threads_count = 0);
+
+    ThreadPool(ThreadPool &&) = default;
+    ThreadPool &operator=(ThreadPool &&) = default;
+
+    void parallel_for(size_t tasks_count,
+                      const std::function<void(size_t)> &task) const;
+
+    size_t get_threads_count() const {
+        return threads_count;
+    }
+
+    static size_t hardware_threads_count();
+
+private:
+    class WorkQueue {
+    public:
+        bool pop_front(size_t &task);
+        bool pop_back(size_t &task);
+
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    // Threads of the pool, kept apart so the pool may be moved
+    class Workers {
+    public:
+        explicit Workers(size_t threads_count);
+        ~Workers();
+
+        // Thread id of the pool, 0 is the calling thread
+        void run(size_t id);
+
+        std::vector<WorkQueue> queues;
+        std::vector<std::thread> threads;
+        std::atomic<bool> busy;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        // Incremented by every parallel_for()
+        size_t generation;
+        // Threads of the current call, the calling thread included
+        size_t workers_count;
+        // Threads of the current call still working
+        size_t running;
+        const std::function<void(size_t)> *task;
+        bool stopping;
+    };
+
+    static void worker(std::vector<WorkQueue> &queues, size_t queues_count, size_t id,
+                       const std::function<void(size_t)> &task);
+
+    size_t threads_count;
+    std::unique_ptr<Workers> workers;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,83 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cmath>
+
+#include <include/utils.h>
+
+/*
+ * Affine transform p' = M * p + translation, M is kept by rows.
+ * Rotations are the ones of Vector3d::rotate_x() and others.
+ */
+class Transform {
+public:
+    Transform() : Transform(Vector3d(1., 0., 0.), Vector3d(0., 1., 0.),
+                            Vector3d(0., 0., 1.), Vector3d()) {
+    }
+
+    Transform(const Vector3d &row_x, const Vector3d &row_y, const Vector3d &row_z,
+              const Vector3d &translation) : translation(translation) {
+        rows[0] = row_x;
+        rows[1] = row_y;
+        rows[2] = row_z;
+    }
+
+    static Transform scale(const Float &k) {
+        return Transform(Vector3d(k, 0., 0.), Vector3d(0., k, 0.), Vector3d(0., 0., k),
+                         Vector3d());
+    }
+
+    static Transform translate(const Vector3d &d) {
+        return Transform(Vector3d(1., 0., 0.), Vector3d(0., 1., 0.), Vector3d(0., 0., 1.), d);
+    }
+
+    static Transform rotate_x(const Float &al) {
+        const Float s = sin(al);
+        const Float c = cos(al);
+        return Transform(Vector3d(1., 0., 0.), Vector3d(0., c, -s), Vector3d(0., s, c),
+                         Vector3d());
+    }
+
+    static Transform rotate_y(const Float &al) {
+        const Float s = sin(al);
+        const Float c = cos(al);
+        return Transform(Vector3d(c, 0., -s), Vector3d(0., 1., 0.), Vector3d(s, 0., c),
+                         Vector3d());
+    }
+
+    static Transform rotate_z(const Float &al) {
+        const Float s = sin(al);
+        const Float c = cos(al);
+        return Transform(Vector3d(c, -s, 0.), Vector3d(s, c, 0.), Vector3d(0., 0., 1.),
+                         Vector3d());
+    }
+
+    // This transform, then the other one
+    Transform then(const Transform &other) const {
+        return Transform(apply_transposed(other.rows[0]), apply_transposed(other.rows[1]),
+                         apply_transposed(other.rows[2]), other.apply_point(translation));
+    }
+
+    // Throws std::runtime_error if M is degenerate
+    Transform inverse() const;
+
+    Point3d apply_point(const Point3d &p) const {
+        return apply_vector(p) + translation;
+    }
+
+    Vector3d apply_vector(const Vector3d &v) const {
+        return Vector3d(Vector3d::dot(rows[0], v), Vector3d::dot(rows[1], v),
+                        Vector3d::dot(rows[2], v));
+    }
+
+    // M^T * v. Normals are transformed by the transposed inverse
+    // transform: to_object.apply_transposed(n) for the object normal n.
+    Vector3d apply_transposed(const Vector3d &v) const {
+        return rows[0].mul(v.x) + rows[1].mul(v.y) + rows[2].mul(v.z);
+    }
+
+    Vector3d rows[3];
+    Vector3d translation;
+};
+
+#endif // TRANSFORM_H
@@ -8,53 +8,30 @@
 #include <include/objects.h>
 #include <include/utils.h>
 
-class Triangle3d : public Object3d{
+class Triangle3d : public Object3d, protected TrianglePrimitive {
 public:
     Triangle3d(const Point3d &p1, const Point3d &p2, const Point3d &p3,
-             const Color &color, const Material &material);
+             const MaterialId material_id);
 
     virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
-                   Point3d &intersection_point) const;
+                   HitRecord &hit) const;
+    virtual Primitive get_primitive() const;
 
-    virtual Color get_color(const Point3d &intersection_point) const;
-    virtual Vector3d get_normal_vector(const Point3d &intersection_point) const;
-    virtual Material get_material(const Point3d &intersection_point) const;
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
     virtual Point3d get_min_boundary_point() const;
     virtual Point3d get_max_boundary_point() const;
-    virtual bool reflects() const;
     virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
                                  LightSource3d & ls_secondary) const;
-
-    virtual void get_weights_of_vertexes(const Point3d &intersection_point,
-                                         Float &w1, Float &w2, Float &w3) const;
-
-protected:
-    // vertexes
-    Point3d p1;
-    Point3d p2;
-    Point3d p3;
-
-    Vector3d norm;
-
-    // distance to the center of coordinates
-    Float d;
-
-    Vector3d v_p1_p2;
-    Vector3d v_p2_p3;
-    Vector3d v_p3_p1;
-
-    // material
-    Color color;
-    Material material;
-
 };
 
 class NormedTriangle3d : public Triangle3d {
 public:
     NormedTriangle3d(const Point3d &p1, const Point3d &p2, const Point3d &p3,
              const Vector3d &n1, const Vector3d &n2, const Vector3d &n3,
-             const Color &color, const Material &material);
-    virtual Vector3d get_normal_vector(const Point3d &intersection_point) const;
+             const MaterialId material_id);
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
 
 protected:
     // normals
@@ -67,8 +44,8 @@ class TexturedTriangle3d : public Triangle3d {
 public:
     TexturedTriangle3d(const Point3d &p1, const Point3d &p2, const Point3d &p3,
              const Point2d &t1,const Point2d &t2, const Point2d &t3,
-             Canvas *texture, const Color &color, const Material &material);
-    virtual Color get_color(const Point3d &intersection_point) const;
+             Canvas *texture, const MaterialId material_id);
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
 
 protected:
     // texture
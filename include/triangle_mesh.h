@@ -0,0 +1,220 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <include/canvas.h>
+#include <include/mapped_file.h>
+#include <include/objects.h>
+#include <include/primitives.h>
+#include <include/ray_packet.h>
+#include <include/utils.h>
+
+/*
+ * Array of the mesh. Elements are kept in the array while the mesh is
+ * built, or the array is a view of the elements in the mapped mesh cache
+ * (see MeshCache). Changing the view copies the elements first.
+ */
+template <class T>
+class MeshArray {
+public:
+    MeshArray() : data_(NULL), size_(0) {
+    }
+
+    MeshArray(const MeshArray &) = delete;
+    MeshArray &operator=(const MeshArray &) = delete;
+
+    const T &operator[](const size_t index) const {
+        return data_[index];
+    }
+
+    const T *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return !size_;
+    }
+
+    void push_back(const T &value) {
+        own();
+        storage.push_back(value);
+        update();
+    }
+
+    void resize(const size_t size, const T &value) {
+        own();
+        storage.resize(size, value);
+        update();
+    }
+
+    void reserve(const size_t size) {
+        own();
+        storage.reserve(size);
+        update();
+    }
+
+    // The elements must live as long as the array
+    void set_view(const T *data, const size_t size) {
+        std::vector<T>().swap(storage);
+        data_ = data;
+        size_ = size;
+    }
+
+private:
+    void own() {
+        if (data_ != storage.data()) {
+            storage.assign(data_, data_ + size_);
+        }
+    }
+
+    void update() {
+        data_ = storage.data();
+        size_ = storage.size();
+    }
+
+    std::vector<T> storage;
+    const T *data_;
+    size_t size_;
+};
+
+/*
+ * Triangles of the loaded model with one material and,
+ * optionally, one texture.
+ *
+ * Vertexes and normals are shared by faces and kept by coordinates
+ * (structure of arrays), faces are triples of indexes. KDTree splits the
+ * mesh into faces and intersects them by indexes. The watertight test
+ * needs only vertexes of the face, normals are computed for hits.
+ */
+class TriangleMesh : public Object3d {
+    friend class MeshCache;
+
+public:
+    static const uint32_t NO_INDEX = UINT32_MAX;
+
+    // The texture is not owned by the mesh
+    TriangleMesh(const MaterialId material_id, const Canvas *texture = NULL);
+
+    // Space for the given counts, so adding them doesn't reallocate
+    void reserve(const size_t vertexes_count, const size_t normals_count,
+                 const size_t texture_points_count, const size_t faces_count);
+    // Return the index of the added vertex, normal or texture point
+    uint32_t add_vertex(const Point3d &p);
+    uint32_t add_normal(const Vector3d &n);
+    uint32_t add_texture_point(const Point2d &t);
+    // Normals are interpolated if n1, n2 and n3 are given,
+    // otherwise the face is flat. The face has the color of the texture
+    // if t1, t2 and t3 are given, otherwise the one of the material.
+    void add_face(const uint32_t v1, const uint32_t v2, const uint32_t v3,
+                  const uint32_t n1 = NO_INDEX, const uint32_t n2 = NO_INDEX,
+                  const uint32_t n3 = NO_INDEX, const uint32_t t1 = NO_INDEX,
+                  const uint32_t t2 = NO_INDEX, const uint32_t t3 = NO_INDEX);
+
+    uint32_t get_vertexes_count() const;
+    uint32_t get_normals_count() const;
+    uint32_t get_texture_points_count() const;
+    uint32_t get_faces_count() const;
+    size_t get_memory() const; // bytes
+
+    Point3d get_vertex(const uint32_t index) const {
+        return Point3d(xs[index], ys[index], zs[index]);
+    }
+
+    void get_face_vertexes(const uint32_t face, Point3d &p1, Point3d &p2,
+                           Point3d &p3) const {
+        const uint32_t * const v = &vertex_indexes[3 * face];
+        p1 = get_vertex(v[0]);
+        p2 = get_vertex(v[1]);
+        p3 = get_vertex(v[2]);
+    }
+
+    // The same geometry as Triangle3d of the face has
+    TrianglePrimitive get_face(const uint32_t face) const {
+        const uint32_t * const v = &vertex_indexes[3 * face];
+        return TrianglePrimitive(get_vertex(v[0]), get_vertex(v[1]), get_vertex(v[2]));
+    }
+
+    bool intersect_face(const uint32_t face, const ShearedRay &ray, HitRecord &hit) const {
+        const uint32_t * const v = &vertex_indexes[3 * face];
+        return TrianglePrimitive::intersect(ray, get_vertex(v[0]), get_vertex(v[1]),
+                                            get_vertex(v[2]), hit);
+    }
+
+    PACKET_INLINE int intersect_face_packet(const uint32_t face, const RayPacket &packet,
+                                            const PacketShear &shear, const int lanes,
+                                            HitRecord hits[]) const {
+        const uint32_t * const v = &vertex_indexes[3 * face];
+        return TrianglePrimitive::intersect_packet(packet, shear, lanes, get_vertex(v[0]),
+                                                   get_vertex(v[1]), get_vertex(v[2]),
+                                                   hits);
+    }
+
+    // The face has normals to interpolate, otherwise it is flat
+    bool has_face_normals(const uint32_t face) const {
+        return !normal_indexes.empty() && (normal_indexes[3 * face] != NO_INDEX);
+    }
+
+    // The color of the face is the one of the texture
+    bool has_face_texture(const uint32_t face) const {
+        return texture && !texture_indexes.empty() && (texture_indexes[3 * face] != NO_INDEX);
+    }
+
+    Point3d get_face_min_boundary_point(const uint32_t face) const;
+    Point3d get_face_max_boundary_point(const uint32_t face) const;
+
+    // Nearest intersection with faces, they are tested one by one
+    virtual bool intersect(const Point3d &vector_start, const Vector3d &vector,
+                           HitRecord &hit) const;
+    virtual Primitive get_primitive() const;
+
+    // hit.primitive is the face, hit.normal is its geometric normal
+    virtual Color get_color(const HitRecord &hit, const MaterialTable &materials) const;
+    virtual Vector3d get_normal_vector(const HitRecord &hit) const;
+    virtual Point3d get_min_boundary_point() const;
+    virtual Point3d get_max_boundary_point() const;
+    virtual bool secondary_light(const Point3d &point, const LightSource3d &ls,
+                                 const MaterialTable &materials,
+                                 LightSource3d &ls_secondary) const;
+    // Every face would be a secondary light source, so every shaded point
+    // would test all faces of reflecting meshes: they have none
+    virtual bool has_secondary_light() const;
+
+protected:
+    // vertexes
+    MeshArray<Float> xs;
+    MeshArray<Float> ys;
+    MeshArray<Float> zs;
+
+    // normals
+    MeshArray<Float> nxs;
+    MeshArray<Float> nys;
+    MeshArray<Float> nzs;
+
+    // 3 vertexes of every face
+    MeshArray<uint32_t> vertex_indexes;
+    // 3 normals of every face, empty while all faces are flat
+    MeshArray<uint32_t> normal_indexes;
+
+    // texture
+    const Canvas *texture;
+    MeshArray<Float> tus;
+    MeshArray<Float> tvs;
+    // 3 texture points of every face, empty while no face has them
+    MeshArray<uint32_t> texture_indexes;
+
+    // bounds of the faces
+    Point3d min_point;
+    Point3d max_point;
+
+    // the mesh cache the arrays are views of, if they are
+    std::unique_ptr<const MappedFile> cache_file;
+};
+
+#endif // TRIANGLE_MESH_H
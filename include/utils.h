@@ -1,11 +1,24 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <cfloat>
 #include <cmath>
-
+#include <cstddef>
+#include <cstdint>
+
+// Precision of geometry, KDTree and tracing, double unless the project
+// is built with SINGLE_PRECISION defined (see untitled.pro).
+// FloatBits is the signed integer of the same size.
+#ifdef SINGLE_PRECISION
+typedef float Float;
+typedef int32_t FloatBits;
+#define FLOAT_MAX FLT_MAX
+#else
 typedef double Float;
-const Float EPSILON = 1e-5;
+typedef int64_t FloatBits;
 #define FLOAT_MAX DBL_MAX
+#endif
+const Float EPSILON = 1e-5;
 
 template <typename T>
 inline T fast_max(const T &a, const T &b, const T &c) {
@@ -76,6 +89,10 @@ public:
 
 //class Point3d;
 
+/*
+ * All operations are inline, they are called for every ray and hit
+ * and are small enough for the compiler to vectorize them in place.
+ */
 class Vector3d {
 public:
     Vector3d() : Vector3d(0., 0., 0.) {
@@ -85,42 +102,113 @@ public:
         x(x), y(y), z(z) {
     }
 
-    Vector3d(const Vector3d &start, const Vector3d &end);
+    Vector3d(const Vector3d &start, const Vector3d &end) :
+        Vector3d(end.x - start.x, end.y - start.y, end.z - start.z) {
+    }
 
-    Vector3d cross(const Vector3d &other) const;
-    Float dot(const Vector3d &other) const;
-    Float cos(const Vector3d &other) const;
+    Vector3d cross(const Vector3d &other) const {
+        return cross(*this, other);
+    }
+
+    Float dot(const Vector3d &other) const {
+        return dot(*this, other);
+    }
 
-    static Vector3d cross(const Vector3d &a, const Vector3d &b);
-    static Float dot(const Vector3d &v1, const Vector3d &v2);
-    static Float cos(const Vector3d &v1, const Vector3d &v2);
+    Float cos(const Vector3d &other) const {
+        return cos(*this, other);
+    }
+
+    static Vector3d cross(const Vector3d &a, const Vector3d &b) {
+        return Vector3d(a.z * b.y - a.y * b.z,
+                        a.x * b.z - a.z * b.x,
+                        a.y * b.x - a.x * b.y);
+    }
+
+    static Float dot(const Vector3d &v1, const Vector3d &v2) {
+        return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+    }
+
+    static Float cos(const Vector3d &v1, const Vector3d &v2) {
+        return dot(v1, v2) / sqrt(v1.module2() * v2.module2());
+    }
 
     static bool check_same_clock_dir(const Vector3d &v1, const Vector3d &v2,
-                                     const Vector3d &norm);
+                                     const Vector3d &norm) {
+        const Vector3d norm_v1_v2 = cross(v2, v1);
+        return !(dot(norm_v1_v2, norm) < 0);
+    }
 
-    Vector3d reflect(const Vector3d &norm) const;
-    Vector3d mul(const Float& k) const;
+    Vector3d reflect(const Vector3d &norm) const {
+        const Float k = 2. * dot(norm) / norm.module2();
+        return Vector3d(x - norm.x * k,
+                        y - norm.y * k,
+                        z - norm.z * k);
+    }
 
+    Vector3d mul(const Float& k) const {
+        return Vector3d(x * k, y * k, z * k);
+    }
+
+
+    Vector3d rotate_x(const Float &sin_al, const Float &cos_al) const {
+        return Vector3d(x,
+                        y * cos_al - z * sin_al,
+                        y * sin_al + z * cos_al);
+    }
+
+    Vector3d rotate_y(const Float &sin_al, const Float &cos_al) const {
+        return Vector3d(x * cos_al - z * sin_al,
+                        y,
+                        x * sin_al + z * cos_al);
+    }
+
+    Vector3d rotate_z(const Float &sin_al, const Float &cos_al) const {
+        return Vector3d(x * cos_al - y * sin_al,
+                        x * sin_al + y * cos_al,
+                        z);
+    }
 
-    Vector3d rotate_x(const Float &sin_al, const Float &cos_al) const;
-    Vector3d rotate_y(const Float &sin_al, const Float &cos_al) const;
-    Vector3d rotate_z(const Float &sin_al, const Float &cos_al) const;
+    Float module2() const {
+        return x * x + y * y + z * z;
+    }
 
-    Float module2() const;
-    Float module() const;
+    Float module() const {
+        return sqrt(module2());
+    }
 
-    void normalize();
+    void normalize() {
+        const Float module = this->module();
+        x /= module;
+        y /= module;
+        z /= module;
+    }
 
     Float x;
     Float y;
     Float z;
 };
 
-Vector3d operator+(const Vector3d &a, const Vector3d &b);
-Vector3d operator-(const Vector3d &a, const Vector3d &b);
+inline Vector3d operator+(const Vector3d &a, const Vector3d &b) {
+    return Vector3d(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+inline Vector3d operator-(const Vector3d &a, const Vector3d &b) {
+    return Vector3d(a.x - b.x, a.y - b.y, a.z - b.z);
+}
 
 typedef Vector3d Point3d;
 
+// Start of the ray leaving the surface at point to the side of normal.
+// The point is moved along the normal by a few units in the last place
+// of its coordinates, so the ray doesn't hit the surface again however
+// far from the origin of coordinates it is (see: C. Waechter, N. Binder,
+// "A Fast and Robust Method for Avoiding Self-Intersection", 2019).
+Point3d offset_ray_origin(const Point3d &point, const Vector3d &normal);
+
+// Non-cryptographic 64-bit hash for detecting changed data (cache keys),
+// the data is read by 8-byte words
+uint64_t hash_bytes(const void *data, const size_t size, const uint64_t seed = 0);
+
 
 /*
 class Point3d : public Vector3d {
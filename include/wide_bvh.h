@@ -0,0 +1,102 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <include/bvh.h>
+
+/*
+ * BVH with WIDTH children per node (BVH4, BVH8), collapsed from the binary
+ * tree of BVH (see: I. Wald et al., "Getting Rid of Packets", 2008).
+ * Bounds of all children of the node are kept as arrays of floats
+ * by coordinates, so the ray is tested against all of them by the same
+ * SIMD instructions. Children hit by the ray are visited from the nearest.
+ *
+ * Children are tested by groups of 4 Float lanes, a group of double
+ * takes one AVX2 register or two SSE ones, BVH8 has two groups.
+ * Packets are traced ray by ray.
+ */
+template <int WIDTH>
+class WideBVH : public BVH {
+    friend class AcceleratorCache;
+
+public:
+    WideBVH(std::vector<Object3d *> &objects, const ThreadPool &pool);
+    virtual bool find_intersection_tree(const Point3d vector_start,
+                                        const Vector3d vector,
+                                        HitRecord &hit) const;
+    virtual int find_intersection_packet(const RayPacket &packet, HitRecord hits[]) const;
+    virtual bool is_occluded(const Point3d vector_start, const Vector3d vector,
+                             const Float max_t) const;
+    virtual Statistics get_statistics() const;
+    // Boxes are refitted to the moved objects, subtrees are not built
+    // again: the tree must be built again if it became too slow
+    virtual bool refit(const ThreadPool &pool);
+    virtual ~WideBVH();
+
+private:
+    // Every inner node is pushed into the stack once, with all its children
+    // but the nearest one
+    static const int STACK_SIZE = MAX_TREE_DEPTH * (WIDTH - 1) + 1;
+
+    // Children are tested by groups of GROUP_SIZE lanes
+    static const int GROUP_SIZE = 4;
+    static const int GROUPS = WIDTH / GROUP_SIZE;
+    typedef Float Lanes __attribute__((vector_size(GROUP_SIZE * sizeof(Float))));
+    typedef float FloatLanes __attribute__((vector_size(GROUP_SIZE * sizeof(float))));
+
+    // Node of the tree, 32 * WIDTH bytes. Unused children have empty
+    // boxes and are never hit.
+    class Node {
+    public:
+        Node();
+        Box box(const int child) const;
+        void set_box(const int child, const Box &box);
+
+        // Bounds of the i-th child are min[axis][i / GROUP_SIZE][i % GROUP_SIZE]
+        FloatLanes min[3][GROUPS];
+        FloatLanes max[3][GROUPS];
+        // Index of the node for inner children,
+        // offset of primitive_refs for leaves
+        uint32_t children[WIDTH];
+        // 0 for inner children
+        uint32_t objects_counts[WIDTH];
+    };
+
+    // Child waiting in the stack
+    class StackEntry {
+    public:
+        uint32_t child;
+        uint32_t objects_count;
+        Float t_min;
+    };
+
+    std::vector<Node> nodes;
+
+    // Nothing is built, for AcceleratorCache
+    explicit WideBVH(std::vector<Object3d *> &objects);
+
+    // Bits of children hit by the ray at 0 <= t <= t_stop,
+    // t_min is the distance to every child box
+    int clip_children(const Node &node, const Float start[], const Float inv_vector[],
+                      const Float t_stop, Float t_min[]) const;
+
+    // The same as BVH::traverse(), but compiled for the instruction set
+    // of the CPU (PACKET_KERNEL)
+    template <class LeafVisitor>
+    void traverse(const Point3d &vector_start, const Vector3d &vector,
+                  const Float &t_stop, LeafVisitor visit_leaf) const;
+    bool find_nearest(const Point3d &vector_start, const Vector3d &vector,
+                      HitRecord &hit) const;
+    bool find_any(const Point3d &vector_start, const Vector3d &vector,
+                  const Float max_t) const;
+
+    uint32_t flatten(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                     const std::vector<BuildItem> &items, std::vector<uint32_t> &mesh_indexes);
+
+    void collect_statistics(const uint32_t node, const int depth, const Float root_area,
+                            Statistics &stats) const;
+};
+
+#endif // WIDE_BVH_H
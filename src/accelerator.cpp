@@ -0,0 +1,213 @@
+#include <cfloat>
+#include <cmath>
+
+#include <include/accelerator.h>
+#include <include/bvh.h>
+#include <include/kdtree.h>
+#include <include/wide_bvh.h>
+
+const uint32_t Accelerator::NO_REF;
+
+Accelerator::Accelerator(std::vector<Object3d*> &objects)
+    : objects(objects), build_time(0.), build_threads_count(1) {
+}
+
+Accelerator::~Accelerator() {
+}
+
+Accelerator *Accelerator::build(const Type type, std::vector<Object3d*> &objects,
+                                const ThreadPool &pool) {
+    switch (type) {
+    case BVH2:
+        return new BVH(objects, pool);
+    case BVH4:
+        return new WideBVH<4>(objects, pool);
+    case BVH8:
+        return new WideBVH<8>(objects, pool);
+    case KD_TREE:
+    default:
+        return new KDTree(objects, pool, KDTree::SAH_SWEEP);
+    }
+}
+
+std::vector<Accelerator::BuildItem> Accelerator::get_build_items() const {
+    std::vector<BuildItem> items;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Primitive primitive = objects[i]->get_primitive();
+        if (primitive.type != Primitive::MESH) {
+            items.push_back({(uint32_t) i, 0, NULL});
+            continue;
+        }
+        for (uint32_t face = 0; face < primitive.mesh->get_faces_count(); ++face) {
+            items.push_back({(uint32_t) i, face, primitive.mesh});
+        }
+    }
+    return items;
+}
+
+void Accelerator::get_item_bounds(const BuildItem &item, Point3d &min_point,
+                                  Point3d &max_point) const {
+    if (item.mesh) {
+        min_point = item.mesh->get_face_min_boundary_point(item.face);
+        max_point = item.mesh->get_face_max_boundary_point(item.face);
+    } else {
+        min_point = objects[item.object]->get_min_boundary_point();
+        max_point = objects[item.object]->get_max_boundary_point();
+    }
+}
+
+std::vector<uint32_t> Accelerator::get_empty_mesh_indexes() const {
+    return std::vector<uint32_t>(objects.size(), NO_REF);
+}
+
+uint32_t Accelerator::add_primitive(const BuildItem &item, std::vector<uint32_t> &mesh_indexes) {
+    if (item.mesh) {
+        uint32_t &mesh = mesh_indexes[item.object];
+        if (mesh == NO_REF) {
+            mesh = meshes.size();
+            meshes.push_back(item.mesh);
+            primitive_objects[Primitive::MESH].push_back(objects[item.object]);
+        }
+        mesh_faces.push_back({mesh, item.face});
+        return ((mesh_faces.size() - 1) << TYPE_BITS) | Primitive::MESH;
+    }
+
+    const Primitive primitive = objects[item.object]->get_primitive();
+    const uint32_t index = primitive_objects[primitive.type].size();
+    primitive_objects[primitive.type].push_back(objects[item.object]);
+
+    switch (primitive.type) {
+    case Primitive::TRIANGLE:
+        triangles.push_back(primitive.triangle);
+        break;
+    case Primitive::QUADRANGLE:
+        quadrangles.push_back(primitive.quadrangle);
+        break;
+    case Primitive::SPHERE:
+        spheres.push_back(primitive.sphere);
+        break;
+    case Primitive::GENERIC:
+    default:
+        break;
+    }
+    return (index << TYPE_BITS) | primitive.type;
+}
+
+void Accelerator::get_primitive_bounds(const uint32_t ref, Point3d &min_point,
+                                       Point3d &max_point) const {
+    const uint32_t type = ref & TYPE_MASK;
+    const uint32_t index = ref >> TYPE_BITS;
+    if (type == Primitive::MESH) {
+        const TriangleMesh * const mesh = meshes[mesh_faces[index].mesh];
+        min_point = mesh->get_face_min_boundary_point(mesh_faces[index].face);
+        max_point = mesh->get_face_max_boundary_point(mesh_faces[index].face);
+    } else {
+        min_point = primitive_objects[type][index]->get_min_boundary_point();
+        max_point = primitive_objects[type][index]->get_max_boundary_point();
+    }
+}
+
+void Accelerator::update_primitives() {
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        triangles[i] = primitive_objects[Primitive::TRIANGLE][i]->get_primitive().triangle;
+    }
+    for (size_t i = 0; i < quadrangles.size(); ++i) {
+        quadrangles[i] = primitive_objects[Primitive::QUADRANGLE][i]->get_primitive().quadrangle;
+    }
+    for (size_t i = 0; i < spheres.size(); ++i) {
+        spheres[i] = primitive_objects[Primitive::SPHERE][i]->get_primitive().sphere;
+    }
+}
+
+size_t Accelerator::get_primitives_memory() const {
+    return primitive_refs.size() * sizeof(uint32_t)
+            + triangles.size() * sizeof(TrianglePrimitive)
+            + quadrangles.size() * sizeof(QuadranglePrimitive)
+            + spheres.size() * sizeof(SpherePrimitive)
+            + mesh_faces.size() * sizeof(MeshFace)
+            + objects.size() * sizeof(Object3d*) * 2;
+}
+
+PACKET_KERNEL
+int Accelerator::nearest_triangle(const ShearedRay &ray, const uint32_t refs[],
+                                  const int count, Float &t) const {
+    Point3d p1[RayPacket::SIZE];
+    Point3d p2[RayPacket::SIZE];
+    Point3d p3[RayPacket::SIZE];
+    for (int i = 0; i < count; ++i) {
+        const uint32_t index = refs[i] >> TYPE_BITS;
+        if ((refs[i] & TYPE_MASK) == Primitive::TRIANGLE) {
+            p1[i] = triangles[index].p1;
+            p2[i] = triangles[index].p2;
+            p3[i] = triangles[index].p3;
+        } else {
+            meshes[mesh_faces[index].mesh]->get_face_vertexes(mesh_faces[index].face,
+                                                              p1[i], p2[i], p3[i]);
+        }
+    }
+
+    Float ts[RayPacket::SIZE];
+    const int lanes = TrianglePrimitive::intersect_triangles(ray, p1, p2, p3, count, ts);
+
+    int nearest = -1;
+    for (int i = 0; i < count; ++i) {
+        if (((lanes >> i) & 1) && ((nearest < 0) || (ts[i] < t))) {
+            nearest = i;
+            t = ts[i];
+        }
+    }
+    return nearest;
+}
+
+void Accelerator::complete_hit(const uint32_t ref, HitRecord &hit) const {
+    const uint32_t type = ref & TYPE_MASK;
+    const uint32_t index = ref >> TYPE_BITS;
+    switch (type) {
+    case Primitive::TRIANGLE:
+        hit.normal = triangles[index].norm;
+        break;
+    case Primitive::QUADRANGLE:
+        hit.normal = quadrangles[index].norm;
+        break;
+    case Primitive::SPHERE:
+        hit.normal = Vector3d(spheres[index].center, hit.point);
+        break;
+    case Primitive::MESH:
+        hit.object = primitive_objects[type][mesh_faces[index].mesh];
+        hit.primitive = mesh_faces[index].face;
+        hit.normal = meshes[mesh_faces[index].mesh]->get_face(hit.primitive).norm;
+        return;
+    default:
+        break;
+    }
+    hit.object = primitive_objects[type][index];
+}
+
+float Accelerator::float_below(const Float x) {
+    const float f = x;
+    return (f > x) ? std::nextafter(f, -FLT_MAX) : f;
+}
+
+float Accelerator::float_above(const Float x) {
+    const float f = x;
+    return (f < x) ? std::nextafter(f, FLT_MAX) : f;
+}
+
+size_t Accelerator::chunks_for(const size_t count, const ThreadPool &pool) {
+    if (pool.get_threads_count() <= 1) {
+        return 1;
+    }
+    return std::max((size_t) 1, std::min(count / PARALLEL_CHUNK,
+                                         pool.get_threads_count() * 4));
+}
+
+size_t Accelerator::chunk_begin(const size_t count, const size_t chunks, const size_t chunk) {
+    return count * chunk / chunks;
+}
+
+size_t Accelerator::spawn_depth_for(const size_t threads_count) {
+    if (threads_count <= 1) {
+        return 0;
+    }
+    return (size_t) ceil(log2(threads_count * SUBTREES_PER_THREAD));
+}
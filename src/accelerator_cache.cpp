@@ -0,0 +1,390 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include <include/accelerator_cache.h>
+#include <include/bvh.h>
+#include <include/kdtree.h>
+
+const uint32_t AcceleratorCache::VERSION;
+const char * const AcceleratorCache::SUFFIX = ".accel";
+const char AcceleratorCache::MAGIC[8] = {'R', 'T', 'A', 'C', 'C', 'E', 'L', '\0'};
+
+size_t AcceleratorCache::element_size(const int array, const Accelerator::Type type) {
+    switch (array) {
+    case NODES:
+        switch (type) {
+        case Accelerator::BVH2:
+            return sizeof(BVH::FlatNode);
+        case Accelerator::BVH4:
+            return sizeof(WideBVH<4>::Node);
+        case Accelerator::BVH8:
+            return sizeof(WideBVH<8>::Node);
+        case Accelerator::KD_TREE:
+        default:
+            return sizeof(KDTree::FlatNode);
+        }
+    case MESH_FACES:
+        return sizeof(Accelerator::MeshFace);
+    default:
+        return sizeof(uint32_t);
+    }
+}
+
+std::vector<uint64_t> AcceleratorCache::get_element_sizes(const Accelerator::Type type) {
+    std::vector<uint64_t> element_sizes(ARRAYS_COUNT);
+    for (int i = 0; i < ARRAYS_COUNT; ++i) {
+        element_sizes[i] = element_size(i, type);
+    }
+    return element_sizes;
+}
+
+Accelerator *AcceleratorCache::build(const std::string &directory,
+                                     const Accelerator::Type type,
+                                     std::vector<Object3d *> &objects, const ThreadPool &pool) {
+    const uint64_t key = get_key(type, objects);
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) key);
+    const std::string filename = directory + "/" + name + SUFFIX;
+
+    Accelerator *accelerator = read(filename, key, type, objects);
+    if (!accelerator) {
+        accelerator = Accelerator::build(type, objects, pool);
+        // the accelerator is built again next time if the file can't be written
+        write(filename, key, type, *accelerator);
+    }
+    return accelerator;
+}
+
+/*
+ * Builders see only the bounds of objects and faces of meshes, copies of
+ * primitives are taken from the objects when the file is read. Types of
+ * primitives are hashed too, they choose the arrays of primitives.
+ */
+uint64_t AcceleratorCache::get_key(const Accelerator::Type type,
+                                   const std::vector<Object3d *> &objects) {
+    const Float parameters[] = {
+        (Float) VERSION, (Float) sizeof(Float), (Float) type,
+        (Float) KDTree::SAH_SWEEP, (Float) KDTree::MAX_TREE_DEPTH,
+        KDTree::TRAVERSAL_COST, KDTree::INTERSECTION_COST, KDTree::EMPTY_BONUS,
+        (Float) BVH::MAX_TREE_DEPTH, (Float) BVH::BINS_COUNT, (Float) BVH::MAX_LEAF_OBJECTS,
+        BVH::TRAVERSAL_COST, BVH::INTERSECTION_COST
+    };
+    uint64_t key = hash_bytes(parameters, sizeof(parameters));
+
+    std::vector<Float> bounds;
+    bounds.reserve(KEY_CHUNK + 7);
+    const auto add_bounds = [&](const Point3d &min_point, const Point3d &max_point) {
+        const Float item[] = {
+            min_point.x, min_point.y, min_point.z, max_point.x, max_point.y, max_point.z
+        };
+        bounds.insert(bounds.end(), item, item + 6);
+        if (bounds.size() >= KEY_CHUNK) {
+            key = hash_bytes(bounds.data(), bounds.size() * sizeof(Float), key);
+            bounds.clear();
+        }
+    };
+
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Primitive primitive = objects[i]->get_primitive();
+        bounds.push_back(primitive.type);
+        if (primitive.type != Primitive::MESH) {
+            add_bounds(objects[i]->get_min_boundary_point(),
+                       objects[i]->get_max_boundary_point());
+            continue;
+        }
+        bounds.push_back(primitive.mesh->get_faces_count());
+        for (uint32_t face = 0; face < primitive.mesh->get_faces_count(); ++face) {
+            add_bounds(primitive.mesh->get_face_min_boundary_point(face),
+                       primitive.mesh->get_face_max_boundary_point(face));
+        }
+    }
+    return hash_bytes(bounds.data(), bounds.size() * sizeof(Float), key);
+}
+
+const void *AcceleratorCache::get_nodes(const Accelerator &accelerator,
+                                        const Accelerator::Type type, size_t &count) {
+    switch (type) {
+    case Accelerator::BVH2:
+        count = static_cast<const BVH &>(accelerator).nodes.size();
+        return static_cast<const BVH &>(accelerator).nodes.data();
+    case Accelerator::BVH4:
+        count = static_cast<const WideBVH<4> &>(accelerator).nodes.size();
+        return static_cast<const WideBVH<4> &>(accelerator).nodes.data();
+    case Accelerator::BVH8:
+        count = static_cast<const WideBVH<8> &>(accelerator).nodes.size();
+        return static_cast<const WideBVH<8> &>(accelerator).nodes.data();
+    case Accelerator::KD_TREE:
+    default:
+        count = static_cast<const KDTree &>(accelerator).nodes.size();
+        return static_cast<const KDTree &>(accelerator).nodes.data();
+    }
+}
+
+bool AcceleratorCache::write(const std::string &filename, const uint64_t key,
+                             const Accelerator::Type type, const Accelerator &accelerator) {
+    // primitives are stored as indexes of their objects
+    std::unordered_map<const Object3d *, uint32_t> object_indexes;
+    for (size_t i = 0; i < accelerator.objects.size(); ++i) {
+        object_indexes.insert({accelerator.objects[i], (uint32_t) i});
+    }
+    std::vector<uint32_t> primitive_objects[Primitive::TYPES_COUNT];
+    for (int i = 0; i < Primitive::TYPES_COUNT; ++i) {
+        for (size_t j = 0; j < accelerator.primitive_objects[i].size(); ++j) {
+            primitive_objects[i].push_back(object_indexes[accelerator.primitive_objects[i][j]]);
+        }
+    }
+
+    std::vector<CacheFile::Array> arrays(ARRAYS_COUNT);
+    for (int i = 0; i < ARRAYS_COUNT; ++i) {
+        arrays[i].element_size = element_size(i, type);
+    }
+    size_t nodes_count;
+    arrays[NODES].data = get_nodes(accelerator, type, nodes_count);
+    arrays[NODES].size = nodes_count;
+    arrays[PRIMITIVE_REFS].data = accelerator.primitive_refs.data();
+    arrays[PRIMITIVE_REFS].size = accelerator.primitive_refs.size();
+    arrays[MESH_FACES].data = accelerator.mesh_faces.data();
+    arrays[MESH_FACES].size = accelerator.mesh_faces.size();
+    for (int i = 0; i < Primitive::TYPES_COUNT; ++i) {
+        arrays[PRIMITIVE_OBJECTS + i].data = primitive_objects[i].data();
+        arrays[PRIMITIVE_OBJECTS + i].size = primitive_objects[i].size();
+    }
+    // the type is hashed into the key
+    return CacheFile::write(filename, MAGIC, VERSION, key, arrays);
+}
+
+Accelerator *AcceleratorCache::read(const std::string &filename, const uint64_t key,
+                                    const Accelerator::Type type,
+                                    std::vector<Object3d *> &objects) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::unique_ptr<const MappedFile> file = CacheFile::open(filename, MAGIC, VERSION, key,
+                                                                   get_element_sizes(type));
+    if (!file) {
+        return NULL;
+    }
+
+    const std::vector<CacheFile::Array> arrays = CacheFile::get_arrays(*file);
+    std::unique_ptr<Accelerator> accelerator(create(type, objects));
+    if (!read_primitives(arrays, *accelerator) || !read_nodes(arrays, type, *accelerator)) {
+        return NULL;
+    }
+
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    accelerator->build_time = time.count();
+    accelerator->build_threads_count = 1;
+    return accelerator.release();
+}
+
+Accelerator *AcceleratorCache::create(const Accelerator::Type type,
+                                      std::vector<Object3d *> &objects) {
+    switch (type) {
+    case Accelerator::BVH2:
+        return new BVH(objects);
+    case Accelerator::BVH4:
+        return new WideBVH<4>(objects);
+    case Accelerator::BVH8:
+        return new WideBVH<8>(objects);
+    case Accelerator::KD_TREE:
+    default:
+        return new KDTree(objects, KDTree::Voxel(objects));
+    }
+}
+
+template <class T>
+void AcceleratorCache::read_array(const std::vector<CacheFile::Array> &arrays,
+                                  const int array, std::vector<T> &elements) {
+    elements.resize(arrays[array].size);
+    memcpy(static_cast<void *>(elements.data()), arrays[array].data,
+           elements.size() * sizeof(T));
+}
+
+bool AcceleratorCache::read_primitives(const std::vector<CacheFile::Array> &arrays,
+                                       Accelerator &accelerator) {
+    const std::vector<Object3d *> &objects = accelerator.objects;
+    for (int type = 0; type < Primitive::TYPES_COUNT; ++type) {
+        std::vector<uint32_t> indexes;
+        read_array(arrays, PRIMITIVE_OBJECTS + type, indexes);
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            if (indexes[i] >= objects.size()) {
+                return false;
+            }
+            Object3d * const object = objects[indexes[i]];
+            const Primitive primitive = object->get_primitive();
+            if (primitive.type != type) {
+                return false;
+            }
+
+            accelerator.primitive_objects[type].push_back(object);
+            switch (type) {
+            case Primitive::TRIANGLE:
+                accelerator.triangles.push_back(primitive.triangle);
+                break;
+            case Primitive::QUADRANGLE:
+                accelerator.quadrangles.push_back(primitive.quadrangle);
+                break;
+            case Primitive::SPHERE:
+                accelerator.spheres.push_back(primitive.sphere);
+                break;
+            case Primitive::MESH:
+                accelerator.meshes.push_back(primitive.mesh);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    read_array(arrays, MESH_FACES, accelerator.mesh_faces);
+    for (size_t i = 0; i < accelerator.mesh_faces.size(); ++i) {
+        const Accelerator::MeshFace &face = accelerator.mesh_faces[i];
+        if ((face.mesh >= accelerator.meshes.size())
+                || (face.face >= accelerator.meshes[face.mesh]->get_faces_count())) {
+            return false;
+        }
+    }
+
+    read_array(arrays, PRIMITIVE_REFS, accelerator.primitive_refs);
+    for (size_t i = 0; i < accelerator.primitive_refs.size(); ++i) {
+        const uint32_t ref = accelerator.primitive_refs[i];
+        const uint32_t type = ref & Accelerator::TYPE_MASK;
+        if (type >= (uint32_t) Primitive::TYPES_COUNT) {
+            return false;
+        }
+        const size_t count = (type == Primitive::MESH) ? accelerator.mesh_faces.size()
+                                                       : accelerator.primitive_objects[type].size();
+        if ((ref >> Accelerator::TYPE_BITS) >= count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AcceleratorCache::read_nodes(const std::vector<CacheFile::Array> &arrays,
+                                  const Accelerator::Type type, Accelerator &accelerator) {
+    const size_t refs_count = accelerator.primitive_refs.size();
+    switch (type) {
+    case Accelerator::BVH2: {
+        BVH &tree = static_cast<BVH &>(accelerator);
+        read_array(arrays, NODES, tree.nodes);
+        if (!check_binary_nodes(tree.nodes, refs_count, BVH::MAX_TREE_DEPTH)) {
+            return false;
+        }
+        // the file is written right after the build
+        tree.built_areas.resize(tree.nodes.size());
+        for (size_t i = 0; i < tree.nodes.size(); ++i) {
+            tree.built_areas[i] = tree.nodes[i].box.surface_area();
+        }
+        tree.built_cost = tree.get_statistics().sah_cost;
+        return true;
+    }
+    case Accelerator::BVH4: {
+        WideBVH<4> &tree = static_cast<WideBVH<4> &>(accelerator);
+        read_array(arrays, NODES, tree.nodes);
+        if (!check_wide_nodes(tree)) {
+            return false;
+        }
+        tree.built_cost = tree.get_statistics().sah_cost;
+        return true;
+    }
+    case Accelerator::BVH8: {
+        WideBVH<8> &tree = static_cast<WideBVH<8> &>(accelerator);
+        read_array(arrays, NODES, tree.nodes);
+        if (!check_wide_nodes(tree)) {
+            return false;
+        }
+        tree.built_cost = tree.get_statistics().sah_cost;
+        return true;
+    }
+    case Accelerator::KD_TREE:
+    default: {
+        KDTree &tree = static_cast<KDTree &>(accelerator);
+        read_array(arrays, NODES, tree.nodes);
+        return check_binary_nodes(tree.nodes, refs_count, KDTree::MAX_TREE_DEPTH);
+    }
+    }
+}
+
+/*
+ * Nodes are visited depth-first as they were flattened, the left child
+ * first: every visited node must be the next one of the array, so there
+ * are no cycles, no shared nodes and no references out of the array.
+ * Traversal stacks hold max_depth + 1 nodes.
+ */
+template <class Node>
+bool AcceleratorCache::check_binary_nodes(const std::vector<Node> &nodes,
+                                          const size_t refs_count, const int max_depth) {
+    std::vector<std::pair<uint32_t, int> > stack(1, {0, 0});
+    size_t next = 0;
+    while (!stack.empty()) {
+        const uint32_t node = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        if ((node != next) || (node >= nodes.size()) || (depth > max_depth)) {
+            return false;
+        }
+        ++next;
+
+        const Node &n = nodes[node];
+        if (n.is_leaf()) {
+            if ((uint64_t) n.objects_offset() + n.objects_count() > refs_count) {
+                return false;
+            }
+        } else {
+            stack.push_back({n.right(), depth + 1});
+            stack.push_back({node + 1, depth + 1});
+        }
+    }
+    return next == nodes.size();
+}
+
+/*
+ * The same check for WideBVH, its nodes are followed by the ones of their
+ * inner children in order. Unused children must have empty boxes, they
+ * would be visited as the root otherwise. Every inner node pushes at most
+ * WIDTH - 1 children into the traversal stack, so nodes are not deeper
+ * than MAX_TREE_DEPTH - 1.
+ */
+template <int WIDTH>
+bool AcceleratorCache::check_wide_nodes(const WideBVH<WIDTH> &tree) {
+    typedef typename WideBVH<WIDTH>::Node Node;
+    typedef typename WideBVH<WIDTH>::Box Box;
+    const std::vector<Node> &nodes = tree.nodes;
+
+    std::vector<std::pair<uint32_t, int> > stack(1, {0, 0});
+    size_t next = 0;
+    while (!stack.empty()) {
+        const uint32_t node = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        if ((node != next) || (node >= nodes.size())
+                || (depth >= WideBVH<WIDTH>::MAX_TREE_DEPTH)) {
+            return false;
+        }
+        ++next;
+
+        const Node &n = nodes[node];
+        for (int i = WIDTH; i-- > 0;) {
+            if (n.objects_counts[i]) {
+                if ((uint64_t) n.children[i] + n.objects_counts[i]
+                        > tree.primitive_refs.size()) {
+                    return false;
+                }
+            } else if (n.children[i]) {
+                stack.push_back({n.children[i], depth + 1});
+            } else {
+                const Box box = n.box(i);
+                const Box empty;
+                for (int axis = 0; axis < 3; ++axis) {
+                    if ((box.min[axis] != empty.min[axis])
+                            || (box.max[axis] != empty.max[axis])) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return next == nodes.size();
+}
@@ -0,0 +1,42 @@
+#include <algorithm>
+#include <cstdint>
+
+#include <include/arena.h>
+
+const size_t Arena::BLOCK_SIZE;
+
+Arena::Arena() : free_begin(NULL), free_end(NULL), memory(0) {
+}
+
+Arena::~Arena() {
+    for (size_t i = destructors.size(); i > 0; --i) {
+        destructors[i - 1].destroy(destructors[i - 1].object);
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        ::operator delete(blocks[i]);
+    }
+}
+
+void *Arena::allocate(const size_t size, const size_t alignment) {
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(free_begin) + alignment - 1)
+            & ~(uintptr_t)(alignment - 1);
+    if (!free_begin || (begin + size > reinterpret_cast<uintptr_t>(free_end))) {
+        // the rest of the current block is left unused
+        const size_t block_size = std::max(BLOCK_SIZE, size + alignment);
+        char * const block = static_cast<char *>(::operator new(block_size));
+        blocks.push_back(block);
+        memory += block_size;
+
+        free_begin = block;
+        free_end = block + block_size;
+        begin = (reinterpret_cast<uintptr_t>(free_begin) + alignment - 1)
+                & ~(uintptr_t)(alignment - 1);
+    }
+
+    free_begin = reinterpret_cast<char *>(begin + size);
+    return reinterpret_cast<void *>(begin);
+}
+
+size_t Arena::get_memory() const {
+    return memory;
+}
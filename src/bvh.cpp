@@ -0,0 +1,188 @@
+#include <include/bvh.h>
+
+BVH::~BVH() {
+}
+
+BVH::BuildNode::~BuildNode() {
+    if (l) {
+        delete l;
+    }
+    if (r) {
+        delete r;
+    }
+}
+
+/*
+ * Slab test (see: "slab test", Kay, Kajiya, 1986). The near side of every
+ * slab is chosen by the sign of the ray, so empty boxes are never hit.
+ * Comparisons are written to ignore NaN, which appears when the ray
+ * is parallel to the slab and starts on its border.
+ */
+inline bool BVH::Box::clip_ray(const Float start[], const Float inv_vector[],
+                               const Float t_stop) const {
+    Float t0 = 0.;
+    Float t1 = t_stop;
+    for (int axis = 0; axis < 3; ++axis) {
+        const bool positive = (inv_vector[axis] >= 0.);
+        const Float t_near = ((positive ? min[axis] : max[axis]) - start[axis])
+                * inv_vector[axis];
+        const Float t_far = ((positive ? max[axis] : min[axis]) - start[axis])
+                * inv_vector[axis] * ROBUST_FACTOR;
+        t0 = (t_near > t0) ? t_near : t0;
+        t1 = (t_far < t1) ? t_far : t1;
+    }
+    return t0 <= t1;
+}
+
+// clip_ray() for every lane
+PACKET_INLINE int BVH::Box::clip_packet(const Float start[],
+                                        const RayPacket::Lanes inv_vector[],
+                                        const RayPacket::Lanes &t_stop) const {
+    typedef RayPacket::Lanes Lanes;
+
+    Lanes t0 = Lanes{};
+    Lanes t1 = t_stop;
+    for (int axis = 0; axis < 3; ++axis) {
+        const Lanes t_a = (min[axis] - start[axis]) * inv_vector[axis];
+        const Lanes t_b = (max[axis] - start[axis]) * inv_vector[axis];
+        const RayPacket::Mask positive = (inv_vector[axis] >= 0.);
+        const Lanes t_near = positive ? t_a : t_b;
+        const Lanes t_far = (positive ? t_b : t_a) * ROBUST_FACTOR;
+        t0 = (t_near > t0) ? t_near : t0;
+        t1 = (t_far < t1) ? t_far : t1;
+    }
+    return RayPacket::to_bits(t0 <= t1);
+}
+
+/*
+ * Depth-first traversal, the child which is nearer to the ray start along
+ * the split axis goes first, the other one waits in the stack. Boxes are
+ * tested when nodes are visited, boxes starting after t_stop are skipped.
+ *
+ * visit_leaf(offset, count) of the references of the leaf returns true
+ * to stop the search and may decrease t_stop.
+ */
+template <class LeafVisitor>
+void BVH::traverse(const Point3d &vector_start, const Vector3d &vector,
+                   const Float &t_stop, LeafVisitor visit_leaf) const {
+    const Float inv_vector[] = {Float(1.) / vector.x, Float(1.) / vector.y, Float(1.) / vector.z};
+    const Float start[] = {vector_start.x, vector_start.y, vector_start.z};
+
+    uint32_t stack[MAX_TREE_DEPTH + 1];
+    int stack_size = 0;
+
+    uint32_t node = 0;
+    for (;;) {
+        const FlatNode &n = nodes[node];
+
+        if (n.box.clip_ray(start, inv_vector, t_stop)) {
+            if (!n.is_leaf()) {
+                const bool left_first = (inv_vector[n.axis()] >= 0.);
+                stack[stack_size++] = left_first ? n.right() : node + 1;
+                node = left_first ? node + 1 : n.right();
+                continue;
+            }
+
+            if (visit_leaf(n.objects_offset(), n.objects_count())) {
+                return;
+            }
+        }
+
+        if (!stack_size) {
+            return;
+        }
+        node = stack[--stack_size];
+    }
+}
+
+bool BVH::find_intersection_tree(const Point3d vector_start,
+                                 const Vector3d vector,
+                                 HitRecord &hit) const {
+    return find_nearest_hit(vector_start, vector, hit, [&](const Float &t_stop,
+                                                          const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
+
+int BVH::find_intersection_packet(const RayPacket &packet, HitRecord hits[]) const {
+    return traverse_packet(packet, hits);
+}
+
+/*
+ * The same traversal as traverse() for all rays of the packet. The packet
+ * goes to the node if any of its rays hits the box before its nearest hit.
+ * Rays of coherent packet have the same signs, so they visit children
+ * in the same order.
+ */
+PACKET_KERNEL
+int BVH::traverse_packet(const RayPacket &packet, HitRecord hits[]) const {
+    typedef RayPacket::Lanes Lanes;
+
+    const Lanes inv_vector[] = {1. / packet.x, 1. / packet.y, 1. / packet.z};
+    const Float start[] = {packet.start.x, packet.start.y, packet.start.z};
+    const PacketShear shear(packet);
+
+    uint32_t stack[MAX_TREE_DEPTH + 1];
+    int stack_size = 0;
+
+    uint32_t nearest_ref[RayPacket::SIZE] = {NO_REF, NO_REF, NO_REF, NO_REF};
+    HitRecord nearest_hits[RayPacket::SIZE];
+    Lanes nearest_t = Lanes{} + FLOAT_MAX;
+
+    uint32_t node = 0;
+    for (;;) {
+        const FlatNode &n = nodes[node];
+        const int lanes = n.box.clip_packet(start, inv_vector, nearest_t);
+
+        if (lanes && !n.is_leaf()) {
+            const bool left_first = (inv_vector[n.axis()][0] >= 0.);
+            stack[stack_size++] = left_first ? n.right() : node + 1;
+            node = left_first ? node + 1 : n.right();
+            continue;
+        }
+
+        if (lanes) {
+            const uint32_t * const leaf_refs = &primitive_refs[n.objects_offset()];
+            for (uint32_t i = 0; i < n.objects_count(); ++i) {
+                HitRecord primitive_hits[RayPacket::SIZE];
+                const int lane_hits = intersect_primitive_packet(leaf_refs[i], packet, shear,
+                                                                 lanes, primitive_hits);
+                for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+                    if (((lane_hits >> lane) & 1)
+                            && (primitive_hits[lane].t < nearest_t[lane])) {
+                        nearest_ref[lane] = leaf_refs[i];
+                        nearest_hits[lane] = primitive_hits[lane];
+                        nearest_t[lane] = primitive_hits[lane].t;
+                    }
+                }
+            }
+        }
+
+        if (!stack_size) {
+            break;
+        }
+        node = stack[--stack_size];
+    }
+
+    int found = 0;
+    for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+        if (nearest_ref[lane] == NO_REF) {
+            continue;
+        }
+        found |= 1 << lane;
+
+        if (nearest_t[lane] < hits[lane].t) {
+            complete_hit(nearest_ref[lane], nearest_hits[lane]);
+            hits[lane] = nearest_hits[lane];
+        }
+    }
+    return found;
+}
+
+bool BVH::is_occluded(const Point3d vector_start, const Vector3d vector,
+                      const Float max_t) const {
+    return find_any_hit(vector_start, vector, max_t, [&](const Float &t_stop,
+                                                         const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
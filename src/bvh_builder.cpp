@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <chrono>
+
+#include <include/bvh.h>
+#include <include/thread_pool.h>
+
+const int BVH::BINS_COUNT;
+
+/*
+ * Building of BVH using binned Surface Area Heuristic (see: I. Wald,
+ * "On fast Construction of SAH-based Bounding Volume Hierarchies", 2007)
+ *
+ * SAH of the leaf = intersection_cost * objects_count
+ *
+ * SAH of the split = traversal_cost
+ *                  + intersection_cost * (left_area / area * left_count
+ *                                       + right_area / area * right_count)
+ *
+ * Objects are splitted by their centroids: the centroid bounds of the node
+ * are divided into bins per axis, every bin keeps the count and the
+ * bounding box of its objects, so the splits between bins are evaluated
+ * in O(bins) after an O(N) pass. Nodes have up to BINS_COUNT bins,
+ * small ones have fewer: 2 bins per object are enough for them.
+ * Nodes are splitted while the best split is cheaper than the leaf
+ * or the node has more than MAX_LEAF_OBJECTS objects.
+ *
+ * Parallel build is the same as the one of KDTree: the top nodes are
+ * splitted by this thread, binning in parallel, subtrees below spawn
+ * depth are built by the pool. Ids of every node are a range of one
+ * array, partitioned in place, so subtrees don't share anything.
+ */
+
+class BVH::Builder {
+public:
+    Builder(const std::vector<Box> &boxes, const ThreadPool &pool)
+        : boxes(boxes), pool(pool), serial(1) {
+    }
+
+    // The root is at depth of the whole tree
+    BuildNode *build(std::vector<uint32_t> &ids, const int depth) {
+        std::vector<Subtree> subtrees;
+        Context top = {pool, &subtrees,
+                       depth + (int) spawn_depth_for(pool.get_threads_count())};
+
+        BuildNode *root = NULL;
+        rec_build(root, ids, 0, ids.size(), depth, top);
+
+        pool.parallel_for(subtrees.size(), [&](size_t i) {
+            Subtree &s = subtrees[i];
+            Context context = {serial, NULL, 0};
+            rec_build(*s.node, ids, s.begin, s.end, s.depth, context);
+        });
+
+        return root;
+    }
+
+private:
+    class Subtree {
+    public:
+        uint32_t begin;
+        uint32_t end;
+        int depth;
+        BuildNode **node;
+    };
+
+    class Context {
+    public:
+        const ThreadPool &pool;
+        std::vector<Subtree> *subtrees; // NULL if nothing is spawned
+        int spawn_depth;
+    };
+
+    class Bounds {
+    public:
+        Box box;
+        Box centroids;
+    };
+
+    class Bins {
+    public:
+        Box boxes[3][BINS_COUNT];
+        uint32_t counts[3][BINS_COUNT];
+    };
+
+    const std::vector<Box> &boxes;
+    const ThreadPool &pool;
+    const ThreadPool serial;
+
+    static int bin(const Float x, const Float c_min, const Float scale,
+                   const int bins_count) {
+        const int b = (int)((x - c_min) * scale);
+        return std::max(0, std::min(bins_count - 1, b));
+    }
+
+    // Boxes of objects and of their centroids,
+    // chunks of objects are processed in parallel and merged
+    Bounds get_bounds(const std::vector<uint32_t> &ids, const uint32_t begin,
+                      const uint32_t end, const ThreadPool &pool) const {
+        const size_t count = end - begin;
+        const size_t chunks = chunks_for(count, pool);
+        std::vector<Bounds> chunk_bounds(chunks);
+
+        pool.parallel_for(chunks, [&](size_t c) {
+            Bounds &bounds = chunk_bounds[c];
+            const size_t chunk_end = begin + chunk_begin(count, chunks, c + 1);
+            for (size_t i = begin + chunk_begin(count, chunks, c); i < chunk_end; ++i) {
+                const Box &box = boxes[ids[i]];
+                bounds.box.extend(box);
+                for (int axis = 0; axis < 3; ++axis) {
+                    const float c = box.centroid(axis);
+                    bounds.centroids.min[axis] = std::min(bounds.centroids.min[axis], c);
+                    bounds.centroids.max[axis] = std::max(bounds.centroids.max[axis], c);
+                }
+            }
+        });
+
+        Bounds bounds;
+        for (size_t c = 0; c < chunks; ++c) {
+            bounds.box.extend(chunk_bounds[c].box);
+            bounds.centroids.extend(chunk_bounds[c].centroids);
+        }
+        return bounds;
+    }
+
+    Bins count_bins(const std::vector<uint32_t> &ids, const uint32_t begin,
+                    const uint32_t end, const Box &centroids, const int bins_count,
+                    const ThreadPool &pool) const {
+        const size_t count = end - begin;
+        const size_t chunks = chunks_for(count, pool);
+        std::vector<Bins> chunk_bins(chunks, Bins());
+
+        pool.parallel_for(chunks, [&](size_t c) {
+            Bins &bins = chunk_bins[c];
+            const size_t chunk_end = begin + chunk_begin(count, chunks, c + 1);
+            for (int axis = 0; axis < 3; ++axis) {
+                const Float c_min = centroids.min[axis];
+                const Float extent = centroids.max[axis] - c_min;
+                if (extent <= 0.) {
+                    continue;
+                }
+                const Float scale = bins_count / extent;
+                for (size_t i = begin + chunk_begin(count, chunks, c); i < chunk_end; ++i) {
+                    const Box &box = boxes[ids[i]];
+                    const int b = bin(box.centroid(axis), c_min, scale, bins_count);
+                    bins.boxes[axis][b].extend(box);
+                    ++bins.counts[axis][b];
+                }
+            }
+        });
+
+        Bins bins = Bins();
+        for (size_t c = 0; c < chunks; ++c) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int b = 0; b < bins_count; ++b) {
+                    bins.boxes[axis][b].extend(chunk_bins[c].boxes[axis][b]);
+                    bins.counts[axis][b] += chunk_bins[c].counts[axis][b];
+                }
+            }
+        }
+        return bins;
+    }
+
+    void rec_build(BuildNode *&node, std::vector<uint32_t> &ids, const uint32_t begin,
+                   const uint32_t end, const int depth, Context &context) const {
+        if (context.subtrees && (depth == context.spawn_depth)) {
+            Subtree subtree = {begin, end, depth, &node};
+            context.subtrees->push_back(subtree);
+            node = NULL;
+            return;
+        }
+
+        const Bounds bounds = get_bounds(ids, begin, end, context.pool);
+        node = new BuildNode(bounds.box, begin, end);
+
+        const uint32_t objects_count = end - begin;
+        if ((depth >= MAX_TREE_DEPTH) || (objects_count <= 1)) {
+            return;
+        }
+
+        const int bins_count = std::min(BINS_COUNT, (int) objects_count * 2);
+        const Bins bins = count_bins(ids, begin, end, bounds.centroids, bins_count,
+                                     context.pool);
+        const Float area = bounds.box.surface_area();
+
+        Float best_cost = FLOAT_MAX;
+        int best_axis = -1;
+        int best_bin = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (bounds.centroids.max[axis] <= bounds.centroids.min[axis]) {
+                continue;
+            }
+
+            // Areas and counts of bins [0, b) and [b, bins_count)
+            Float right_areas[BINS_COUNT];
+            uint32_t right_counts[BINS_COUNT];
+            Box right_box;
+            uint32_t right_count = 0;
+            for (int b = bins_count - 1; b > 0; --b) {
+                right_box.extend(bins.boxes[axis][b]);
+                right_count += bins.counts[axis][b];
+                right_areas[b] = right_box.surface_area();
+                right_counts[b] = right_count;
+            }
+
+            Box left_box;
+            uint32_t left_count = 0;
+            for (int b = 1; b < bins_count; ++b) {
+                left_box.extend(bins.boxes[axis][b - 1]);
+                left_count += bins.counts[axis][b - 1];
+                if (!left_count || !right_counts[b]) {
+                    continue;
+                }
+                const Float cost = TRAVERSAL_COST
+                        + INTERSECTION_COST * (left_box.surface_area() / area * left_count
+                                             + right_areas[b] / area * right_counts[b]);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if ((best_cost >= INTERSECTION_COST * objects_count)
+                && (objects_count <= MAX_LEAF_OBJECTS)) {
+            return;
+        }
+
+        uint32_t middle;
+        if (best_axis >= 0) {
+            const Float c_min = bounds.centroids.min[best_axis];
+            const Float scale = bins_count / (bounds.centroids.max[best_axis] - c_min);
+            middle = std::partition(ids.begin() + begin, ids.begin() + end,
+                                    [&](const uint32_t id) {
+                return bin(boxes[id].centroid(best_axis), c_min, scale, bins_count) < best_bin;
+            }) - ids.begin();
+        } else {
+            // all centroids are the same, any split is as good as another
+            best_axis = 0;
+            middle = begin + objects_count / 2;
+        }
+
+        node->axis = best_axis;
+        rec_build(node->l, ids, begin, middle, depth + 1, context);
+        rec_build(node->r, ids, middle, end, depth + 1, context);
+    }
+};
+
+BVH::BVH(std::vector<Object3d*> &objects) : Accelerator(objects), built_cost(0.) {
+}
+
+BVH::BVH(std::vector<Object3d*> &objects, const ThreadPool &pool)
+    : Accelerator(objects), built_cost(0.) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const std::vector<BuildItem> items = get_build_items();
+    std::vector<uint32_t> ids;
+    BuildNode * const root = build_tree(items, ids, pool);
+
+    std::vector<uint32_t> mesh_indexes = get_empty_mesh_indexes();
+    flatten(root, ids, items, mesh_indexes);
+    delete root;
+
+    built_areas.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        built_areas[i] = nodes[i].box.surface_area();
+    }
+    built_cost = get_statistics().sah_cost;
+
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    build_time = time.count();
+    build_threads_count = pool.get_threads_count();
+}
+
+BVH::BuildNode *BVH::build_tree(const std::vector<BuildItem> &items,
+                                std::vector<uint32_t> &ids, const ThreadPool &pool) const {
+    std::vector<Box> boxes(items.size());
+    pool.parallel_for(chunks_for(items.size(), pool), [&](size_t c) {
+        const size_t chunks = chunks_for(items.size(), pool);
+        const size_t end = chunk_begin(items.size(), chunks, c + 1);
+        for (size_t i = chunk_begin(items.size(), chunks, c); i < end; ++i) {
+            Point3d min_p, max_p;
+            get_item_bounds(items[i], min_p, max_p);
+            boxes[i] = Box(min_p, max_p);
+        }
+    });
+
+    return build_tree(boxes, ids, pool, 0);
+}
+
+BVH::BuildNode *BVH::build_tree(const std::vector<Box> &boxes, std::vector<uint32_t> &ids,
+                                const ThreadPool &pool, const int depth) const {
+    ids.resize(boxes.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ids[i] = i;
+    }
+    return Builder(boxes, pool).build(ids, depth);
+}
+
+uint32_t BVH::flatten(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                      const std::vector<BuildItem> &items,
+                      std::vector<uint32_t> &mesh_indexes) {
+    const uint32_t index = nodes.size();
+
+    if (!node->l) {
+        nodes.push_back(FlatNode::leaf(node->box, primitive_refs.size(),
+                                       node->end - node->begin));
+        for (uint32_t i = node->begin; i < node->end; ++i) {
+            primitive_refs.push_back(add_primitive(items[ids[i]], mesh_indexes));
+        }
+        return index;
+    }
+
+    nodes.push_back(FlatNode());
+    flatten(node->l, ids, items, mesh_indexes);
+    const uint32_t right = flatten(node->r, ids, items, mesh_indexes);
+    nodes[index] = FlatNode::inner(node->box, node->axis, right);
+    return index;
+}
+
+BVH::Statistics BVH::get_statistics() const {
+    Statistics stats = {0, 0, 0, 0, 0, 0., 0, build_time, build_threads_count};
+    collect_statistics(0, 0, stats);
+    stats.memory = nodes.size() * sizeof(FlatNode)
+            + get_primitives_memory();
+    return stats;
+}
+
+void BVH::collect_statistics(const uint32_t node, const int depth, Statistics &stats) const {
+    const Float root_area = nodes[0].box.surface_area();
+    const FlatNode &n = nodes[node];
+    const Float probability = root_area ? n.box.surface_area() / root_area : 1.;
+
+    ++stats.nodes;
+    stats.depth = std::max(stats.depth, depth);
+
+    if (n.is_leaf()) {
+        ++stats.leaves;
+        if (!n.objects_count()) {
+            ++stats.empty_leaves;
+        }
+        stats.references += n.objects_count();
+        stats.sah_cost += probability * INTERSECTION_COST * n.objects_count();
+        return;
+    }
+
+    stats.sah_cost += probability * TRAVERSAL_COST;
+    collect_statistics(node + 1, depth + 1, stats);
+    collect_statistics(n.right(), depth + 1, stats);
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+
+#include <include/bvh.h>
+#include <include/thread_pool.h>
+
+/*
+ * Refit of BVH for moving objects: the hierarchy is kept, boxes of leaves
+ * are computed again from their primitives, then boxes of inner nodes from
+ * the bottom. Moved objects stretch the boxes of their ancestors, the tree
+ * stays correct but becomes slower, its SAH cost is compared with the one
+ * after the build.
+ *
+ * When the cost grew too much, the topmost subtrees whose boxes grew more
+ * than MAX_REFIT_AREA_RATIO times are built again over the same primitives
+ * (see: K. Kopta et al., "Fast, Effective BVH Updates for Animated
+ * Scenes", 2012, for other updates of the hierarchy). Boxes of the whole
+ * scene don't grow when some of its objects move inside of it, so these
+ * subtrees are usually much smaller than the tree. Subtrees are stored
+ * depth-first, so every one is a range of nodes and its leaves reference
+ * a range of primitive_refs: the new subtree takes the same range of
+ * references, nodes after it are moved.
+ */
+
+BVH::Box BVH::get_refs_box(const uint32_t offset, const uint32_t count) const {
+    Box box;
+    for (uint32_t i = offset; i < offset + count; ++i) {
+        Point3d min_p, max_p;
+        get_primitive_bounds(primitive_refs[i], min_p, max_p);
+        box.extend(Box(min_p, max_p));
+    }
+    return box;
+}
+
+bool BVH::refit(const ThreadPool &pool) {
+    update_primitives();
+
+    const size_t chunks = chunks_for(nodes.size(), pool);
+    pool.parallel_for(chunks, [&](size_t c) {
+        const size_t end = chunk_begin(nodes.size(), chunks, c + 1);
+        for (size_t i = chunk_begin(nodes.size(), chunks, c); i < end; ++i) {
+            if (nodes[i].is_leaf()) {
+                nodes[i].box = get_refs_box(nodes[i].objects_offset(),
+                                            nodes[i].objects_count());
+            }
+        }
+    });
+
+    // children are stored after their parents
+    for (size_t i = nodes.size(); i-- > 0;) {
+        if (!nodes[i].is_leaf()) {
+            nodes[i].box = nodes[i + 1].box;
+            nodes[i].box.extend(nodes[nodes[i].right()].box);
+        }
+    }
+
+    if (get_statistics().sah_cost <= built_cost * MAX_REFIT_COST_RATIO) {
+        return true;
+    }
+
+    std::vector<int> depths(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_leaf()) {
+            depths[i + 1] = depths[i] + 1;
+            depths[nodes[i].right()] = depths[i] + 1;
+        }
+    }
+
+    std::vector<uint32_t> subtrees;
+    for (uint32_t i = 0; i < nodes.size();) {
+        if (nodes[i].box.surface_area() > built_areas[i] * MAX_REFIT_AREA_RATIO) {
+            subtrees.push_back(i);
+            i = subtree_end(i);
+        } else {
+            ++i;
+        }
+    }
+    if (subtrees.empty() || (subtrees.front() == 0)) {
+        return false;
+    }
+
+    // the last ones first, the nodes before them are not moved
+    for (size_t i = subtrees.size(); i-- > 0;) {
+        rebuild_subtree(subtrees[i], depths[subtrees[i]], pool);
+    }
+    return get_statistics().sah_cost <= built_cost * MAX_REFIT_COST_RATIO;
+}
+
+uint32_t BVH::subtree_end(const uint32_t node) const {
+    uint32_t last = node;
+    while (!nodes[last].is_leaf()) {
+        last = nodes[last].right();
+    }
+    return last + 1;
+}
+
+void BVH::rebuild_subtree(const uint32_t node, const int depth, const ThreadPool &pool) {
+    const uint32_t end = subtree_end(node);
+
+    uint32_t refs_begin = primitive_refs.size();
+    uint32_t refs_end = 0;
+    for (uint32_t i = node; i < end; ++i) {
+        if (nodes[i].is_leaf() && nodes[i].objects_count()) {
+            refs_begin = std::min(refs_begin, nodes[i].objects_offset());
+            refs_end = std::max(refs_end, nodes[i].objects_offset() + nodes[i].objects_count());
+        }
+    }
+    if (refs_begin >= refs_end) {
+        return;
+    }
+
+    const std::vector<uint32_t> refs(primitive_refs.begin() + refs_begin,
+                                     primitive_refs.begin() + refs_end);
+    std::vector<Box> boxes(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+        Point3d min_p, max_p;
+        get_primitive_bounds(refs[i], min_p, max_p);
+        boxes[i] = Box(min_p, max_p);
+    }
+
+    std::vector<uint32_t> ids;
+    BuildNode * const root = build_tree(boxes, ids, pool, depth);
+    std::vector<FlatNode> subtree_nodes;
+    uint32_t next_ref = refs_begin;
+    flatten_refs(root, ids, refs, node, next_ref, subtree_nodes);
+    delete root;
+
+    // right children after the subtree are moved with it
+    const uint32_t old_size = end - node;
+    const uint32_t new_size = subtree_nodes.size();
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_leaf() && (nodes[i].right() >= end)) {
+            nodes[i] = FlatNode::inner(nodes[i].box, nodes[i].axis(),
+                                       nodes[i].right() - old_size + new_size);
+        }
+    }
+
+    std::vector<float> subtree_areas(new_size);
+    for (uint32_t i = 0; i < new_size; ++i) {
+        subtree_areas[i] = subtree_nodes[i].box.surface_area();
+    }
+
+    nodes.erase(nodes.begin() + node, nodes.begin() + end);
+    nodes.insert(nodes.begin() + node, subtree_nodes.begin(), subtree_nodes.end());
+    built_areas.erase(built_areas.begin() + node, built_areas.begin() + end);
+    built_areas.insert(built_areas.begin() + node, subtree_areas.begin(), subtree_areas.end());
+}
+
+uint32_t BVH::flatten_refs(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                           const std::vector<uint32_t> &refs, const uint32_t first_node,
+                           uint32_t &next_ref, std::vector<FlatNode> &subtree_nodes) {
+    const uint32_t index = subtree_nodes.size();
+
+    if (!node->l) {
+        subtree_nodes.push_back(FlatNode::leaf(node->box, next_ref, node->end - node->begin));
+        for (uint32_t i = node->begin; i < node->end; ++i) {
+            primitive_refs[next_ref++] = refs[ids[i]];
+        }
+        return first_node + index;
+    }
+
+    subtree_nodes.push_back(FlatNode());
+    flatten_refs(node->l, ids, refs, first_node, next_ref, subtree_nodes);
+    const uint32_t right = flatten_refs(node->r, ids, refs, first_node, next_ref,
+                                        subtree_nodes);
+    subtree_nodes[index] = FlatNode::inner(node->box, node->axis, right);
+    return first_node + index;
+}
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+#include <include/cache_file.h>
+#include <include/utils.h>
+
+const size_t CacheFile::ALIGNMENT;
+const uint32_t CacheFile::BYTE_ORDER_MARK;
+
+uint64_t CacheFile::align(const uint64_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+std::string CacheFile::temp_filename(const std::string &filename) {
+    std::ostringstream name;
+    name << filename << '.' << getpid() << '.' << std::this_thread::get_id() << ".tmp";
+    return name.str();
+}
+
+bool CacheFile::write(const std::string &filename, const char magic[8], const uint32_t version,
+                      const uint64_t key, const std::vector<Array> &arrays) {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.float_size = sizeof(Float);
+    header.arrays_count = arrays.size();
+    header.key = key;
+
+    std::vector<ArrayEntry> entries(arrays.size());
+    uint64_t offset = align(sizeof(Header) + entries.size() * sizeof(ArrayEntry));
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        entries[i].offset = offset;
+        entries[i].size = arrays[i].size;
+        entries[i].element_size = arrays[i].element_size;
+        offset = align(offset + arrays[i].size * arrays[i].element_size);
+    }
+
+    const std::string temp = temp_filename(filename);
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(ArrayEntry));
+    const char padding[ALIGNMENT] = {};
+    offset = sizeof(header) + entries.size() * sizeof(ArrayEntry);
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        const uint64_t bytes = arrays[i].size * arrays[i].element_size;
+        out.write(padding, entries[i].offset - offset);
+        out.write(static_cast<const char *>(arrays[i].data), bytes);
+        offset = entries[i].offset + bytes;
+    }
+    out.close();
+
+    if (!out || (std::rename(temp.c_str(), filename.c_str()) != 0)) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<const MappedFile> CacheFile::open(const std::string &filename,
+                                                  const char magic[8], const uint32_t version,
+                                                  const uint64_t key,
+                                                  const std::vector<uint64_t> &element_sizes) {
+    std::unique_ptr<const MappedFile> file;
+    try {
+        file.reset(new MappedFile(filename));
+    } catch (const std::runtime_error &) {
+        return NULL;
+    }
+
+    Header header;
+    if (file->size() < sizeof(header)) {
+        return NULL;
+    }
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(header.magic)) || (header.version != version)
+            || (header.byte_order != BYTE_ORDER_MARK)
+            || (header.float_size != sizeof(Float)) || (header.key != key)
+            || (header.arrays_count != element_sizes.size())
+            || (file->size() - sizeof(header) < element_sizes.size() * sizeof(ArrayEntry))) {
+        return NULL;
+    }
+
+    const char * const table = file->data() + sizeof(header);
+    for (size_t i = 0; i < element_sizes.size(); ++i) {
+        ArrayEntry entry;
+        memcpy(&entry, table + i * sizeof(ArrayEntry), sizeof(entry));
+        if ((entry.element_size != element_sizes[i]) || (entry.offset % ALIGNMENT)
+                || (entry.offset > file->size())
+                || (entry.size > (file->size() - entry.offset) / entry.element_size)) {
+            return NULL;
+        }
+    }
+    return file;
+}
+
+std::vector<CacheFile::Array> CacheFile::get_arrays(const MappedFile &file) {
+    Header header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    std::vector<Array> arrays(header.arrays_count);
+    const char * const table = file.data() + sizeof(header);
+    for (size_t i = 0; i < arrays.size(); ++i) {
+        ArrayEntry entry;
+        memcpy(&entry, table + i * sizeof(ArrayEntry), sizeof(entry));
+        arrays[i].data = file.data() + entry.offset;
+        arrays[i].size = entry.size;
+        arrays[i].element_size = entry.element_size;
+    }
+    return arrays;
+}
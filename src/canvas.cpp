@@ -10,36 +10,95 @@
 
 #include <math.h>
 
+#include <new>
+
 
 Canvas::Canvas(const char * const file_name) {
+    allocate(0, 0);
     read_png(file_name);
 }
 
-Canvas::Canvas(size_t width, size_t height)
-    : img_(QImage(width, height, QImage::Format_RGB32)) {
+Canvas::Canvas(size_t width, size_t height) {
+    allocate(width, height);
+}
+
+Canvas::Canvas(const Canvas &other) {
+    allocate(other.width_, other.height_);
+    memcpy(data_.get(), other.data_.get(), stride_ * height_ * sizeof(Pixel));
+}
+
+Canvas &Canvas::operator=(const Canvas &other) {
+    if (this != &other) {
+        allocate(other.width_, other.height_);
+        memcpy(data_.get(), other.data_.get(), stride_ * height_ * sizeof(Pixel));
+    }
+    return *this;
+}
+
+void Canvas::allocate(size_t width, size_t height) {
+    const size_t row_pixels = ROW_ALIGNMENT / sizeof(Pixel);
+    width_ = width;
+    height_ = height;
+    stride_ = (width + row_pixels - 1) / row_pixels * row_pixels;
+
+    void *data = NULL;
+    const size_t size = stride_ * height_ * sizeof(Pixel);
+    if (posix_memalign(&data, ROW_ALIGNMENT, size ? size : ROW_ALIGNMENT)) {
+        throw std::bad_alloc();
+    }
+    data_ = std::shared_ptr<Pixel>(static_cast<Pixel *>(data), free);
 }
 
 void Canvas::clear() {
-    img_.fill(QColor(0, 0, 0));
+    for (size_t y = 0; y < height_; ++y) {
+        Pixel *p = row(y);
+        for (size_t x = 0; x < width_; ++x) {
+            p[x] = to_pixel(Color(0, 0, 0));
+        }
+    }
+}
+
+static void release_shared_pixels(void *info) {
+    delete static_cast<std::shared_ptr<Canvas::Pixel> *>(info);
+}
+
+QImage Canvas::getQImage() const {
+    if (!width_ || !height_) {
+        return QImage();
+    }
+    return QImage(reinterpret_cast<uchar *>(data_.get()), width_, height_,
+                  stride_ * sizeof(Pixel), QImage::Format_RGB32,
+                  release_shared_pixels, new std::shared_ptr<Pixel>(data_));
 }
 
 void Canvas::write_png(const char * const file_name) const {
-    img_.save(file_name);
+    getQImage().save(file_name);
 }
 
 void Canvas::read_png(const char * const file_name) {
-    img_.load(file_name);
+    QImage img;
+    if (!img.load(file_name)) {
+        allocate(0, 0);
+        return;
+    }
+    img = img.convertToFormat(QImage::Format_RGB32);
+
+    allocate(img.width(), img.height());
+    for (size_t y = 0; y < height_; ++y) {
+        memcpy(row(y), img.constScanLine(y), width_ * sizeof(Pixel));
+    }
 }
 
 Canvas Canvas::grayscale() const {
-    const int w = img_.width();
-    const int h = img_.height();
+    const int w = width_;
+    const int h = height_;
     Canvas ret(w, h);
 
-    for(int x = 0; x < w; ++x) {
-        for(int y = 0; y < h; ++y) {
-            const Color gray = get_pixel(x, y).grayscale();
-            ret.set_pixel(x, y, gray);
+    for(int y = 0; y < h; ++y) {
+        const Pixel *src = row(y);
+        Pixel *dst = ret.row(y);
+        for(int x = 0; x < w; ++x) {
+            dst[x] = to_pixel(to_color(src[x]).grayscale());
         }
     }
 
@@ -61,17 +120,24 @@ int mattrix_y[3][3] =
 
 Canvas Canvas::detect_edges() const {
     Canvas grayscaled_canv = grayscale();
-    const int w = img_.width();
-    const int h = img_.height();
+    const int w = width_;
+    const int h = height_;
     Canvas grad_canv(w, h);
-    
-    for(int x = 1; x < w - 1; ++x) {
-        for(int y = 1; y < h - 1; ++y) {
+    grad_canv.clear();
+
+    for(int y = 1; y < h - 1; ++y) {
+        // gray pixels have equal components, blue one is the cheapest to get
+        const Pixel *rows[3] = {grayscaled_canv.row(y - 1),
+                                grayscaled_canv.row(y),
+                                grayscaled_canv.row(y + 1)};
+        Pixel *dst = grad_canv.row(y);
+
+        for(int x = 1; x < w - 1; ++x) {
             int gx = 0;
             for(int i = -1; i < 2; ++i) {
                 for(int j = -1; j < 2; ++j) {
                     gx += mattrix_x[i + 1][j + 1] *
-                            grayscaled_canv.get_pixel(x + i, y + j).r();
+                            (int)(rows[j + 1][x + i] & 0xff);
                 }
             }
             
@@ -79,12 +145,12 @@ Canvas Canvas::detect_edges() const {
             for(int i = -1; i < 2; ++i) {
                 for(int j = -1; j < 2; ++j) {
                     gy += mattrix_y[i + 1][j + 1] *
-                            grayscaled_canv.get_pixel(x + i, y + j).r();
+                            (int)(rows[j + 1][x + i] & 0xff);
                 }
             }
             
             Byte grad = (Byte) sqrt(gx * gx + gy * gy);
-            grad_canv.set_pixel(x, y, Color(grad, grad, grad));
+            dst[x] = to_pixel(Color(grad, grad, grad));
         }
     }
     
@@ -92,12 +158,9 @@ Canvas Canvas::detect_edges() const {
 }
 
 Color Canvas::get_pixel(int x, int y) const {
-    if ((x < 0) || (x > img_.width()) ||
-            (y < 0) || (y > img_.height())) {
+    if ((x < 0) || (x >= (int)width_) ||
+            (y < 0) || (y >= (int)height_)) {
         return Color(0, 0, 0);
     }
-    QColor c = img_.pixel(x, y);
-    int r, g, b;
-    c.getRgb(&r, &g, &b);
-    return Color(r, g, b);
+    return to_color(row(y)[x]);
 }
@@ -1,6 +1,6 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
-#include <cfloat>
 #include <cmath>
 #include <cstring>
 #include <stdexcept>
@@ -9,19 +9,7 @@
 #include <include/kdtree.h>
 #include <include/utils.h>
 
-bool KDTree::Voxel::is_in(const Point3d p) const {
-    return ((p.x > x_min) && (p.x < x_max) &&
-            (p.y > y_min) && (p.y < y_max) &&
-            (p.z > z_min) && (p.z < z_max));
-}
-
-KDTree::KDTree(std::vector<Object3d*> &objects) {
-    bounding_box = Voxel(objects);
-    root = rec_build(objects, bounding_box, 0);
-}
-
 KDTree::~KDTree() {
-    delete root;
 }
 
 KDTree::KDNode::~KDNode() {
@@ -33,39 +21,6 @@ KDTree::KDNode::~KDNode() {
     }
 }
 
-KDTree::KDNode* KDTree::rec_build(std::vector<Object3d*> &objects, Voxel v, int iter) {
-    enum Plane p;
-    Point3d c;
-    v.find_plane(objects, iter, p, c);
-
-    if (p == NONE) {
-        return new KDNode(objects);
-    }
-
-    Voxel vl, vr;
-    v.split(p, c, vl, vr);
-
-    std::vector<Object3d*> l_obj = vl.filter_overlapped_objects(objects);
-    KDNode * l = rec_build(l_obj, vl, iter + 1);
-
-    std::vector<Object3d*> r_obj = vr.filter_overlapped_objects(objects);
-    KDNode * r = rec_build(r_obj, vr, iter + 1);
-
-    KDNode * node = new KDNode(p, c, std::vector<Object3d*>(), l, r);
-    return node;
-}
-
-std::vector<Object3d*>
-KDTree::Voxel::filter_overlapped_objects(const std::vector<Object3d *> &objects) const {
-    std::vector<Object3d*> result;
-    for (size_t i = 0; i < objects.size(); ++i) {
-        if (is_in(objects[i])) {
-            result.push_back(objects[i]);
-        }
-    }
-    return result;
-}
-
 void KDTree::Voxel::split(const enum Plane p, const Point3d c,
                         Voxel& vl, Voxel& vr) const {
     vl = vr = (*this);
@@ -87,149 +42,6 @@ void KDTree::Voxel::split(const enum Plane p, const Point3d c,
     }
 }
 
-/*
- * Using Surface Area Heuristic (SAH) for finding best split pane
- *
- * SAH = 0.5 * voxel_surface_area * number_of_objects_in_voxel
- *
- * splitted_SAH = split_cost
- *                + 0.5 * left_voxel_surface_area * number_of_objects_in_left_voxel
- *                + 0.5 * right_voxel_surface_area * number_of_objects_in_right_voxel
- *
- * Finding coordinate of split plane (XY, XZ or YZ) which minimizing SAH
- *
- * If can't find optimal split plane - returns NONE
- *
- * see: http://stackoverflow.com/a/4633332/653511
- */
-
-void KDTree::Voxel::find_plane(const std::vector<Object3d*> &objects, const int tree_depth,
-                       enum Plane &p, Point3d &c) const {
-    if ((tree_depth >= MAX_TREE_DEPTH) || (objects.size() <= OBJECTS_IN_LEAF)) {
-        p = NONE;
-        return;
-    }
-
-    const Float hx = x_max - x_min;
-    const Float hy = y_max - y_min;
-    const Float hz = z_max - z_min;
-
-    // evaluating square of each side of init voxel
-    Float Sxy = hx * hy;
-    Float Sxz = hx * hz;
-    Float Syz = hy * hz;
-
-    const Float Ssum = Sxy + Sxz + Syz;
-
-    // Let's normalize square of each side of initial voxel
-    // to satisfy the following relationship:
-    // Sxy + Sxz + Syz = 1
-    Sxy /= Ssum;
-    Sxz /= Ssum;
-    Syz /= Ssum;
-
-    // Assume that at the beginning best SAH has initial voxel
-    // SAH = 0.5 * square * objects_count
-    // square of initial voxel is Sxy + Sxz + Syz = 1
-    Float bestSAH = objects.size();
-    // initial voxel doesn't have split pane
-    p = NONE;
-
-    Float S_split;
-    Float S_non_split;
-
-    // let's find split surface, which have the least SAH
-    // trying to minimize SAH by splitting across XY plane
-    S_split = Sxy;
-    S_non_split = Sxz + Syz;
-    for (int i = 1; i < MAX_SPLITS_OF_VOXEL; i++) {
-        Voxel vl, vr;
-        Float l, r, currSAH;
-        Point3d curr_split_coord;
-
-        l = ((Float) i) / MAX_SPLITS_OF_VOXEL;
-        r = 1. - l;
-
-        // Current coordinate of split surface
-        curr_split_coord.z = z_min + l * hz;
-
-        split(XY, curr_split_coord, vl, vr);
-
-        currSAH = (S_split + l * S_non_split) * vl.count_objects_in(objects)
-                + (S_split + r * S_non_split) * vr.count_objects_in(objects)
-                + SPLIT_COST;
-
-        if(currSAH < bestSAH) {
-            bestSAH = currSAH;
-            p = XY;
-            c = curr_split_coord;
-        }
-    }
-
-    // trying to minimize SAH by splitting across XZ plane
-    S_split = Sxz;
-    S_non_split = Sxy + Syz;
-    for (int i = 1; i < MAX_SPLITS_OF_VOXEL; i++) {
-        Voxel vl, vr;
-        Float l, r, currSAH;
-        Point3d curr_split_coord;
-        l = ((Float) i) / MAX_SPLITS_OF_VOXEL;
-        r = 1. - l;
-
-        // Current coordinate of split surface
-        curr_split_coord.y = y_min + l * hy;
-
-        split(XZ, curr_split_coord, vl, vr);
-
-        currSAH = (S_split + l * S_non_split) * vl.count_objects_in(objects)
-                + (S_split + r * S_non_split) * vr.count_objects_in(objects)
-                + SPLIT_COST;
-
-        if (currSAH < bestSAH) {
-            bestSAH = currSAH;
-            p = XZ;
-            c = curr_split_coord;
-        }
-    }
-
-    // trying to minimize SAH by splitting across YZ plane
-    S_split = Syz;
-    S_non_split = Sxy + Sxz;
-    for (int i = 1; i < MAX_SPLITS_OF_VOXEL; i++) {
-        Voxel vl, vr;
-        Float l, r, currSAH;
-        Point3d curr_split_coord;
-        l = ((Float) i) / MAX_SPLITS_OF_VOXEL;
-        r = 1. - l;
-
-        // Current coordinate of split surface
-        curr_split_coord.x = x_min + l * hx;
-
-        split(YZ, curr_split_coord, vl, vr);
-
-        currSAH = (S_split + l * S_non_split) * vl.count_objects_in(objects)
-                + (S_split + r * S_non_split) * vr.count_objects_in(objects)
-                + SPLIT_COST;
-
-        if (currSAH < bestSAH) {
-            bestSAH = currSAH;
-            p = YZ;
-            c = curr_split_coord;
-        }
-    }
-}
-
-int KDTree::Voxel::count_objects_in(const std::vector<Object3d*> &objects) const {
-    int count = 0;
-    for (size_t i = 0; i < objects.size(); ++i) {
-        if (is_in(objects[i])) {
-            ++count;
-        }
-    }
-
-    return count;
-}
-
 KDTree::Voxel::Voxel(const std::vector<Object3d*> &objects) {
     if (objects.empty()) {
         (*this) = {-1, -1, -1, 1, 1, 1};
@@ -265,279 +77,357 @@ KDTree::Voxel::Voxel(const std::vector<Object3d*> &objects) {
     (*this) = {x_min - 1, y_min - 1, z_min - 1, x_max + 1, y_max + 1, z_max + 1};
 }
 
-bool KDTree::Voxel::is_in(Object3d * const obj) const {
-    Point3d min_p = obj->get_min_boundary_point();
-    Point3d max_p = obj->get_max_boundary_point();
-
-    return !((max_p.x < x_min) || (max_p.y < y_min) || (max_p.z < z_min)
-          || (min_p.x > x_max) || (min_p.y > y_max) || (min_p.z > z_max) );
+KDTree::Voxel KDTree::Voxel::round_out_to_float() const {
+    return Voxel(float_below(x_min), float_below(y_min), float_below(z_min),
+                 float_above(x_max), float_above(y_max), float_above(z_max));
 }
 
-KDTree::KDNode::KDNode(const std::vector<Object3d*> &objects) {
-    plane = NONE;
+Float KDTree::Voxel::get_min(const enum Plane p) const {
+    switch (p) {
+    case XY:
+        return z_min;
+    case XZ:
+        return y_min;
+    case YZ:
+        return x_min;
+    case NONE:
+    default:
+        // Unreachable case
+        throw std::runtime_error("[get_min] Plane is NONE. Error");
+    }
+}
 
-    for (size_t i = 0; i < objects.size(); ++i) {
-        this->objects.push_back(objects[i]); // TODO REWRITE
+Float KDTree::Voxel::get_max(const enum Plane p) const {
+    switch (p) {
+    case XY:
+        return z_max;
+    case XZ:
+        return y_max;
+    case YZ:
+        return x_max;
+    case NONE:
+    default:
+        // Unreachable case
+        throw std::runtime_error("[get_max] Plane is NONE. Error");
     }
+}
 
-    l = NULL;
-    r = NULL;
+Float KDTree::Voxel::surface_area() const {
+    const Float hx = x_max - x_min;
+    const Float hy = y_max - y_min;
+    const Float hz = z_max - z_min;
+    return 2. * (hx * hy + hx * hz + hy * hz);
 }
 
-bool KDTree::Voxel::vector_plane_intersection(const Vector3d vector,
-                                      const Point3d vector_start,
-                                      const enum Plane plane,
-                                      const Point3d coord,
-                                      Point3d &result) {
-    Float k;
-    switch (plane) {
-    case XY:
-        if (((coord.z < vector_start.z) && (vector.z > 0))
-                || ((coord.z > vector_start.z) && (vector.z < 0))) {
-            return false;
-        }
+KDTree::Voxel KDTree::Voxel::clip(const Voxel &other) const {
+    return Voxel(std::max(x_min, other.x_min), std::max(y_min, other.y_min),
+                 std::max(z_min, other.z_min), std::min(x_max, other.x_max),
+                 std::min(y_max, other.y_max), std::min(z_max, other.z_max));
+}
 
-        k = (coord.z - vector_start.z) / vector.z;
-        result = Point3d(vector_start.x + vector.x * k,
-                          vector_start.y + vector.y * k,
-                          coord.z);
+Point3d KDTree::plane_coord(const enum Plane p, const Float position) {
+    Point3d c;
+    switch (p) {
+    case XY:
+        c.z = position;
         break;
-
     case XZ:
-        if (((coord.y < vector_start.y) && (vector.y > 0))
-                || ((coord.y > vector_start.y) && (vector.y < 0)))
-            return false;
-
-        k = (coord.y - vector_start.y) / vector.y;
-        result = Point3d(vector_start.x + vector.x * k,
-                          coord.y,
-                          vector_start.z + vector.z * k);
+        c.y = position;
         break;
-
     case YZ:
-        if (((coord.x < vector_start.x) && (vector.x > 0))
-           || ((coord.x > vector_start.x) && (vector.x < 0)))
-            return false;
-
-        k = (coord.x - vector_start.x) / vector.x;
-        result = Point3d(coord.x,
-                          vector_start.y + vector.y * k,
-                          vector_start.z + vector.z * k);
+        c.x = position;
         break;
-
     case NONE:
     default:
         // Unreachable case
-        throw new std::runtime_error("[vector_plane_intersection] Plane is NONE. Error");
-        break;
+        throw std::runtime_error("[plane_coord] Plane is NONE. Error");
     }
-
-    return true;
+    return c;
 }
 
-inline bool KDTree::Voxel::x_in_voxel(const Float x) const {
-    return (x_min < x) && (x < x_max);
+KDTree::KDNode::KDNode(const std::vector<uint32_t> &objects)
+    : plane(NONE), objects(objects), l(NULL), r(NULL) {
 }
 
-inline bool KDTree::Voxel::y_in_voxel(const Float y) const {
-    return (y_min < y) && (y < y_max);
+static inline Float along(const Vector3d &v, const int axis) {
+    return (axis == 0) ? v.x : ((axis == 1) ? v.y : v.z);
 }
 
-inline bool KDTree::Voxel::z_in_voxel(const Float z) const {
-    return (z_min < z) && (z < z_max);
+// Index of coordinate axis normal to plane
+static inline int axis_of(const int plane) {
+    // XY -> z, XZ -> y, YZ -> x
+    return 2 - plane;
 }
 
-bool KDTree::Voxel::intersection(const Vector3d vector,
-                               const Point3d vector_start) const {
-    if (is_in(vector_start)) {
-        return true;
+/*
+ * Clips ray vector_start + t * vector, t >= 0, by the voxel
+ * (see: "slab test", Kay, Kajiya, 1986)
+ *
+ * Comparisons are written to ignore NaN, which appears when the ray
+ * is parallel to the slab and starts on its border.
+ */
+bool KDTree::Voxel::clip_ray(const Point3d &vector_start, const Vector3d &vector,
+                             Float &t_min, Float &t_max) const {
+    const Float mins[] = {x_min, y_min, z_min};
+    const Float maxs[] = {x_max, y_max, z_max};
+
+    Float t0 = 0.;
+    Float t1 = FLOAT_MAX;
+    for (int axis = 0; axis < 3; ++axis) {
+        const Float inv = 1. / along(vector, axis);
+        Float t_near = (mins[axis] - along(vector_start, axis)) * inv;
+        Float t_far = (maxs[axis] - along(vector_start, axis)) * inv;
+        if (t_near > t_far) {
+            std::swap(t_near, t_far);
+        }
+        t0 = (t_near > t0) ? t_near : t0;
+        t1 = (t_far < t1) ? t_far : t1;
+        if (t0 > t1) {
+            return false;
+        }
     }
 
-    Point3d p, c;
-
-    c.z = z_min;
-    if (vector_plane_intersection(vector, vector_start, XY, c, p)
-            && x_in_voxel(p.x) && y_in_voxel(p.y)) {
-        return true;
-    }
+    t_min = t0;
+    t_max = t1;
+    return true;
+}
 
-    c.z = z_max;
-    if (vector_plane_intersection(vector, vector_start, XY, c, p)
-            && x_in_voxel(p.x) && y_in_voxel(p.y)) {
-        return true;
+/*
+ * Front to back traversal keeping the interval [t_min, t_max] of the ray
+ * inside of the current voxel (see: V. Havran, "Heuristic Ray Shooting
+ * Algorithms", 2000, algorithm "TA_B_rec"). Inner nodes only compute the
+ * distance to the split plane, far children wait in the stack.
+ *
+ * Every intersection found is real, so leaves accept hits outside of
+ * their voxel. visit_leaf(offset, count) of the references of the leaf
+ * returns true to stop the search and may decrease t_stop: voxels starting
+ * after t_stop are skipped.
+ */
+template <class LeafVisitor>
+void KDTree::traverse(const Point3d &vector_start, const Vector3d &vector,
+                      const Float &t_stop, LeafVisitor visit_leaf) const {
+    Float t_min, t_max;
+    if (!bounding_box.clip_ray(vector_start, vector, t_min, t_max)
+            || (t_stop < t_min)) {
+        return;
     }
 
-    c.y = y_min;
-    if (vector_plane_intersection(vector, vector_start, XZ, c, p)
-            && x_in_voxel(p.x) && z_in_voxel(p.z)) {
-        return true;
-    }
+    const Float inv_vector[] = {Float(1.) / vector.x, Float(1.) / vector.y, Float(1.) / vector.z};
+    const Float start[] = {vector_start.x, vector_start.y, vector_start.z};
+
+    class StackEntry {
+    public:
+        uint32_t node;
+        Float t_min;
+        Float t_max;
+    };
+    StackEntry stack[MAX_TREE_DEPTH + 1];
+    int stack_size = 0;
+
+    uint32_t node = 0;
+    for (;;) {
+        const FlatNode &n = nodes[node];
+
+        if (!n.is_leaf()) {
+            const int axis = axis_of(n.plane());
+            const Float split = n.split();
+
+            // left child is below the split plane
+            const bool below_first = (start[axis] < split)
+                    || ((start[axis] == split) && (inv_vector[axis] <= 0));
+            const uint32_t first = below_first ? node + 1 : n.right();
+            const uint32_t second = below_first ? n.right() : node + 1;
+
+            if (along(vector, axis) == 0.) {
+                // parallel to the split plane, maybe lying in it
+                if (start[axis] == split) {
+                    stack[stack_size++] = {second, t_min, t_max};
+                }
+                node = first;
+                continue;
+            }
 
-    c.y = y_max;
-    if (vector_plane_intersection(vector, vector_start, XZ, c, p)
-            && x_in_voxel(p.x) && z_in_voxel(p.z)) {
-        return true;
-    }
+            const Float t_split = (split - start[axis]) * inv_vector[axis];
+            if ((t_split > t_max) || (t_split <= 0.)) {
+                node = first;
+            } else if (t_split < t_min) {
+                node = second;
+            } else {
+                stack[stack_size++] = {second, t_split, t_max};
+                node = first;
+                t_max = t_split;
+            }
+            continue;
+        }
 
-    c.x = x_min;
-    if (vector_plane_intersection(vector, vector_start, YZ, c, p)
-            && y_in_voxel(p.y) && z_in_voxel(p.z)) {
-        return true;
-    }
+        if (visit_leaf(n.objects_offset(), n.objects_count())) {
+            return;
+        }
 
-    c.x = x_max;
-    if (vector_plane_intersection(vector, vector_start, YZ, c, p)
-            && y_in_voxel(p.y) && z_in_voxel(p.z)) {
-        return true;
+        do {
+            if (!stack_size) {
+                return;
+            }
+            --stack_size;
+            node = stack[stack_size].node;
+            t_min = stack[stack_size].t_min;
+            t_max = stack[stack_size].t_max;
+        } while (t_stop < t_min);
     }
-
-    return false;
 }
 
 bool KDTree::find_intersection_tree(const Point3d vector_start,
                                     const Vector3d vector,
-                                    Object3d* &nearest_obj_ptr,
-                                    Point3d &nearest_intersection_point_ptr,
-                                    Float &nearest_intersection_point_dist_ptr) {
-
-    return (bounding_box.intersection(vector, vector_start)
-            && find_intersection_node(root,
-                                      bounding_box,
-                                      vector_start,
-                                      vector,
-                                      nearest_obj_ptr,
-                                      nearest_intersection_point_ptr,
-                                      nearest_intersection_point_dist_ptr));
+                                    HitRecord &hit) const {
+    return find_nearest_hit(vector_start, vector, hit, [&](const Float &t_stop,
+                                                          const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
 
+int KDTree::find_intersection_packet(const RayPacket &packet, HitRecord hits[]) const {
+    return traverse_packet(packet, hits);
 }
 
-bool KDTree::find_intersection_node(KDNode * const node,
-                            const Voxel v,
-                            const Point3d vector_start,
-                            const Vector3d vector,
-                            Object3d* &nearest_obj_ptr,
-                            Point3d &nearest_intersection_point_ptr,
-                            Float &nearest_intersection_point_dist_ptr) {
-    if (node->plane == NONE) {
-        if (node->objects.size()) {
-            Object3d * nearest_obj = NULL;
-            Point3d nearest_intersection_point;
-            Float sqr_nearest_dist = 1E99; // TODO REWRITE
-
-            bool intersected = false;
-
-            // Finding nearest object
-            // and intersection point
-            for (size_t i = 0; i < node->objects.size(); ++i) {
-                if (node->objects[i]) {
-                    Object3d * obj = node->objects[i];
-                    Point3d intersection_point;
-
-                    if ((obj->intersect(vector_start, vector, intersection_point))
-                            && (v.is_in(intersection_point))) {
-
-                        Float sqr_curr_dist = Vector3d(vector_start, intersection_point).module2();
-
-                        if ((sqr_curr_dist < sqr_nearest_dist) || (!intersected)) {
-
-                            nearest_obj = obj;
-                            nearest_intersection_point = intersection_point;
-                            sqr_nearest_dist = sqr_curr_dist;
-                            intersected = true;
-                        }
-                    }
-                }
+/*
+ * The same traversal as traverse() for all rays of the packet, every ray
+ * has its own [t_min, t_max] in the lane. The packet goes to the child
+ * if any of the rays needs it, rays not needing it get empty interval.
+ * Rays of coherent packet visit children in the same order, so every ray
+ * visits the same leaves and finds the same hit as a single ray does.
+ */
+PACKET_KERNEL
+int KDTree::traverse_packet(const RayPacket &packet, HitRecord hits[]) const {
+    typedef RayPacket::Lanes Lanes;
+    typedef RayPacket::Mask Mask;
+
+    const Lanes vector[] = {packet.x, packet.y, packet.z};
+    const Lanes inv_vector[] = {1. / packet.x, 1. / packet.y, 1. / packet.z};
+    const Float start[] = {packet.start.x, packet.start.y, packet.start.z};
+    const PacketShear shear(packet);
+    const Lanes zero = Lanes{};
+    const Lanes empty_min = zero + FLOAT_MAX;
+    const Lanes empty_max = zero - FLOAT_MAX;
+
+    // Voxel::clip_ray for every lane
+    const Float mins[] = {bounding_box.x_min, bounding_box.y_min, bounding_box.z_min};
+    const Float maxs[] = {bounding_box.x_max, bounding_box.y_max, bounding_box.z_max};
+    Lanes t_min = zero;
+    Lanes t_max = zero + FLOAT_MAX;
+    for (int axis = 0; axis < 3; ++axis) {
+        const Lanes t_a = (mins[axis] - start[axis]) * inv_vector[axis];
+        const Lanes t_b = (maxs[axis] - start[axis]) * inv_vector[axis];
+        const Lanes t_near = (t_a > t_b) ? t_b : t_a;
+        const Lanes t_far = (t_a > t_b) ? t_a : t_b;
+        t_min = (t_near > t_min) ? t_near : t_min;
+        t_max = (t_far < t_max) ? t_far : t_max;
+    }
+
+    class StackEntry {
+    public:
+        Lanes t_min;
+        Lanes t_max;
+        uint32_t node;
+    };
+    StackEntry stack[MAX_TREE_DEPTH + 1];
+    int stack_size = 0;
+
+    uint32_t nearest_ref[RayPacket::SIZE] = {NO_REF, NO_REF, NO_REF, NO_REF};
+    HitRecord nearest_hits[RayPacket::SIZE];
+    Lanes nearest_t = zero + FLOAT_MAX;
+
+    Mask live = (t_min <= t_max);
+    uint32_t node = 0;
+    while (RayPacket::to_bits(live)) {
+        const FlatNode &n = nodes[node];
+
+        if (!n.is_leaf()) {
+            const int axis = axis_of(n.plane());
+            const Float split = n.split();
+
+            // the same for all rays of coherent packet
+            const bool below_first = (start[axis] < split)
+                    || ((start[axis] == split) && (vector[axis][0] < 0));
+            const uint32_t first = below_first ? node + 1 : n.right();
+            const uint32_t second = below_first ? n.right() : node + 1;
+
+            // rays parallel to the split plane and lying in it get NaN
+            // t_split and need both children with the whole interval
+            Mask in_plane = Mask{};
+            if (start[axis] == split) {
+                in_plane = (vector[axis] == 0.);
             }
 
-            if (intersected) {
-                Float nearest_dist = sqrt(sqr_nearest_dist);
+            const Lanes t_split = (split - start[axis]) * inv_vector[axis];
+            const Mask first_only = ~in_plane & ((t_split > t_max) | (t_split <= 0.));
+            const Mask second_only = ~in_plane & ~first_only & (t_split < t_min);
+            const Mask need_first = live & ~second_only;
+            const Mask need_second = live & ~first_only;
+
+            if (!RayPacket::to_bits(need_second)) {
+                node = first;
+            } else if (!RayPacket::to_bits(need_first)) {
+                node = second;
+            } else {
+                const Lanes second_t_min = (second_only | in_plane) ? t_min : t_split;
+                const Lanes first_t_max = (first_only | in_plane) ? t_max : t_split;
+                stack[stack_size++] = {need_second ? second_t_min : empty_min, t_max, second};
+                node = first;
+                t_max = need_first ? first_t_max : empty_max;
+            }
+            live = (t_min <= t_max) & ~(nearest_t < t_min);
+            continue;
+        }
 
-                if (nearest_dist < nearest_intersection_point_dist_ptr) {
-                    nearest_intersection_point_dist_ptr = nearest_dist;
-                    nearest_obj_ptr = nearest_obj;
-                    nearest_intersection_point_ptr = nearest_intersection_point;
+        const int lanes = RayPacket::to_bits(live);
+        const uint32_t * const leaf_refs = &primitive_refs[n.objects_offset()];
+        for (uint32_t i = 0; i < n.objects_count(); ++i) {
+            HitRecord primitive_hits[RayPacket::SIZE];
+            const int lane_hits = intersect_primitive_packet(leaf_refs[i], packet, shear,
+                                                             lanes, primitive_hits);
+            for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+                if (((lane_hits >> lane) & 1) && (primitive_hits[lane].t < nearest_t[lane])) {
+                    nearest_ref[lane] = leaf_refs[i];
+                    nearest_hits[lane] = primitive_hits[lane];
+                    nearest_t[lane] = primitive_hits[lane].t;
                 }
             }
-
-            return intersected;
         }
-        return false;
-    }
-
-    // Otherwise
-
-    Voxel front_voxel;
-    Voxel back_voxel;
 
-    KDNode * front_node;
-    KDNode * back_node;
-
-    switch (node->plane) {
-    case XY:
-        if (((node->coord.z > v.z_min) && (node->coord.z > vector_start.z))
-           || ((node->coord.z < v.z_min) && (node->coord.z < vector_start.z))) {
-
-            front_node = node->l;
-            back_node = node->r;
-            v.split(node->plane, node->coord, front_voxel, back_voxel);
-        } else {
-            front_node = node->r;
-            back_node = node->l;
-            v.split(node->plane, node->coord, back_voxel, front_voxel);
+        live = Mask{};
+        while (stack_size && !RayPacket::to_bits(live)) {
+            --stack_size;
+            node = stack[stack_size].node;
+            t_min = stack[stack_size].t_min;
+            t_max = stack[stack_size].t_max;
+            live = (t_min <= t_max) & ~(nearest_t < t_min);
         }
-        break;
+    }
 
-    case XZ:
-        if (((node->coord.y > v.y_min) && (node->coord.y > vector_start.y))
-           || ((node->coord.y < v.y_min) && (node->coord.y < vector_start.y))) {
-
-            front_node = node->l;
-            back_node = node->r;
-            v.split(node->plane, node->coord, front_voxel, back_voxel);
-        } else {
-            front_node = node->r;
-            back_node = node->l;
-            v.split(node->plane, node->coord, back_voxel, front_voxel);
+    int found = 0;
+    for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+        if (nearest_ref[lane] == NO_REF) {
+            continue;
         }
-        break;
+        found |= 1 << lane;
 
-    case YZ:
-        if (((node->coord.x > v.x_min) && (node->coord.x > vector_start.x))
-           || ((node->coord.x < v.x_min) && (node->coord.x < vector_start.x))) {
-
-            front_node = node->l;
-            back_node = node->r;
-            v.split(node->plane, node->coord, front_voxel, back_voxel);
-        } else {
-            front_node = node->r;
-            back_node = node->l;
-            v.split(node->plane, node->coord, back_voxel, front_voxel);
+        if (nearest_t[lane] < hits[lane].t) {
+            complete_hit(nearest_ref[lane], nearest_hits[lane]);
+            hits[lane] = nearest_hits[lane];
         }
-        break;
-
-    case NONE:
-    default:
-        // Unreachable case
-        throw std::runtime_error("[find_intersection_node] Plane is NONE. Error");
-        break;
     }
+    return found;
+}
+
+bool KDTree::is_occluded(const Point3d vector_start, const Vector3d vector,
+                         const Float max_t) const {
+    return find_any_hit(vector_start, vector, max_t, [&](const Float &t_stop,
+                                                         const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
 
-    if (front_voxel.intersection(vector, vector_start)
-       && find_intersection_node(front_node,
-                                 front_voxel,
-                                 vector_start,
-                                 vector,
-                                 nearest_obj_ptr,
-                                 nearest_intersection_point_ptr,
-                                 nearest_intersection_point_dist_ptr))
-        return true;
-
-    return (back_voxel.intersection(vector, vector_start)
-            && find_intersection_node(back_node,
-                                      back_voxel,
-                                      vector_start,
-                                      vector,
-                                      nearest_obj_ptr,
-                                      nearest_intersection_point_ptr,
-                                      nearest_intersection_point_dist_ptr));
+bool KDTree::refit(const ThreadPool &pool) {
+    (void)pool;
+    return false;
 }
@@ -0,0 +1,762 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <include/kdtree.h>
+#include <include/thread_pool.h>
+
+const int KDTree::MAX_TREE_DEPTH;
+
+/*
+ * Building of kd-tree using Surface Area Heuristic (SAH)
+ *
+ * SAH of the leaf = intersection_cost * objects_count
+ *
+ * SAH of the split = traversal_cost
+ *                  + intersection_cost * (left_area / area * left_count
+ *                                       + right_area / area * right_count)
+ *
+ * Voxel is splitted while the best split is cheaper than the leaf.
+ *
+ * SweepBuilder evaluates SAH on every boundary of object bounding boxes.
+ * To do that in O(N log N) it keeps boundaries ("events") sorted from the
+ * root to leaves and only merges small sorted lists on every split, see:
+ * I. Wald, V. Havran "On building fast kd-trees for ray tracing,
+ * and on doing that in O(N log N)", 2006.
+ *
+ * BinnedBuilder evaluates SAH only on BINS_COUNT - 1 planes per axis,
+ * counting objects in bins in O(N) per voxel without any sorting.
+ *
+ * Both builders work with bounding boxes of objects and faces of meshes,
+ * cached once in the constructor of KDTree.
+ *
+ * With several threads the builders split the top voxels of the tree
+ * using all threads for sweeping, binning and partitioning, down to
+ * the depth with about SUBTREES_PER_THREAD voxels per thread. Subtrees of
+ * these voxels are built independently by the work-stealing pool.
+ * Split decisions don't depend on the threads count, so the tree
+ * is the same as the one built by a single thread.
+ */
+
+class KDTree::SplitEvent {
+public:
+    enum Type {END = 0, PLANAR = 1, START = 2};
+
+    SplitEvent() {
+    }
+
+    SplitEvent(const Float position, const uint32_t object,
+               const enum Plane plane, const Type type)
+        : position(position), object(object), plane(plane), type(type) {
+    }
+
+    // Sorted by plane, position and type,
+    // objects order makes the result deterministic
+    bool operator<(const SplitEvent &other) const {
+        if (plane != other.plane) {
+            return plane < other.plane;
+        }
+        if (position != other.position) {
+            return position < other.position;
+        }
+        if (type != other.type) {
+            return type < other.type;
+        }
+        return object < other.object;
+    }
+
+    Float position;
+    uint32_t object;
+    uint8_t plane;
+    uint8_t type;
+};
+
+Float KDTree::split_cost(const Voxel &v, const enum Plane p, const Float position,
+                         const size_t left_count, const size_t right_count) {
+    // Halves of surface areas: the faces parallel to the split plane
+    // are the same for the voxel and both parts, the rest is proportional
+    // to the length along the plane normal
+    const Float dx = v.x_max - v.x_min;
+    const Float dy = v.y_max - v.y_min;
+    const Float dz = v.z_max - v.z_min;
+
+    Float parallel_area, side_perimeter;
+    switch (p) {
+    case XY:
+        parallel_area = dx * dy;
+        side_perimeter = dx + dy;
+        break;
+    case XZ:
+        parallel_area = dx * dz;
+        side_perimeter = dx + dz;
+        break;
+    case YZ:
+    default:
+        parallel_area = dy * dz;
+        side_perimeter = dy + dz;
+        break;
+    }
+
+    const Float area = dx * dy + dx * dz + dy * dz;
+    const Float left_area = parallel_area + (position - v.get_min(p)) * side_perimeter;
+    const Float right_area = parallel_area + (v.get_max(p) - position) * side_perimeter;
+
+    Float cost = TRAVERSAL_COST
+            + INTERSECTION_COST * (left_area / area * left_count
+                                 + right_area / area * right_count);
+    if (!left_count || !right_count) {
+        cost *= 1. - EMPTY_BONUS;
+    }
+    return cost;
+}
+
+int KDTree::max_depth_for(const size_t objects_count) {
+    if (objects_count <= 1) {
+        return 0;
+    }
+    return std::min(MAX_TREE_DEPTH, (int)(8 + 1.3 * log2(objects_count)));
+}
+
+class KDTree::SweepBuilder {
+public:
+    SweepBuilder(const std::vector<Voxel> &boxes, const ThreadPool &pool)
+        : boxes(boxes), pool(pool), serial(1),
+          max_depth(max_depth_for(boxes.size())) {
+    }
+
+    KDNode *build(const Voxel &v) {
+        // Events of each plane are generated and sorted independently,
+        // all events are sorted by plane first
+        std::vector<SplitEvent> plane_events[3];
+        const enum Plane planes[] = {XY, XZ, YZ};
+        pool.parallel_for(3, [&](size_t k) {
+            plane_events[k].reserve(2 * boxes.size());
+            for (size_t i = 0; i < boxes.size(); ++i) {
+                add_plane_events(i, boxes[i].clip(v), planes[k], plane_events[k]);
+            }
+            std::sort(plane_events[k].begin(), plane_events[k].end());
+        });
+
+        std::vector<SplitEvent> events;
+        events.reserve(plane_events[0].size() + plane_events[1].size()
+                       + plane_events[2].size());
+        for (int k = 0; k < 3; ++k) {
+            events.insert(events.end(), plane_events[k].begin(), plane_events[k].end());
+            std::vector<SplitEvent>().swap(plane_events[k]);
+        }
+
+        // The top of the tree is built by this thread, splitting voxels
+        // in parallel, subtrees below spawn_depth are built by the pool
+        std::vector<Subtree> subtrees;
+        std::vector<uint8_t> sides(boxes.size());
+        Context top = {pool, sides, &subtrees,
+                       (int) spawn_depth_for(pool.get_threads_count())};
+
+        KDNode *root = NULL;
+        rec_build(root, events, v, 0, top);
+
+        pool.parallel_for(subtrees.size(), [&](size_t i) {
+            Subtree &s = subtrees[i];
+            std::vector<uint8_t> subtree_sides(boxes.size());
+            Context context = {serial, subtree_sides, NULL, 0};
+            rec_build(*s.node, s.events, s.v, s.depth, context);
+        });
+
+        return root;
+    }
+
+private:
+    enum Side {LEFT, RIGHT, BOTH};
+
+    class Split {
+    public:
+        Float cost;
+        enum Plane plane;
+        Float position;
+        bool planar_left;
+    };
+
+    class Subtree {
+    public:
+        std::vector<SplitEvent> events;
+        Voxel v;
+        int depth;
+        KDNode **node;
+    };
+
+    class Context {
+    public:
+        const ThreadPool &pool;
+        std::vector<uint8_t> &sides; // scratch, indexed by objects
+        std::vector<Subtree> *subtrees; // NULL if nothing is spawned
+        int spawn_depth;
+    };
+
+    const std::vector<Voxel> &boxes;
+    const ThreadPool &pool;
+    const ThreadPool serial;
+    const int max_depth;
+
+    static void add_plane_events(const uint32_t object, const Voxel &box,
+                                 const enum Plane p, std::vector<SplitEvent> &events) {
+        const Float min = box.get_min(p);
+        const Float max = box.get_max(p);
+        if (min == max) {
+            events.push_back(SplitEvent(min, object, p, SplitEvent::PLANAR));
+        } else {
+            events.push_back(SplitEvent(min, object, p, SplitEvent::START));
+            events.push_back(SplitEvent(max, object, p, SplitEvent::END));
+        }
+    }
+
+    static void add_events(const uint32_t object, const Voxel &box,
+                           std::vector<SplitEvent> &events) {
+        add_plane_events(object, box, XY, events);
+        add_plane_events(object, box, XZ, events);
+        add_plane_events(object, box, YZ, events);
+    }
+
+    // Every object has exactly one START or PLANAR event on each plane
+    static bool is_object_event(const SplitEvent &e) {
+        return (e.plane == YZ) && (e.type != SplitEvent::END);
+    }
+
+    KDNode *make_leaf(const std::vector<SplitEvent> &events) const {
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (is_object_event(events[i])) {
+                ids.push_back(events[i].object);
+            }
+        }
+        std::sort(ids.begin(), ids.end());
+        return new KDNode(ids);
+    }
+
+    // Sweeps events [begin, end) of one plane from min to max,
+    // every position is a split candidate
+    static void sweep(const std::vector<SplitEvent> &events,
+                      const size_t begin, const size_t end,
+                      const Voxel &v, const size_t objects_count, Split &best) {
+        if (begin == end) {
+            return;
+        }
+        const enum Plane p = (enum Plane) events[begin].plane;
+        const Float v_min = v.get_min(p);
+        const Float v_max = v.get_max(p);
+
+        size_t left_count = 0;
+        size_t right_count = objects_count;
+
+        size_t i = begin;
+        while (i < end) {
+            const Float position = events[i].position;
+            size_t ends = 0, planars = 0, starts = 0;
+
+            while ((i < end) && (events[i].position == position)
+                   && (events[i].type == SplitEvent::END)) {
+                ++ends;
+                ++i;
+            }
+            while ((i < end) && (events[i].position == position)
+                   && (events[i].type == SplitEvent::PLANAR)) {
+                ++planars;
+                ++i;
+            }
+            while ((i < end) && (events[i].position == position)
+                   && (events[i].type == SplitEvent::START)) {
+                ++starts;
+                ++i;
+            }
+
+            right_count -= planars + ends;
+
+            // Splits on the voxel border don't cut anything
+            if ((v_min < position) && (position < v_max)) {
+                const Float cost_l = split_cost(v, p, position,
+                                                left_count + planars, right_count);
+                const Float cost_r = split_cost(v, p, position,
+                                                left_count, right_count + planars);
+                if (cost_l < best.cost) {
+                    best = {cost_l, p, position, true};
+                }
+                if (cost_r < best.cost) {
+                    best = {cost_r, p, position, false};
+                }
+            }
+
+            left_count += starts + planars;
+        }
+    }
+
+    // Planes are swept in parallel, the first of equally good
+    // candidates is chosen, as a single sweep over all events would do
+    static Split find_split(const std::vector<SplitEvent> &events, const Voxel &v,
+                            const size_t objects_count, const ThreadPool &pool) {
+        size_t bounds[4] = {0, 0, 0, events.size()};
+        for (int k = 1; k < 3; ++k) {
+            bounds[k] = std::lower_bound(events.begin(), events.end(), k,
+                                         [](const SplitEvent &e, int plane) {
+                                             return e.plane < plane;
+                                         }) - events.begin();
+        }
+
+        const Split leaf = {INTERSECTION_COST * objects_count, NONE, 0., false};
+        Split splits[3] = {leaf, leaf, leaf};
+        pool.parallel_for(3, [&](size_t k) {
+            sweep(events, bounds[k], bounds[k + 1], v, objects_count, splits[k]);
+        });
+
+        Split best = leaf;
+        for (int k = 0; k < 3; ++k) {
+            if (splits[k].cost < best.cost) {
+                best = splits[k];
+            }
+        }
+        return best;
+    }
+
+    // Moves events to the children. Events of one side objects stay sorted,
+    // objects on both sides get new events of their clipped boxes
+    void partition(std::vector<SplitEvent> &events, const Split &split,
+                   const Voxel &vl, const Voxel &vr, const ThreadPool &pool,
+                   std::vector<uint8_t> &sides,
+                   std::vector<SplitEvent> &left_events,
+                   std::vector<SplitEvent> &right_events) const {
+        const size_t chunks = chunks_for(events.size(), pool);
+
+        // Every pass writes sides of each object at most once,
+        // so chunks of one pass never touch the same entry
+        pool.parallel_for(chunks, [&](size_t c) {
+            const size_t end = chunk_begin(events.size(), chunks, c + 1);
+            for (size_t i = chunk_begin(events.size(), chunks, c); i < end; ++i) {
+                if (is_object_event(events[i])) {
+                    sides[events[i].object] = BOTH;
+                }
+            }
+        });
+
+        pool.parallel_for(chunks, [&](size_t c) {
+            const size_t end = chunk_begin(events.size(), chunks, c + 1);
+            for (size_t i = chunk_begin(events.size(), chunks, c); i < end; ++i) {
+                const SplitEvent &e = events[i];
+                if (e.plane != split.plane) {
+                    continue;
+                }
+                if ((e.type == SplitEvent::END) && (e.position <= split.position)) {
+                    sides[e.object] = LEFT;
+                } else if ((e.type == SplitEvent::START) && (e.position >= split.position)) {
+                    sides[e.object] = RIGHT;
+                } else if (e.type == SplitEvent::PLANAR) {
+                    const bool left = (e.position < split.position)
+                            || ((e.position == split.position) && split.planar_left);
+                    sides[e.object] = left ? LEFT : RIGHT;
+                }
+            }
+        });
+
+        std::vector<std::vector<SplitEvent> > left_only(chunks), right_only(chunks);
+        std::vector<std::vector<SplitEvent> > left_new(chunks), right_new(chunks);
+        pool.parallel_for(chunks, [&](size_t c) {
+            const size_t end = chunk_begin(events.size(), chunks, c + 1);
+            for (size_t i = chunk_begin(events.size(), chunks, c); i < end; ++i) {
+                const SplitEvent &e = events[i];
+                switch (sides[e.object]) {
+                case LEFT:
+                    left_only[c].push_back(e);
+                    break;
+                case RIGHT:
+                    right_only[c].push_back(e);
+                    break;
+                default:
+                    if ((e.plane == split.plane) && (e.type == SplitEvent::START)) {
+                        add_events(e.object, boxes[e.object].clip(vl), left_new[c]);
+                        add_events(e.object, boxes[e.object].clip(vr), right_new[c]);
+                    }
+                    break;
+                }
+            }
+        });
+        std::vector<SplitEvent>().swap(events);
+
+        pool.parallel_for(2, [&](size_t side) {
+            std::vector<std::vector<SplitEvent> > &only = side ? right_only : left_only;
+            std::vector<std::vector<SplitEvent> > &created = side ? right_new : left_new;
+            std::vector<SplitEvent> &result = side ? right_events : left_events;
+
+            std::vector<SplitEvent> sorted_only = concatenate(only);
+            std::vector<SplitEvent> sorted_new = concatenate(created);
+            std::sort(sorted_new.begin(), sorted_new.end());
+
+            result.resize(sorted_only.size() + sorted_new.size());
+            std::merge(sorted_only.begin(), sorted_only.end(),
+                       sorted_new.begin(), sorted_new.end(), result.begin());
+        });
+    }
+
+    static std::vector<SplitEvent> concatenate(std::vector<std::vector<SplitEvent> > &parts) {
+        if (parts.size() == 1) {
+            return std::move(parts[0]);
+        }
+        size_t size = 0;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            size += parts[i].size();
+        }
+        std::vector<SplitEvent> result;
+        result.reserve(size);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            result.insert(result.end(), parts[i].begin(), parts[i].end());
+            std::vector<SplitEvent>().swap(parts[i]);
+        }
+        return result;
+    }
+
+    void rec_build(KDNode *&node, std::vector<SplitEvent> &events, const Voxel &v,
+                   const int depth, Context &context) const {
+        if (context.subtrees && (depth == context.spawn_depth)) {
+            Subtree subtree = {std::move(events), v, depth, &node};
+            context.subtrees->push_back(std::move(subtree));
+            node = NULL;
+            return;
+        }
+
+        size_t objects_count = 0;
+        for (size_t i = 0; i < events.size(); ++i) {
+            objects_count += is_object_event(events[i]);
+        }
+        if ((depth >= max_depth) || (objects_count == 0)) {
+            node = make_leaf(events);
+            return;
+        }
+
+        // Small voxels are not worth of threads
+        const ThreadPool &pool = (events.size() >= PARALLEL_CHUNK) ? context.pool : serial;
+
+        const Split split = find_split(events, v, objects_count, pool);
+        if (split.plane == NONE) {
+            node = make_leaf(events);
+            return;
+        }
+
+        const Point3d c = plane_coord(split.plane, split.position);
+        Voxel vl, vr;
+        v.split(split.plane, c, vl, vr);
+
+        std::vector<SplitEvent> left_events, right_events;
+        partition(events, split, vl, vr, pool, context.sides, left_events, right_events);
+
+        node = new KDNode(split.plane, c, NULL, NULL);
+        rec_build(node->l, left_events, vl, depth + 1, context);
+        rec_build(node->r, right_events, vr, depth + 1, context);
+    }
+};
+
+class KDTree::BinnedBuilder {
+public:
+    BinnedBuilder(const std::vector<Voxel> &boxes, const ThreadPool &pool)
+        : boxes(boxes), pool(pool), serial(1),
+          max_depth(max_depth_for(boxes.size())) {
+    }
+
+    KDNode *build(const Voxel &v) {
+        std::vector<uint32_t> ids(boxes.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = i;
+        }
+
+        // The top of the tree is built by this thread, splitting voxels
+        // in parallel, subtrees below spawn_depth are built by the pool
+        std::vector<Subtree> subtrees;
+        Context top = {pool, &subtrees, (int) spawn_depth_for(pool.get_threads_count())};
+
+        KDNode *root = NULL;
+        rec_build(root, ids, v, 0, top);
+
+        pool.parallel_for(subtrees.size(), [&](size_t i) {
+            Subtree &s = subtrees[i];
+            Context context = {serial, NULL, 0};
+            rec_build(*s.node, s.ids, s.v, s.depth, context);
+        });
+
+        return root;
+    }
+
+private:
+    class Subtree {
+    public:
+        std::vector<uint32_t> ids;
+        Voxel v;
+        int depth;
+        KDNode **node;
+    };
+
+    class Context {
+    public:
+        const ThreadPool &pool;
+        std::vector<Subtree> *subtrees; // NULL if nothing is spawned
+        int spawn_depth;
+    };
+
+    class Bins {
+    public:
+        size_t min[3][BINS_COUNT];
+        size_t max[3][BINS_COUNT];
+    };
+
+    const std::vector<Voxel> &boxes;
+    const ThreadPool &pool;
+    const ThreadPool serial;
+    const int max_depth;
+
+    KDNode *make_leaf(const std::vector<uint32_t> &ids) const {
+        return new KDNode(ids);
+    }
+
+    static int bin(const Float x, const Float v_min, const Float scale) {
+        const int b = (int)((x - v_min) * scale);
+        return std::max(0, std::min(BINS_COUNT - 1, b));
+    }
+
+    // Counts bins which contain min and max of each object,
+    // chunks of objects are counted in parallel and summed up
+    Bins count_bins(const std::vector<uint32_t> &ids, const Voxel &v,
+                    const ThreadPool &pool) const {
+        const enum Plane planes[] = {XY, XZ, YZ};
+        const size_t chunks = chunks_for(ids.size(), pool);
+        std::vector<Bins> chunk_bins(chunks, Bins());
+
+        pool.parallel_for(chunks, [&](size_t c) {
+            Bins &bins = chunk_bins[c];
+            const size_t end = chunk_begin(ids.size(), chunks, c + 1);
+            for (int k = 0; k < 3; ++k) {
+                const Float v_min = v.get_min(planes[k]);
+                const Float extent = v.get_max(planes[k]) - v_min;
+                if (extent <= 0.) {
+                    continue;
+                }
+                const Float scale = BINS_COUNT / extent;
+                for (size_t i = chunk_begin(ids.size(), chunks, c); i < end; ++i) {
+                    const Voxel &box = boxes[ids[i]];
+                    ++bins.min[k][bin(box.get_min(planes[k]), v_min, scale)];
+                    ++bins.max[k][bin(box.get_max(planes[k]), v_min, scale)];
+                }
+            }
+        });
+
+        Bins bins = Bins();
+        for (size_t c = 0; c < chunks; ++c) {
+            for (int k = 0; k < 3; ++k) {
+                for (int b = 0; b < BINS_COUNT; ++b) {
+                    bins.min[k][b] += chunk_bins[c].min[k][b];
+                    bins.max[k][b] += chunk_bins[c].max[k][b];
+                }
+            }
+        }
+        return bins;
+    }
+
+    void rec_build(KDNode *&node, std::vector<uint32_t> &ids, const Voxel &v,
+                   const int depth, Context &context) const {
+        if (context.subtrees && (depth == context.spawn_depth)) {
+            Subtree subtree = {std::move(ids), v, depth, &node};
+            context.subtrees->push_back(std::move(subtree));
+            node = NULL;
+            return;
+        }
+
+        const size_t objects_count = ids.size();
+        if ((depth >= max_depth) || (objects_count == 0)) {
+            node = make_leaf(ids);
+            return;
+        }
+
+        const Bins bins = count_bins(ids, v, context.pool);
+
+        Float best_cost = INTERSECTION_COST * objects_count;
+        enum Plane best_plane = NONE;
+        Float best_position = 0.;
+
+        const enum Plane planes[] = {XY, XZ, YZ};
+        for (int k = 0; k < 3; ++k) {
+            const enum Plane p = planes[k];
+            const Float v_min = v.get_min(p);
+            const Float extent = v.get_max(p) - v_min;
+            if (extent <= 0.) {
+                continue;
+            }
+
+            // Plane b lies between bins b - 1 and b,
+            // split positions are stored as float in the tree
+            size_t left_count = 0;
+            size_t right_count = objects_count;
+            for (int b = 1; b < BINS_COUNT; ++b) {
+                left_count += bins.min[k][b - 1];
+                right_count -= bins.max[k][b - 1];
+
+                const Float position = (float) (v_min + extent * b / BINS_COUNT);
+                if ((position <= v_min) || (position >= v_min + extent)) {
+                    continue;
+                }
+                const Float cost = split_cost(v, p, position, left_count, right_count);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_plane = p;
+                    best_position = position;
+                }
+            }
+        }
+
+        if (best_plane == NONE) {
+            node = make_leaf(ids);
+            return;
+        }
+
+        const size_t chunks = chunks_for(objects_count, context.pool);
+        std::vector<std::vector<uint32_t> > left_parts(chunks), right_parts(chunks);
+        context.pool.parallel_for(chunks, [&](size_t c) {
+            const size_t end = chunk_begin(objects_count, chunks, c + 1);
+            for (size_t i = chunk_begin(objects_count, chunks, c); i < end; ++i) {
+                const Voxel &box = boxes[ids[i]];
+                const Float min = box.get_min(best_plane);
+                const Float max = box.get_max(best_plane);
+                // objects lying in the split plane go to the left
+                if ((min < best_position) || (max <= best_position)) {
+                    left_parts[c].push_back(ids[i]);
+                }
+                if (max > best_position) {
+                    right_parts[c].push_back(ids[i]);
+                }
+            }
+        });
+        std::vector<uint32_t>().swap(ids);
+
+        std::vector<uint32_t> left_ids, right_ids;
+        for (size_t c = 0; c < chunks; ++c) {
+            left_ids.insert(left_ids.end(), left_parts[c].begin(), left_parts[c].end());
+            right_ids.insert(right_ids.end(), right_parts[c].begin(), right_parts[c].end());
+        }
+
+        const Point3d c = plane_coord(best_plane, best_position);
+        Voxel vl, vr;
+        v.split(best_plane, c, vl, vr);
+
+        node = new KDNode(best_plane, c, NULL, NULL);
+        rec_build(node->l, left_ids, vl, depth + 1, context);
+        rec_build(node->r, right_ids, vr, depth + 1, context);
+    }
+};
+
+KDTree::KDTree(std::vector<Object3d*> &objects, const Voxel &bounding_box)
+    : Accelerator(objects), bounding_box(bounding_box) {
+}
+
+KDTree::KDTree(std::vector<Object3d*> &objects, const ThreadPool &pool,
+               BuildMethod method) : Accelerator(objects) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    bounding_box = Voxel(objects);
+
+    const std::vector<BuildItem> items = get_build_items();
+
+    // Boxes are rounded outwards to float, so every split position
+    // found by sweeping is exactly stored in the float of FlatNode
+    std::vector<Voxel> boxes(items.size());
+    pool.parallel_for(chunks_for(items.size(), pool), [&](size_t c) {
+        const size_t chunks = chunks_for(items.size(), pool);
+        const size_t end = chunk_begin(items.size(), chunks, c + 1);
+        for (size_t i = chunk_begin(items.size(), chunks, c); i < end; ++i) {
+            Point3d min_p, max_p;
+            get_item_bounds(items[i], min_p, max_p);
+            boxes[i] = Voxel(min_p.x, min_p.y, min_p.z,
+                             max_p.x, max_p.y, max_p.z).round_out_to_float();
+        }
+    });
+
+    KDNode *root;
+    if (method == SAH_BINNED) {
+        root = BinnedBuilder(boxes, pool).build(bounding_box);
+    } else {
+        root = SweepBuilder(boxes, pool).build(bounding_box);
+    }
+
+    std::vector<uint32_t> item_refs(items.size(), NO_REF);
+    std::vector<uint32_t> mesh_indexes = get_empty_mesh_indexes();
+    flatten(root, items, item_refs, mesh_indexes);
+    delete root;
+
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    build_time = time.count();
+    build_threads_count = pool.get_threads_count();
+}
+
+// item_refs[i] is the tag of items[i] primitive, or NO_REF
+// if it is not added yet
+uint32_t KDTree::flatten(const KDNode * const node, const std::vector<BuildItem> &items,
+                         std::vector<uint32_t> &item_refs,
+                         std::vector<uint32_t> &mesh_indexes) {
+    const uint32_t index = nodes.size();
+
+    if (node->plane == NONE) {
+        nodes.push_back(FlatNode::leaf(primitive_refs.size(), node->objects.size()));
+        for (size_t i = 0; i < node->objects.size(); ++i) {
+            uint32_t &ref = item_refs[node->objects[i]];
+            if (ref == NO_REF) {
+                ref = add_primitive(items[node->objects[i]], mesh_indexes);
+            }
+            primitive_refs.push_back(ref);
+        }
+        return index;
+    }
+
+    Float split;
+    switch (node->plane) {
+    case XY:
+        split = node->coord.z;
+        break;
+    case XZ:
+        split = node->coord.y;
+        break;
+    default:
+        split = node->coord.x;
+        break;
+    }
+
+    nodes.push_back(FlatNode());
+    flatten(node->l, items, item_refs, mesh_indexes);
+    const uint32_t right = flatten(node->r, items, item_refs, mesh_indexes);
+    nodes[index] = FlatNode::inner(node->plane, split, right);
+    return index;
+}
+
+KDTree::Statistics KDTree::get_statistics() const {
+    Statistics stats = {0, 0, 0, 0, 0, 0., 0, build_time, build_threads_count};
+    collect_statistics(0, bounding_box, 0, stats);
+    stats.memory = nodes.size() * sizeof(FlatNode)
+            + get_primitives_memory();
+    return stats;
+}
+
+void KDTree::collect_statistics(const uint32_t node, const Voxel &v, const int depth,
+                                Statistics &stats) const {
+    const Float probability = v.surface_area() / bounding_box.surface_area();
+    const FlatNode &n = nodes[node];
+
+    ++stats.nodes;
+    stats.depth = std::max(stats.depth, depth);
+
+    if (n.is_leaf()) {
+        ++stats.leaves;
+        if (!n.objects_count()) {
+            ++stats.empty_leaves;
+        }
+        stats.references += n.objects_count();
+        stats.sah_cost += probability * INTERSECTION_COST * n.objects_count();
+        return;
+    }
+
+    stats.sah_cost += probability * TRAVERSAL_COST;
+
+    Voxel vl, vr;
+    v.split(n.plane(), plane_coord(n.plane(), n.split()), vl, vr);
+    collect_statistics(node + 1, vl, depth + 1, stats);
+    collect_statistics(n.right(), vr, depth + 1, stats);
+}
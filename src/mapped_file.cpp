@@ -0,0 +1,59 @@
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+#include <include/mapped_file.h>
+
+MappedFile::MappedFile(const std::string &filename, const Access access)
+        : data_(NULL), size_(0), mapped(false) {
+#ifdef HAVE_MMAP
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("[MappedFile] Can't open " + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("[MappedFile] Can't read " + filename);
+    }
+    size_ = st.st_size;
+    if (size_) {
+        void * const address = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            if (access == SEQUENTIAL_ACCESS) {
+                madvise(address, size_, MADV_SEQUENTIAL);
+            }
+            data_ = static_cast<const char *>(address);
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped || !size_) {
+        return;
+    }
+#endif
+
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("[MappedFile] Can't open " + filename);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = buffer.data();
+    size_ = buffer.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef HAVE_MMAP
+    if (mapped) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+#endif
+}
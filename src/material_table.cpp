@@ -0,0 +1,26 @@
+#include <stdexcept>
+
+#include <include/material_table.h>
+
+const size_t MaterialTable::MAX_MATERIALS_COUNT;
+
+MaterialId MaterialTable::add(const Color &color, const Material &material) {
+    // Scenes have a few materials and they are added only while loading
+    for (size_t i = 0; i < materials.size(); ++i) {
+        if ((materials[i] == material) && (colors[i].r() == color.r())
+                && (colors[i].g() == color.g()) && (colors[i].b() == color.b())) {
+            return i;
+        }
+    }
+
+    if (materials.size() == MAX_MATERIALS_COUNT) {
+        throw std::runtime_error("[MaterialTable::add] Too many materials");
+    }
+    materials.push_back(material);
+    colors.push_back(color);
+    return materials.size() - 1;
+}
+
+size_t MaterialTable::size() const {
+    return materials.size();
+}
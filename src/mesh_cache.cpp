@@ -0,0 +1,112 @@
+#include <cstring>
+
+#include <include/mesh_cache.h>
+
+const uint32_t MeshCache::VERSION;
+const char MeshCache::MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+std::vector<uint64_t> MeshCache::get_element_sizes() {
+    std::vector<uint64_t> element_sizes(ARRAYS_COUNT, sizeof(Float));
+    for (int i = VERTEX_INDEXES; i <= TEXTURE_INDEXES; ++i) {
+        element_sizes[i] = sizeof(uint32_t);
+    }
+    element_sizes[BOUNDS] = sizeof(double);
+    return element_sizes;
+}
+
+bool MeshCache::write(const std::string &filename, const uint64_t key,
+                      const TriangleMesh &mesh) {
+    const double bounds[] = {
+        mesh.min_point.x, mesh.min_point.y, mesh.min_point.z,
+        mesh.max_point.x, mesh.max_point.y, mesh.max_point.z
+    };
+    const std::vector<uint64_t> element_sizes = get_element_sizes();
+    const CacheFile::Array arrays[ARRAYS_COUNT] = {
+        {mesh.xs.data(), mesh.xs.size(), element_sizes[XS]},
+        {mesh.ys.data(), mesh.ys.size(), element_sizes[YS]},
+        {mesh.zs.data(), mesh.zs.size(), element_sizes[ZS]},
+        {mesh.nxs.data(), mesh.nxs.size(), element_sizes[NXS]},
+        {mesh.nys.data(), mesh.nys.size(), element_sizes[NYS]},
+        {mesh.nzs.data(), mesh.nzs.size(), element_sizes[NZS]},
+        {mesh.tus.data(), mesh.tus.size(), element_sizes[TUS]},
+        {mesh.tvs.data(), mesh.tvs.size(), element_sizes[TVS]},
+        {mesh.vertex_indexes.data(), mesh.vertex_indexes.size(), element_sizes[VERTEX_INDEXES]},
+        {mesh.normal_indexes.data(), mesh.normal_indexes.size(), element_sizes[NORMAL_INDEXES]},
+        {mesh.texture_indexes.data(), mesh.texture_indexes.size(),
+         element_sizes[TEXTURE_INDEXES]},
+        {bounds, 6, element_sizes[BOUNDS]}
+    };
+    return CacheFile::write(filename, MAGIC, VERSION, key,
+                            std::vector<CacheFile::Array>(arrays, arrays + ARRAYS_COUNT));
+}
+
+std::unique_ptr<const MappedFile> MeshCache::open(const std::string &filename,
+                                                  const uint64_t key) {
+    std::unique_ptr<const MappedFile> file = CacheFile::open(filename, MAGIC, VERSION, key,
+                                                             get_element_sizes());
+    if (!file) {
+        return NULL;
+    }
+
+    // arrays of coordinates are equal, faces have 3 indexes of every kind
+    const std::vector<CacheFile::Array> arrays = CacheFile::get_arrays(*file);
+    if ((arrays[YS].size != arrays[XS].size) || (arrays[ZS].size != arrays[XS].size)
+            || (arrays[NYS].size != arrays[NXS].size) || (arrays[NZS].size != arrays[NXS].size)
+            || (arrays[TVS].size != arrays[TUS].size) || (arrays[VERTEX_INDEXES].size % 3)
+            || (arrays[NORMAL_INDEXES].size
+                && (arrays[NORMAL_INDEXES].size != arrays[VERTEX_INDEXES].size))
+            || (arrays[TEXTURE_INDEXES].size
+                && (arrays[TEXTURE_INDEXES].size != arrays[VERTEX_INDEXES].size))
+            || (arrays[BOUNDS].size != 6)) {
+        return NULL;
+    }
+
+    // indexes are checked as TriangleMesh::add_face() does
+    if (!check_indexes(arrays[VERTEX_INDEXES], arrays[XS].size, false)
+            || !check_indexes(arrays[NORMAL_INDEXES], arrays[NXS].size, true)
+            || !check_indexes(arrays[TEXTURE_INDEXES], arrays[TUS].size, true)) {
+        return NULL;
+    }
+    return file;
+}
+
+bool MeshCache::check_indexes(const CacheFile::Array &array, const uint64_t limit,
+                              const bool optional) {
+    const uint32_t * const indexes = static_cast<const uint32_t *>(array.data);
+    for (uint64_t i = 0; i < array.size; i += 3) {
+        // normals and texture points of a face are all given or all NO_INDEX
+        if (optional && (indexes[i] == TriangleMesh::NO_INDEX)
+                && (indexes[i + 1] == TriangleMesh::NO_INDEX)
+                && (indexes[i + 2] == TriangleMesh::NO_INDEX)) {
+            continue;
+        }
+        if ((indexes[i] >= limit) || (indexes[i + 1] >= limit) || (indexes[i + 2] >= limit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshCache::read(std::unique_ptr<const MappedFile> file, TriangleMesh &mesh) {
+    const std::vector<CacheFile::Array> arrays = CacheFile::get_arrays(*file);
+
+    MeshArray<Float> * const coordinates[] = {
+        &mesh.xs, &mesh.ys, &mesh.zs, &mesh.nxs, &mesh.nys, &mesh.nzs, &mesh.tus, &mesh.tvs
+    };
+    MeshArray<uint32_t> * const indexes[] = {
+        &mesh.vertex_indexes, &mesh.normal_indexes, &mesh.texture_indexes
+    };
+    for (int i = 0; i < VERTEX_INDEXES; ++i) {
+        coordinates[i]->set_view(static_cast<const Float *>(arrays[i].data), arrays[i].size);
+    }
+    for (int i = VERTEX_INDEXES; i <= TEXTURE_INDEXES; ++i) {
+        indexes[i - VERTEX_INDEXES]->set_view(static_cast<const uint32_t *>(arrays[i].data),
+                                              arrays[i].size);
+    }
+
+    double bounds[6];
+    memcpy(bounds, arrays[BOUNDS].data, sizeof(bounds));
+    mesh.min_point = Point3d(bounds[0], bounds[1], bounds[2]);
+    mesh.max_point = Point3d(bounds[3], bounds[4], bounds[5]);
+    mesh.cache_file = std::move(file);
+}
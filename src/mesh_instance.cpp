@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include <include/mesh_instance.h>
+
+MeshInstance::MeshInstance(const TriangleMesh * const mesh, const Transform &transform,
+                           const MaterialId material_id)
+        : Object3d(material_id), mesh(mesh), mesh_tree(NULL), to_world(transform),
+          to_object(transform.inverse()) {
+    update_bounds();
+}
+
+const TriangleMesh *MeshInstance::get_mesh() const {
+    return mesh;
+}
+
+void MeshInstance::set_mesh_tree(const Accelerator * const tree) {
+    mesh_tree = tree;
+}
+
+void MeshInstance::set_transform(const Transform &transform) {
+    to_object = transform.inverse();
+    to_world = transform;
+    update_bounds();
+}
+
+void MeshInstance::update_bounds() {
+    min_point = Point3d(FLOAT_MAX, FLOAT_MAX, FLOAT_MAX);
+    max_point = Point3d(-FLOAT_MAX, -FLOAT_MAX, -FLOAT_MAX);
+    const Point3d mesh_min = mesh->get_min_boundary_point();
+    const Point3d mesh_max = mesh->get_max_boundary_point();
+    for (int corner = 0; corner < 8; ++corner) {
+        const Point3d p = to_world.apply_point(
+                Point3d((corner & 1) ? mesh_max.x : mesh_min.x,
+                        (corner & 2) ? mesh_max.y : mesh_min.y,
+                        (corner & 4) ? mesh_max.z : mesh_min.z));
+        min_point = Point3d(std::min(min_point.x, p.x), std::min(min_point.y, p.y),
+                            std::min(min_point.z, p.z));
+        max_point = Point3d(std::max(max_point.x, p.x), std::max(max_point.y, p.y),
+                            std::max(max_point.z, p.z));
+    }
+}
+
+bool MeshInstance::intersect(const Point3d &vector_start, const Vector3d &vector,
+                             HitRecord &hit) const {
+    HitRecord object_hit;
+    if (!mesh_tree->find_intersection_tree(to_object.apply_point(vector_start),
+                                           to_object.apply_vector(vector), object_hit)) {
+        return false;
+    }
+
+    hit = object_hit;
+    hit.object = const_cast<MeshInstance *>(this);
+    hit.point = vector_start + vector.mul(object_hit.t);
+    hit.normal = to_object.apply_transposed(object_hit.normal);
+    return true;
+}
+
+bool MeshInstance::is_occluded(const Point3d &vector_start, const Vector3d &vector,
+                              const Float max_t) const {
+    // t is the same in object coordinates, so is max_t
+    return mesh_tree->is_occluded(to_object.apply_point(vector_start),
+                                  to_object.apply_vector(vector), max_t);
+}
+
+Color MeshInstance::get_color(const HitRecord &hit, const MaterialTable &materials) const {
+    if (mesh->has_face_texture(hit.primitive)) {
+        return mesh->get_color(hit, materials);
+    }
+    return materials.get_color(material_id);
+}
+
+Vector3d MeshInstance::get_normal_vector(const HitRecord &hit) const {
+    if (!mesh->has_face_normals(hit.primitive)) {
+        return hit.normal;
+    }
+    return to_object.apply_transposed(mesh->get_normal_vector(hit));
+}
+
+Point3d MeshInstance::get_min_boundary_point() const {
+    return min_point;
+}
+
+Point3d MeshInstance::get_max_boundary_point() const {
+    return max_point;
+}
+
+bool MeshInstance::secondary_light(const Point3d &point, const LightSource3d &ls,
+                                   const MaterialTable &materials,
+                                   LightSource3d &ls_secondary) const {
+    (void) point;
+    (void) ls;
+    (void) materials;
+    (void) ls_secondary;
+    return false;
+}
+
+bool MeshInstance::has_secondary_light() const {
+    return false;
+}
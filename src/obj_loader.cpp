@@ -1,226 +1,310 @@
-#include <cstdio>
-#include <cstdlib>
+#include <algorithm>
+#include <charconv>
 #include <cstring>
+#include <stdexcept>
 
-#include <string>
-#include <fstream>
-#include <iostream>
-
-#include <include/camera.h>
-#include <include/color.h>
-#include <include/utils.h>
+#include <include/mesh_cache.h>
 #include <include/obj_loader.h>
-#include <include/triangle.h>
 
+const char * const SceneFaceHandler::MESH_CACHE_SUFFIX = ".mesh";
+
+const size_t SceneFaceHandler::MIN_CHUNK_SIZE;
+const size_t SceneFaceHandler::CHUNKS_PER_THREAD;
+const int SceneFaceHandler::Triangle::VERTEXES;
+const int SceneFaceHandler::Triangle::TEXTURE_POINTS;
+const int SceneFaceHandler::Triangle::NORMALS;
+
+static bool is_space(const char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+static const char *skip_spaces(const char *str, const char *end) {
+    while ((str < end) && is_space(*str)) {
+        ++str;
+    }
+    return str;
+}
+
+// Start of the next line
+static const char *skip_line(const char *str, const char *end) {
+    const char * const line_end = static_cast<const char *>(memchr(str, '\n', end - str));
+    return line_end ? line_end + 1 : end;
+}
+
+// The keyword is the first word of the line
+static bool is_keyword(const char *str, const char *end, const char *keyword) {
+    const size_t length = strlen(keyword);
+    return ((size_t)(end - str) > length) && !memcmp(str, keyword, length)
+            && is_space(str[length]);
+}
+
+static bool is_line_end(const char *str, const char *end) {
+    return (str == end) || (*str == '\n') || (*str == '#');
+}
+
+static const char *parse_float(const char *str, const char *end, Float &value) {
+    str = skip_spaces(str, end);
+    // from_chars doesn't accept the plus sign
+    if ((str < end) && (*str == '+')) {
+        ++str;
+    }
+    const std::from_chars_result result = std::from_chars(str, end, value);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error("[SceneFaceHandler::load_obj] Bad number");
+    }
+    return result.ptr;
+}
 
-// TODO: use LinkedList instead of arrays
+// Index in the face, count is the number of elements read before it.
+// Negative indexes are counted back from count, modulo 2^32.
+static const char *parse_index(const char *str, const char *end, const size_t count,
+                               uint32_t &index, bool &relative) {
+    int64_t value = 0;
+    const std::from_chars_result result = std::from_chars(str, end, value);
+    if ((result.ec != std::errc()) || (value == 0)
+            || (value > (int64_t)UINT32_MAX) || (value < -(int64_t)UINT32_MAX)) {
+        throw std::runtime_error("[SceneFaceHandler::load_obj] Bad index");
+    }
+    relative = (value < 0);
+    index = relative ? (uint32_t)(count + value) : (uint32_t)(value - 1);
+    return result.ptr;
+}
 
 void SceneFaceHandler::load_obj(std::string filename) {
-    std::ifstream in(filename);
-    std::string line;
-    
-    while (in >> line) {
-        //std::cout << "readed = " << line; TODO REMOVE
-        if ((line != "v") && (line != "vn") && (line != "f")) {
-            continue;
+    TriangleMesh * const mesh = load_mesh(filename);
+    if (mesh) {
+        scene->add_object(mesh);
+    }
+}
+
+TriangleMesh *SceneFaceHandler::load_mesh(std::string filename) {
+    const MappedFile file(filename, MappedFile::SEQUENTIAL_ACCESS);
+    const std::string cache_filename = filename + MESH_CACHE_SUFFIX;
+    const uint64_t cache_key = mesh_cache ? get_cache_key(file) : 0;
+    if (mesh_cache) {
+        std::unique_ptr<const MappedFile> cache = MeshCache::open(cache_filename, cache_key);
+        if (cache) {
+            TriangleMesh * const mesh = scene->add_asset().create<TriangleMesh>(
+                    scene->add_material(default_color, default_material), texture);
+            MeshCache::read(std::move(cache), *mesh);
+            return mesh;
+        }
+    }
+
+    const char * const data = file.data();
+    const char * const data_end = data + file.size();
+
+    // chunks end at line ends
+    const ThreadPool &thread_pool = scene->get_thread_pool();
+    const size_t chunks_count = std::max<size_t>(1, std::min(
+            file.size() / MIN_CHUNK_SIZE,
+            thread_pool.get_threads_count() * CHUNKS_PER_THREAD));
+    std::vector<Chunk> chunks(chunks_count);
+    const char *begin = data;
+    for (size_t i = 0; i < chunks_count; ++i) {
+        chunks[i].begin = begin;
+        chunks[i].end = (i + 1 == chunks_count)
+                ? data_end
+                : skip_line(std::max(begin, data + file.size() / chunks_count * (i + 1)),
+                            data_end);
+        begin = chunks[i].end;
+    }
+
+    thread_pool.parallel_for(chunks_count, [&](size_t chunk) {
+        parse_chunk(chunks[chunk]);
+    });
+
+    size_t vertexes_count = 0;
+    size_t texture_points_count = 0;
+    size_t normals_count = 0;
+    size_t triangles_count = 0;
+    for (size_t i = 0; i < chunks_count; ++i) {
+        vertexes_count += chunks[i].vertexes.size();
+        texture_points_count += chunks[i].texture_points.size();
+        normals_count += chunks[i].normals.size();
+        triangles_count += chunks[i].triangles.size();
+    }
+    if (!triangles_count) {
+        return NULL;
+    }
+
+    // every model is a separate asset of the scene
+    // models loaded with equal color and material share the entry
+    TriangleMesh * const mesh = scene->add_asset().create<TriangleMesh>(
+            scene->add_material(default_color, default_material), texture);
+    mesh->reserve(vertexes_count, normals_count, texture_points_count, triangles_count);
+
+    // Faces may refer to elements of the next chunks,
+    // so all elements are added first
+    for (size_t i = 0; i < chunks_count; ++i) {
+        for (size_t j = 0; j < chunks[i].vertexes.size(); ++j) {
+            mesh->add_vertex(chunks[i].vertexes[j]);
         }
-        
-        if (line == "v") {
-            parse_vertex(in);
+        for (size_t j = 0; j < chunks[i].texture_points.size(); ++j) {
+            mesh->add_texture_point(chunks[i].texture_points[j]);
         }
-        
-        if (line == "vn") {
-            parse_norm_vector(in);
+        for (size_t j = 0; j < chunks[i].normals.size(); ++j) {
+            mesh->add_normal(chunks[i].normals[j]);
         }
-        
-        if (line == "f") {
-            std::getline(in, line);
-            parse_face(line);
+    }
+
+    // elements in the chunks before the current one
+    uint32_t offsets[3] = {0, 0, 0};
+    for (size_t i = 0; i < chunks_count; ++i) {
+        const Chunk &chunk = chunks[i];
+        for (size_t j = 0; j < chunk.triangles.size(); ++j) {
+            const Triangle &triangle = chunk.triangles[j];
+            uint32_t indexes[9];
+            for (int k = 0; k < 9; ++k) {
+                indexes[k] = triangle.indexes[k]
+                        + (((triangle.relative >> k) & 1) ? offsets[k / 3] : 0);
+            }
+
+            const uint32_t * const v = indexes + Triangle::VERTEXES;
+            const uint32_t * const t = indexes + Triangle::TEXTURE_POINTS;
+            const uint32_t * const n = indexes + Triangle::NORMALS;
+            mesh->add_face(v[0], v[1], v[2], n[0], n[1], n[2], t[0], t[1], t[2]);
         }
+
+        offsets[0] += chunk.vertexes.size();
+        offsets[1] += chunk.texture_points.size();
+        offsets[2] += chunk.normals.size();
     }
 
+    // the model is loaded anyway if the cache can't be written
+    if (mesh_cache) {
+        MeshCache::write(cache_filename, cache_key, *mesh);
+    }
+    return mesh;
 }
 
-void SceneFaceHandler::parse_vertex(std::ifstream &in) {
-    Point3d v;
-    in >> v.y >> v.z >> v.x;
-    //std::cout << "V" << v.x << v.y << v.z; TODO REMOVE
-    vertexes.push_back(v);
+void SceneFaceHandler::set_mesh_cache(const bool enabled) {
+    mesh_cache = enabled;
 }
 
-void SceneFaceHandler::parse_norm_vector(std::ifstream &in) {
-    Vector3d v;
-    in >> v.y >> v.z >> v.x;
-    //std::cout << "VN" << v.x << v.y << v.z; TODO REMOVE
-    norm_vectors.push_back(v);
-}
-
-void SceneFaceHandler::parse_face(std::string &str) {
-    Queue<std::string> tokens;
-    Queue<Point3d> q_vertexes;
-    Queue<Vector3d> q_norm_vectors;
-
-    std::string token = "";
-    std::string sep = " \n";
-    for (size_t i = 0; i < str.size(); ++i) {
-        if (sep.find(str[i]) != sep.npos) {
-            if (token != "") {
-                tokens.push(token);
-                token = "";
-            }
-        } else {
-            token += str[i];
+uint64_t SceneFaceHandler::get_cache_key(const MappedFile &file) const {
+    const Float transform[] = {
+        scale, dx, dy, dz, sin_al_x, cos_al_x, sin_al_y, cos_al_y, sin_al_z, cos_al_z
+    };
+    return hash_bytes(file.data(), file.size(), hash_bytes(transform, sizeof(transform)));
+}
+
+void SceneFaceHandler::parse_chunk(Chunk &chunk) const {
+    const char *str = chunk.begin;
+    const char * const end = chunk.end;
+    while (str < end) {
+        str = skip_spaces(str, end);
+        if (is_keyword(str, end, "v")) {
+            str = parse_vertex(str + 1, end, chunk);
+        } else if (is_keyword(str, end, "vt")) {
+            str = parse_texture_point(str + 2, end, chunk);
+        } else if (is_keyword(str, end, "vn")) {
+            str = parse_norm_vector(str + 2, end, chunk);
+        } else if (is_keyword(str, end, "f")) {
+            str = parse_face(str + 1, end, chunk);
         }
+        // other lines and the rest of the line are skipped
+        str = skip_line(str, end);
     }
-    if (token != "") {
-        tokens.push(token);
+}
+
+const char *SceneFaceHandler::parse_vertex(const char *str, const char *end,
+                                           Chunk &chunk) const {
+    Point3d v;
+    str = parse_float(str, end, v.y);
+    str = parse_float(str, end, v.z);
+    str = parse_float(str, end, v.x);
+    const Point3d p = v.rotate_x(sin_al_x, cos_al_x)
+                       .rotate_y(sin_al_y, cos_al_y)
+                       .rotate_z(sin_al_z, cos_al_z);
+    chunk.vertexes.push_back(Point3d(p.x * scale + dx, p.y * scale + dy, p.z * scale + dz));
+    return str;
+}
+
+const char *SceneFaceHandler::parse_texture_point(const char *str, const char *end,
+                                                  Chunk &chunk) const {
+    // v is optional
+    Point2d t;
+    str = parse_float(str, end, t.x);
+    if (!is_line_end(skip_spaces(str, end), end)) {
+        str = parse_float(str, end, t.y);
     }
+    chunk.texture_points.push_back(t);
+    return str;
+}
+
+const char *SceneFaceHandler::parse_norm_vector(const char *str, const char *end,
+                                                Chunk &chunk) const {
+    Vector3d v;
+    str = parse_float(str, end, v.y);
+    str = parse_float(str, end, v.z);
+    str = parse_float(str, end, v.x);
+    chunk.normals.push_back(v.rotate_x(sin_al_x, cos_al_x)
+                             .rotate_y(sin_al_y, cos_al_y)
+                             .rotate_z(sin_al_z, cos_al_z));
+    return str;
+}
 
-    int vertex_index = 0;
-    int texture_index = 0;
-    int norm_index = 0;
-    while(!tokens.empty()) {
-        token = tokens.pop();
-        char cstr[token.length()];
-        strcpy(cstr, token.c_str());
-        parse_face_str(cstr, &vertex_index, &texture_index, &norm_index);
+const char *SceneFaceHandler::parse_face(const char *str, const char *end,
+                                         Chunk &chunk) const {
+    // corners are v, v/vt, v//vn or v/vt/vn
+    const size_t counts[3] = {
+        chunk.vertexes.size(), chunk.texture_points.size(), chunk.normals.size()
+    };
+    // texture points and normals are used only if all corners have them
+    bool textured = true;
+    bool normed = true;
 
-        q_vertexes.push(vertexes[vertex_index - 1]);
-        
-        if(norm_index > 0) {
-            q_norm_vectors.push(norm_vectors[norm_index - 1]);
+    chunk.corners.clear();
+    for (str = skip_spaces(str, end); !is_line_end(str, end); str = skip_spaces(str, end)) {
+        Corner corner;
+        corner.relative = 0;
+        // bit i is set if the corner has indexes[i]
+        int given = 0;
+        for (int i = 0; i < 3; ++i) {
+            if (i > 0) {
+                if ((str == end) || (*str != '/')) {
+                    break;
+                }
+                ++str;
+                if ((str < end) && (*str == '/')) {
+                    continue;
+                }
+            }
+            bool relative;
+            str = parse_index(str, end, counts[i], corner.indexes[i], relative);
+            corner.relative |= relative << i;
+            given |= 1 << i;
         }
+        // relative indexes may be equal to NO_INDEX until they are resolved
+        textured = textured && ((given >> 1) & 1);
+        normed = normed && ((given >> 2) & 1);
+        chunk.corners.push_back(corner);
     }
-    
-    scene_face_handler(q_vertexes, q_norm_vectors);
-}
-
-void SceneFaceHandler::parse_face_str(char * str, int * v_index,
-                                      int * vt_index, int * vn_index) {
-    int str_len = strlen(str);
-
-    int i = 0;
-    while((str[i] != '/') && (str[i] != ' ') && (str[i] != '\0')) {
-        ++i;
-    }
-    str[i] = '\0';
-    
-    if (strlen(str) > 0) {
-        *v_index = atoi(str);
-    }
-    
-    i++;
-    if (i >= str_len) {
-        return;
-    }
-    
-    str += i;
-    str_len = strlen(str);
-    i = 0;
-    while ((str[i] != '/') && (str[i] != ' ') && (str[i] != '\0')) {
-        ++i;
-    }
-
-    str[i] = '\0';
-    
-    if(strlen(str) > 0) {
-        *vt_index = atoi(str);
-    }
-    
-    i++;
-    if (i >= str_len) {
-        return;
-    }
-    
-    str += i;
-    str_len = strlen(str);
-    i = 0;
-    while ((str[i] != '/') && (str[i] != ' ') && (str[i] != '\0')){
-        ++i;
-    }
-
-    str[i] = '\0';
-    
-    if (strlen(str) > 0) {
-        *vn_index = atoi(str);
-    }
-}
-
-void SceneFaceHandler::scene_face_handler(Queue<Point3d> &vertexes,
-                                          Queue<Vector3d> &norm_vectors) {
-    Point3d p_p1 = vertexes.pop();
-    Point3d p_p2 = vertexes.pop();
-    Point3d p_p3;
-    
-    Vector3d p_v1;
-    Vector3d p_v2;
-    Vector3d p_v3;
-    
-    bool vLoaded = false;
-    if (norm_vectors.size() >= 2) {
-        p_v1 = norm_vectors.pop();
-        p_v2 = norm_vectors.pop();
-        vLoaded = true;
-    }
-
-    Point3d p1;
-    Point3d p2;
-    Point3d p3;
-    
-    Vector3d v1;
-    Vector3d v2;
-    Vector3d v3;
-    
-    while(!vertexes.empty()) {
-        p_p3 = vertexes.pop();
-        if (!norm_vectors.empty()) {
-            p_v3 = norm_vectors.pop();
-        } else {
-            vLoaded = false;
-        }
-        p1 = p_p1.rotate_x(sin_al_x, cos_al_x)
-                 .rotate_y(sin_al_y, cos_al_y)
-                 .rotate_z(sin_al_z, cos_al_z);
-        
-        p2 = p_p2.rotate_x(sin_al_x, cos_al_x)
-                 .rotate_x(sin_al_y, cos_al_y)
-                 .rotate_z(sin_al_z, cos_al_z);
-        
-        p3 = p_p3.rotate_x(sin_al_x, cos_al_x)
-                 .rotate_y(sin_al_y, cos_al_y)
-                 .rotate_z(sin_al_z, cos_al_z);
-        
-        if(vLoaded) {
-            
-            v1 = p_v1.rotate_x(sin_al_x, cos_al_x)
-                     .rotate_y(sin_al_y, cos_al_y)
-                     .rotate_z(sin_al_z, cos_al_z);
-            
-            v2 = p_v2.rotate_x(sin_al_x, cos_al_x)
-                     .rotate_y(sin_al_y, cos_al_y)
-                     .rotate_z(sin_al_z, cos_al_z);
-            
-            v3 = p_v3.rotate_x(sin_al_x, cos_al_x)
-                     .rotate_y(sin_al_y, cos_al_y)
-                     .rotate_z(sin_al_z, cos_al_z);
-            
-            scene->add_object(new NormedTriangle3d(Point3d(p1.x * scale + dx, p1.y * scale + dy, p1.z * scale + dz),
-                                                   Point3d(p2.x * scale + dx, p2.y * scale + dy, p2.z * scale + dz),
-                                                   Point3d(p3.x * scale + dx, p3.y * scale + dy, p3.z * scale + dz),
-                                                   v1,
-                                                   v2,
-                                                   v3,
-                                                   default_color,
-                                                   default_material));
-        } else {
-            scene->add_object(new Triangle3d(Point3d(p1.x * scale + dx, p1.y * scale + dy, p1.z * scale + dz),
-                                             Point3d(p2.x * scale + dx, p2.y * scale + dy, p2.z * scale + dz),
-                                             Point3d(p3.x * scale + dx, p3.y * scale + dy, p3.z * scale + dz),
-                                             default_color,
-                                             default_material));
+
+    add_triangles(chunk, textured, normed);
+    return str;
+}
+
+void SceneFaceHandler::add_triangles(Chunk &chunk, const bool textured,
+                                     const bool normed) const {
+    const std::vector<Corner> &corners = chunk.corners;
+    const bool used[3] = {true, textured, normed};
+    for (size_t i = 2; i < corners.size(); ++i) {
+        const Corner * const fan[3] = {&corners[0], &corners[i - 1], &corners[i]};
+
+        Triangle triangle;
+        triangle.relative = 0;
+        for (int kind = 0; kind < 3; ++kind) {
+            for (int j = 0; j < 3; ++j) {
+                const int k = 3 * kind + j;
+                triangle.indexes[k] = used[kind] ? fan[j]->indexes[kind]
+                                                 : TriangleMesh::NO_INDEX;
+                if (used[kind] && ((fan[j]->relative >> kind) & 1)) {
+                    triangle.relative |= 1 << k;
+                }
+            }
         }
-        
-        p_p2 = p_p3;
-        p_v2 = p_v3;
+        chunk.triangles.push_back(triangle);
     }
 }
@@ -4,42 +4,32 @@
 
 Quadrangle3d::Quadrangle3d(const Point3d &p1, const Point3d &p2,
                            const Point3d &p3, const Point3d &p4,
-                           const Color &color, const Material &material)
-        : p1(p1), p2(p2), p3(p3), p4(p4),
-          norm(Vector3d::cross(Vector3d(p1, p3), Vector3d(p3, p2))),
-          color(color), material(material) {
+                           const MaterialId material_id)
+        : Object3d(material_id), QuadranglePrimitive(p1, p2, p3, p4),
+          p2(p2), p3(p3), p4(p4) {
     Vector3d norm2 = Vector3d::cross(Vector3d(p1, p4), Vector3d(p4, p3));
     if (Vector3d::cross(norm, norm2).module2() > EPSILON) {
         throw new std::runtime_error("bad quadrangle");
     }
-    //d = (-(p1.x * norm.x + p1.y * norm.y + p1.z * norm.z));
 }
 
 bool Quadrangle3d::intersect(const Point3d &vector_start, const Vector3d &vector,
-               Point3d &intersection_point) const {
-    Triangle3d a(p1, p2, p3, color, material);
-    Triangle3d b(p1, p3, p4, color, material);
-
-    if (!a.intersect(vector_start, vector, intersection_point)) {
-        return b.intersect(vector_start, vector, intersection_point);
-    } else {
-        return true;
-    }
+               HitRecord &hit) const {
+    return QuadranglePrimitive::intersect(vector_start, vector, hit);
 }
 
-Color Quadrangle3d::get_color(const Point3d &intersection_point) const {
-    (void)intersection_point;
-    return color;
+Primitive Quadrangle3d::get_primitive() const {
+    return Primitive(static_cast<const QuadranglePrimitive &>(*this));
 }
 
-Vector3d Quadrangle3d::get_normal_vector(const Point3d &intersection_point) const {
-    (void)intersection_point;
-    return norm;
+Color Quadrangle3d::get_color(const HitRecord &hit, const MaterialTable &materials) const {
+    (void)hit;
+    return materials.get_color(material_id);
 }
 
-Material Quadrangle3d::get_material(const Point3d &intersection_point) const {
-    (void)intersection_point;
-    return material;
+Vector3d Quadrangle3d::get_normal_vector(const HitRecord &hit) const {
+    (void)hit;
+    return norm;
 }
 
 Point3d Quadrangle3d::get_min_boundary_point() const {
@@ -58,14 +48,12 @@ Point3d Quadrangle3d::get_max_boundary_point() const {
     return Point3d(x_max + EPSILON, y_max + EPSILON, z_max + EPSILON);
 }
 
-bool Quadrangle3d::reflects() const {
-    return material.Kr != 0;
-}
-
 bool Quadrangle3d::secondary_light(const Point3d &point, const LightSource3d &ls,
+                                   const MaterialTable &materials,
                                    LightSource3d &ls_secondary) const {
     (void) point;
     (void) ls;
+    (void) materials;
     (void) ls_secondary;
     return false;
 }
@@ -74,31 +62,22 @@ TexturedQuadrangle3d::TexturedQuadrangle3d(const Point3d &p1, const Point3d &p2,
                                            const Point3d &p3, const Point3d &p4,
                                            const Point2d &t1, const Point2d &t2,
                                            const Point2d &t3, const Point2d &t4,
-                                           Canvas *texture, const Color &color,
-                                           const Material &material)
-    : a(TexturedTriangle3d(p1, p2, p3, t1, t2, t3, texture, color, material)),
-      b(TexturedTriangle3d(p1, p4, p3, t1, t4, t3, texture, color, material)),
-      Quadrangle3d(p1, p2, p3, p4, color, material){
+                                           Canvas *texture, const MaterialId material_id)
+    : a(TexturedTriangle3d(p1, p2, p3, t1, t2, t3, texture, material_id)),
+      b(TexturedTriangle3d(p1, p3, p4, t1, t3, t4, texture, material_id)),
+      Quadrangle3d(p1, p2, p3, p4, material_id){
     Vector3d norm2 = Vector3d::cross(Vector3d(p1, p4), Vector3d(p4, p3));
     if (Vector3d::cross(norm, norm2).module2() > EPSILON) {
         throw new std::runtime_error("bad quadrangle");
     }
 }
 
-bool TexturedQuadrangle3d::intersect(const Point3d &vector_start, const Vector3d &vector,
-               Point3d &intersection_point) const {
-    if (!a.intersect(vector_start, vector, intersection_point)) {
-        return b.intersect(vector_start, vector, intersection_point);
-    } else {
-        return true;
-    }
-}
-
-Color TexturedQuadrangle3d::get_color(const Point3d &intersection_point) const {
-   Point3d itp;
-   if (a.intersect(intersection_point + norm, intersection_point - norm, itp)) {
-       return a.get_color(intersection_point);
+Color TexturedQuadrangle3d::get_color(const HitRecord &hit,
+                                      const MaterialTable &materials) const {
+   // hit.u and hit.v are the ones of the triangle hit
+   if (hit.primitive == 0) {
+       return a.get_color(hit, materials);
    } else {
-       return b.get_color(intersection_point);
+       return b.get_color(hit, materials);
    }
 }
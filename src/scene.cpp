@@ -3,36 +3,63 @@
 #include <float.h>
 #include <math.h>
 
+#include <algorithm>
+#include <vector>
+
+#include <include/accelerator_cache.h>
 #include <include/scene.h>
 
 Scene::Scene(const Color &background_color) :
+        mesh_trees_type(Accelerator::KD_TREE),
         background_color(background_color),
-        fog(new Fog()) {
+        accelerator_type(Accelerator::KD_TREE),
+        accelerator(NULL),
+        accelerator_objects_count(0),
+        fog(new Fog()),
+        render_statistics({0, 0}) {
+    assets.push_back(new Arena());
 }
 
 Scene::~Scene() {
-    for (size_t i = 0; i < objects.size(); i++) {
-        if (objects[i]) {
-            delete objects[i];
-        }
-    }
-    
     for (size_t i = 0; i < light_sources.size(); i++) {
         if (light_sources[i]) {
             delete light_sources[i];
         }
     }
     delete fog;
-    delete kd_tree;
+    delete accelerator;
+    delete_mesh_trees();
+
+    for (size_t i = 0; i < assets.size(); ++i) {
+        delete assets[i];
+    }
+}
+
+Arena &Scene::add_asset() {
+    assets.push_back(new Arena());
+    return *assets.back();
 }
 
 void Scene::add_object(Object3d * const object) {
     objects.push_back(object);
-    if (object->reflects()) {
+    if ((materials.get_material(object->get_material_id()).Kr != 0)
+            && object->has_secondary_light()) {
         reflecting_objects.push_back(object);
     }
 }
 
+MeshInstance *Scene::add_instance(const TriangleMesh * const mesh,
+                                  const Transform &transform) {
+    MeshInstance * const instance = create_object<MeshInstance>(mesh, transform,
+                                                                mesh->get_material_id());
+    instances.push_back(instance);
+    return instance;
+}
+
+MaterialId Scene::add_material(const Color &color, const Material &material) {
+    return materials.add(color, material);
+}
+
 void Scene::prepare_scene() {
     rebuild_kd_tree();
 }
@@ -52,63 +79,231 @@ void Scene::set_exponential_fog(const Float &k) {
 }
 
 void Scene::rebuild_kd_tree() {
-    kd_tree = new KDTree(objects);
+    rebuild_accelerators(true);
+}
+
+void Scene::refit_kd_tree() {
+    if (!accelerator || (accelerator_objects_count != objects.size())
+            || !accelerator->refit(thread_pool)) {
+        // moving objects would write a new file every frame
+        rebuild_accelerators(false);
+    }
+}
+
+void Scene::rebuild_accelerators(const bool cache_scene) {
+    // Trees of meshes are built again after set_accelerator()
+    if (mesh_trees_type != accelerator_type) {
+        delete_mesh_trees();
+        mesh_trees_type = accelerator_type;
+    }
+
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const TriangleMesh * const mesh = instances[i]->get_mesh();
+        Accelerator *&tree = mesh_trees[mesh];
+        if (!tree) {
+            // Accelerator doesn't change its objects
+            std::vector<Object3d*> mesh_objects(1, const_cast<TriangleMesh *>(mesh));
+            tree = build_accelerator(mesh_objects, true);
+        }
+        instances[i]->set_mesh_tree(tree);
+    }
+
+    delete accelerator;
+    accelerator = build_accelerator(objects, cache_scene);
+    accelerator_objects_count = objects.size();
+}
+
+void Scene::delete_mesh_trees() {
+    for (std::map<const TriangleMesh*, Accelerator*>::iterator it = mesh_trees.begin();
+         it != mesh_trees.end(); ++it) {
+        delete it->second;
+    }
+    mesh_trees.clear();
+}
+
+Accelerator *Scene::build_accelerator(std::vector<Object3d*> &objects, const bool cached) const {
+    if (cached && !accelerator_cache_directory.empty()) {
+        return AcceleratorCache::build(accelerator_cache_directory, accelerator_type, objects,
+                                       thread_pool);
+    }
+    return Accelerator::build(accelerator_type, objects, thread_pool);
 }
 
+void Scene::set_accelerator(const Accelerator::Type type) {
+    accelerator_type = type;
+}
+
+void Scene::set_accelerator_cache(const std::string &directory) {
+    accelerator_cache_directory = directory;
+}
+
+void Scene::set_threads_count(size_t threads_count) {
+    thread_pool = ThreadPool(threads_count);
+}
+
+const ThreadPool &Scene::get_thread_pool() const {
+    return thread_pool;
+}
+
+/*
+ * The image is split into RENDER_TILE_SIZE x RENDER_TILE_SIZE tiles which
+ * are traced by the thread pool. Tracing is read-only for the scene, so the
+ * only shared state is the canvas: every tile writes its own pixels of it.
+ * Tiles cost very different time (background vs. reflecting objects),
+ * work stealing in ThreadPool keeps all threads busy until the end.
+ *
+ * Counters are collected by every thread for its current tile and summed
+ * up after the tiles are done.
+ */
 void Scene::render(const Camera &camera, Canvas& canvas) const {
+    const int tiles_x = (canvas.width() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const int tiles_y = (canvas.height() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    const int tiles_count = tiles_x * tiles_y;
+
+    std::vector<RenderStatistics> tiles_statistics(tiles_count);
+    thread_pool.parallel_for(tiles_count, [&](size_t tile) {
+        tiles_statistics[tile] = render_tile(camera, tile % tiles_x, tile / tiles_x,
+                                             canvas);
+    });
+
+    std::vector<RenderStatistics> antialias_statistics(tiles_count, {0, 0});
+    if (ANTIALIASING) {
+        const Canvas edges = canvas.detect_edges();
+
+        thread_pool.parallel_for(tiles_count, [&](size_t tile) {
+            antialias_statistics[tile] = antialias_tile(camera, tile % tiles_x,
+                                                        tile / tiles_x, edges, canvas);
+        });
+    }
+
+    render_statistics = {0, 0};
+    for (int i = 0; i < tiles_count; ++i) {
+        render_statistics.shaded_points += tiles_statistics[i].shaded_points
+                + antialias_statistics[i].shaded_points;
+        render_statistics.shadow_rays += tiles_statistics[i].shadow_rays
+                + antialias_statistics[i].shadow_rays;
+    }
+}
+
+Scene::RenderStatistics Scene::render_tile(const Camera &camera, const int tile_x,
+                                           const int tile_y, Canvas &canvas) const {
+    tracing_statistics = {0, 0};
+
     const int w = canvas.width();
     const int h = canvas.height();
     const Float dx = w / 2.0;
     const Float dy = h / 2.0;
     const Float focus = camera.proj_plane_dist;
 
-    for(int i = 0; i < w; i++) {
-        for(int j = 0; j < h; j++) {
+    const int i_end = std::min(w, (tile_x + 1) * RENDER_TILE_SIZE);
+    const int j_end = std::min(h, (tile_y + 1) * RENDER_TILE_SIZE);
+
+    // Primary rays are traced by 2x2 packets,
+    // odd pixels at the right and bottom borders of image one by one
+    for (int j = tile_y * RENDER_TILE_SIZE; j < j_end; j += 2) {
+        for (int i = tile_x * RENDER_TILE_SIZE; i < i_end; i += 2) {
             const Float x = i - dx;
             const Float y = j - dy;
-            const Vector3d ray = Vector3d(x, y, focus);
-            const Color col = trace(camera, ray);
-            canvas.set_pixel(i, j, col);
+
+            if ((i + 1 < i_end) && (j + 1 < j_end)) {
+                const Vector3d rays[RayPacket::SIZE] = {
+                    Vector3d(x, y, focus), Vector3d(x + 1, y, focus),
+                    Vector3d(x, y + 1, focus), Vector3d(x + 1, y + 1, focus)
+                };
+                Color colors[RayPacket::SIZE];
+                trace_packet(camera, rays, colors);
+
+                Canvas::Pixel *row = canvas.row(j);
+                row[i] = Canvas::to_pixel(colors[0]);
+                row[i + 1] = Canvas::to_pixel(colors[1]);
+                row = canvas.row(j + 1);
+                row[i] = Canvas::to_pixel(colors[2]);
+                row[i + 1] = Canvas::to_pixel(colors[3]);
+                continue;
+            }
+
+            for (int jj = j; jj < std::min(j + 2, j_end); ++jj) {
+                for (int ii = i; ii < std::min(i + 2, i_end); ++ii) {
+                    const Vector3d ray = Vector3d(ii - dx, jj - dy, focus);
+                    canvas.row(jj)[ii] = Canvas::to_pixel(trace(camera, ray));
+                }
+            }
         }
     }
+    return tracing_statistics;
+}
 
-    if(ANTIALIASING) {
-        Canvas edges = canvas.detect_edges();
-        for (int i = 1; i < w - 1; i++) {
-            for (int j = 1; j < h - 1; j++) {
-                // edges canvas is grayscaled
-                // it means that color components (r, g, b) are equal
-                Byte gray = edges.get_pixel(i, j).r();
-
-                if (gray > 10) {
-                    const Float x = i - dx;
-                    const Float y = j - dy;
-
-                    Color c = canvas.get_pixel(i, j);
-
-                    const Float weight = 1.0 / 4;
-
-                    c = Color::multiply(c, weight);
-                    c = Color::add(c,
-                                   Color::multiply(trace(camera, Vector3d(x + 0.5, y, focus)),
-                                                   weight)
-                                   );
-                    c = Color::add(c,
-                                   Color::multiply(trace(camera, Vector3d(x, y + 0.5, focus)),
-                                                   weight)
-                                   );
-                    c = Color::add(c,
-                                   Color::multiply(trace(camera, Vector3d(x + 0.5, y + 0.5, focus)),
-                                                   weight)
-                                   );
-                    canvas.set_pixel(i, j, c);
-                }
+Scene::RenderStatistics Scene::antialias_tile(const Camera &camera, const int tile_x,
+                                              const int tile_y, const Canvas &edges,
+                                              Canvas &canvas) const {
+    tracing_statistics = {0, 0};
+
+    const int w = canvas.width();
+    const int h = canvas.height();
+    const Float dx = w / 2.0;
+    const Float dy = h / 2.0;
+    const Float focus = camera.proj_plane_dist;
+
+    // border pixels have no edges information
+    const int i_begin = std::max(1, tile_x * RENDER_TILE_SIZE);
+    const int j_begin = std::max(1, tile_y * RENDER_TILE_SIZE);
+    const int i_end = std::min(w - 1, (tile_x + 1) * RENDER_TILE_SIZE);
+    const int j_end = std::min(h - 1, (tile_y + 1) * RENDER_TILE_SIZE);
+
+    for (int j = j_begin; j < j_end; j++) {
+        const Canvas::Pixel *edges_row = edges.row(j);
+        Canvas::Pixel *row = canvas.row(j);
+        for (int i = i_begin; i < i_end; i++) {
+            // edges canvas is grayscaled
+            // it means that color components (r, g, b) are equal
+            Byte gray = Canvas::to_color(edges_row[i]).r();
+
+            if (gray > 10) {
+                const Float x = i - dx;
+                const Float y = j - dy;
+
+                Color c = Canvas::to_color(row[i]);
+
+                const Float weight = 1.0 / 4;
+
+                c = Color::multiply(c, weight);
+                c = Color::add(c,
+                               Color::multiply(trace(camera, Vector3d(x + 0.5, y, focus)),
+                                               weight)
+                               );
+                c = Color::add(c,
+                               Color::multiply(trace(camera, Vector3d(x, y + 0.5, focus)),
+                                               weight)
+                               );
+                c = Color::add(c,
+                               Color::multiply(trace(camera, Vector3d(x + 0.5, y + 0.5, focus)),
+                                               weight)
+                               );
+                row[i] = Canvas::to_pixel(c);
             }
         }
     }
+    return tracing_statistics;
 }
 
 size_t Scene::get_objects_count() const {
-    return objects.size();
+    size_t count = 0;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Primitive primitive = objects[i]->get_primitive();
+        count += (primitive.type == Primitive::MESH) ? primitive.mesh->get_faces_count() : 1;
+    }
+    for (size_t i = 0; i < instances.size(); ++i) {
+        // counted above as one object
+        count += instances[i]->get_mesh()->get_faces_count() - 1;
+    }
+    return count;
+}
+
+Accelerator::Statistics Scene::get_kd_tree_statistics() const {
+    return accelerator->get_statistics();
+}
+
+Scene::RenderStatistics Scene::get_render_statistics() const {
+    return render_statistics;
 }
 
@@ -1,63 +1,30 @@
 #include <include/sphere.h>
 
-Sphere::Sphere(const Point3d &center, const Float &radius, const Color &color,
-               const Material &material)
-    : center(center), radius(radius),color(color), material(material) {
+Sphere::Sphere(const Point3d &center, const Float &radius,
+               const MaterialId material_id)
+    : Object3d(material_id), SpherePrimitive(center, radius) {
 }
 
 bool Sphere::intersect(const Point3d &vector_start, const Vector3d &vector,
-               Point3d &intersection_point) const {
-    const Float a = vector.module2();
-
-    const Float b = 2 * Vector3d::dot(vector, (vector_start - center));;
-
-    const Float c = center.module2()
-                    + vector_start.module2()
-                    - 2 * Vector3d::dot(vector_start, center)
-                    - radius * radius;
-
-    const Float D = b * b - 4 * a * c;
-
-    if (D < 0.) {
-        return false;
-    }
-
-    const Float sqrt_D = sqrt(D);
-    const Float a_2 = 2 * a;
-
-    const Float t1 = (-b + sqrt_D) / a_2;
-    const Float t2 = (-b - sqrt_D) / a_2;
-
-    const Float min_t = (t1 < t2) ? t1 : t2;
-    const Float max_t = (t1 > t2) ? t1 : t2;
-
-    const Float t = (min_t > EPSILON) ? min_t : max_t;
-
-    if (t < EPSILON) {
-        return false;
-    }
-
-    intersection_point = vector_start + vector.mul(t);
+               HitRecord &hit) const {
+    return SpherePrimitive::intersect(vector_start, vector, hit);
+}
 
-    return true;
+Primitive Sphere::get_primitive() const {
+    return Primitive(static_cast<const SpherePrimitive &>(*this));
 }
 
-Color Sphere::get_color(const Point3d &intersection_point) const {
-    (void)intersection_point;
-    return color;
+Color Sphere::get_color(const HitRecord &hit, const MaterialTable &materials) const {
+    (void)hit;
+    return materials.get_color(material_id);
 }
 
-Vector3d Sphere::get_normal_vector(const Point3d &intersection_point) const {
-    Vector3d v(center, intersection_point);
+Vector3d Sphere::get_normal_vector(const HitRecord &hit) const {
+    Vector3d v(center, hit.point);
     v.normalize();
     return v;
 }
 
-Material Sphere::get_material(const Point3d &intersection_point) const {
-    (void)intersection_point;
-    return material;
-}
-
 Point3d Sphere::get_min_boundary_point() const {
     return Point3d(center.x - radius - 1., center.y - radius - 1.,
                    center.z - radius - 1.);
@@ -68,14 +35,12 @@ Point3d Sphere::get_max_boundary_point() const {
                    center.z + radius + 1.);
 }
 
-bool Sphere::reflects() const {
-    return material.Kr != 0;
-}
-
 bool Sphere::secondary_light(const Point3d &point, const LightSource3d &ls,
+                             const MaterialTable &materials,
                              LightSource3d &ls_secondary) const {
     (void) point;
     (void) ls;
+    (void) materials;
     (void) ls_secondary;
     return false;
 }
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+#include <include/thread_pool.h>
+
+ThreadPool::ThreadPool(size_t threads_count) : threads_count(threads_count) {
+    if (this->threads_count == 0) {
+        this->threads_count = hardware_threads_count();
+    }
+    workers.reset(new Workers(this->threads_count));
+}
+
+size_t ThreadPool::hardware_threads_count() {
+    const size_t count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+bool ThreadPool::WorkQueue::pop_front(size_t &task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty()) {
+        return false;
+    }
+    task = tasks.front();
+    tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::WorkQueue::pop_back(size_t &task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty()) {
+        return false;
+    }
+    task = tasks.back();
+    tasks.pop_back();
+    return true;
+}
+
+ThreadPool::Workers::Workers(size_t threads_count)
+    : queues(threads_count), busy(false), generation(0), workers_count(0), running(0),
+      task(NULL), stopping(false) {
+    for (size_t i = 1; i < threads_count; ++i) {
+        threads.push_back(std::thread(&Workers::run, this, i));
+    }
+}
+
+ThreadPool::Workers::~Workers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+void ThreadPool::Workers::run(size_t id) {
+    size_t seen = 0;
+    for (;;) {
+        const std::function<void(size_t)> *current_task;
+        size_t current_workers;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || (generation != seen); });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            current_task = task;
+            current_workers = workers_count;
+        }
+        // calls with less tasks than threads don't wake the others up
+        if (id >= current_workers) {
+            continue;
+        }
+
+        worker(queues, current_workers, id, *current_task);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::worker(std::vector<WorkQueue> &queues, size_t queues_count, size_t id,
+                        const std::function<void(size_t)> &task) {
+    size_t current;
+    for (;;) {
+        if (queues[id].pop_front(current)) {
+            task(current);
+            continue;
+        }
+
+        // Own deque is empty - stealing from the others.
+        // Nobody adds tasks after the start, so if every deque
+        // is empty the work is done.
+        bool stolen = false;
+        for (size_t i = 1; (i < queues_count) && !stolen; ++i) {
+            stolen = queues[(id + i) % queues_count].pop_back(current);
+        }
+        if (!stolen) {
+            return;
+        }
+        task(current);
+    }
+}
+
+void ThreadPool::parallel_for(size_t tasks_count,
+                              const std::function<void(size_t)> &task) const {
+    const size_t workers_count = std::min(threads_count, tasks_count);
+    bool idle = false;
+    if ((workers_count <= 1) || !workers->busy.compare_exchange_strong(idle, true)) {
+        for (size_t i = 0; i < tasks_count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::vector<WorkQueue> &queues = workers->queues;
+    for (size_t i = 0; i < workers_count; ++i) {
+        const size_t begin = tasks_count * i / workers_count;
+        const size_t end = tasks_count * (i + 1) / workers_count;
+        for (size_t j = begin; j < end; ++j) {
+            queues[i].tasks.push_back(j);
+        }
+    }
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto guarded_task = [&](size_t i) {
+        try {
+            task(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+    const std::function<void(size_t)> run = guarded_task;
+
+    {
+        std::lock_guard<std::mutex> lock(workers->mutex);
+        ++workers->generation;
+        workers->workers_count = workers_count;
+        workers->running = workers_count - 1;
+        workers->task = &run;
+    }
+    workers->wake.notify_all();
+    worker(queues, workers_count, 0, run);
+    {
+        std::unique_lock<std::mutex> lock(workers->mutex);
+        workers->done.wait(lock, [&]() { return workers->running == 0; });
+        workers->task = NULL;
+    }
+    workers->busy = false;
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
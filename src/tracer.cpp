@@ -1,5 +1,7 @@
 #include <include/scene.h>
 
+thread_local Scene::RenderStatistics Scene::tracing_statistics;
+
 Color Scene::trace(const Camera &camera, const Vector3d &vector) const {
     Vector3d r_vector = vector.rotate_x(camera.sin_al_x, camera.cos_al_x)
                               .rotate_z(camera.sin_al_z, camera.cos_al_z)
@@ -8,19 +10,44 @@ Color Scene::trace(const Camera &camera, const Vector3d &vector) const {
     return trace_recursively(camera.position, r_vector, INITIAL_RAY_INTENSITY, 0);
 }
 
+void Scene::trace_packet(const Camera &camera, const Vector3d vectors[],
+                         Color colors[]) const {
+    RayPacket packet(camera.position);
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        packet.set_vector(i, vectors[i].rotate_x(camera.sin_al_x, camera.cos_al_x)
+                                       .rotate_z(camera.sin_al_z, camera.cos_al_z)
+                                       .rotate_y(camera.sin_al_y, camera.cos_al_y));
+    }
+
+    if (!packet.is_coherent()) {
+        for (int i = 0; i < RayPacket::SIZE; ++i) {
+            colors[i] = trace_recursively(packet.start, packet.vector(i),
+                                          INITIAL_RAY_INTENSITY, 0);
+        }
+        return;
+    }
+
+    HitRecord nearest_hits[RayPacket::SIZE];
+    const int hits = accelerator->find_intersection_packet(packet, nearest_hits);
+
+    // Secondary rays are traced one by one
+    for (int i = 0; i < RayPacket::SIZE; ++i) {
+        if ((hits >> i) & 1) {
+            colors[i] = calculate_color(packet.start, packet.vector(i), nearest_hits[i],
+                                        INITIAL_RAY_INTENSITY, 0);
+        } else {
+            colors[i] = background_color;
+        }
+    }
+}
+
 Color Scene::trace_recursively(const Point3d &vector_start,
                                       const Vector3d &vector, const Float &intensity,
                                       const int recursion_level) const {
-    Object3d * nearest_obj = NULL;
-    Point3d nearest_intersection_point;
-    Float nearest_intersection_point_dist = FLOAT_MAX;
+    HitRecord nearest_hit;
     
-    if (kd_tree->find_intersection_tree(vector_start, vector,
-                               nearest_obj, nearest_intersection_point,
-                               nearest_intersection_point_dist)) {
-
-        return calculate_color(vector_start, vector, nearest_obj,
-                               nearest_intersection_point, nearest_intersection_point_dist,
+    if (accelerator->find_intersection_tree(vector_start, vector, nearest_hit)) {
+        return calculate_color(vector_start, vector, nearest_hit,
                                intensity, recursion_level);
     }
     
@@ -28,23 +55,38 @@ Color Scene::trace_recursively(const Point3d &vector_start,
 }
 
 Color Scene::calculate_color(const Point3d &vector_start,
-                             const Vector3d &vector, const Object3d * const obj,
-                             const Point3d &point, const Float &dist,
+                             const Vector3d &vector, const HitRecord &hit,
                              const Float &intensity, const int recursion_level) const {
-    Float fog_density = fog->density(dist);
-    const Material material = obj->get_material(point); 
-    const Vector3d norm = obj->get_normal_vector(point);
+    const Object3d * const obj = hit.object;
+    const Point3d &point = hit.point;
+    // distance is needed only for the fog
+    Float fog_density = fog->fog() ? fog->density(hit.t * vector.module()) : 0.;
+    const Material &material = materials.get_material(obj->get_material_id());
+    const Vector3d norm = obj->get_normal_vector(hit);
+    // Secondary rays start a bit off the surface, on the side they go to
+    const Vector3d front = (Vector3d::dot(hit.normal, vector) < 0.) ? hit.normal
+                                                                     : hit.normal.mul(-1.);
+    const Point3d front_point = offset_ray_origin(point, front);
     
-    Color obj_color = obj->get_color(point);
+    Color obj_color = obj->get_color(hit, materials);
     Vector3d reflected_ray;
 
     // Result
     Color result_color(0, 0, 0);
 
+    ++tracing_statistics.shaded_points;
+
     if ((material.Ks) || (material.Kr)) {
         reflected_ray = vector.reflect(norm);
     }
 
+    Color diffuse_light;
+    Color specular_light;
+    if (((material.Kd) || (material.Ks)) && light_sources.size()) {
+        get_lighting(point, norm, front, reflected_ray, material, diffuse_light,
+                     specular_light);
+    }
+
     // Ambient
     if (material.Ka) {
         Color ambient_color = Color::mix(background_color, obj_color);
@@ -57,8 +99,7 @@ Color Scene::calculate_color(const Point3d &vector_start,
     if (material.Kd) {
         Color diffuse_color = obj_color;
         if (light_sources.size()) {
-            Color light_color = get_lighting_color(point, norm);
-            diffuse_color = Color::mix(diffuse_color, light_color);
+            diffuse_color = Color::mix(diffuse_color, diffuse_light);
         }
 
         result_color = Color::add(result_color,
@@ -69,7 +110,7 @@ Color Scene::calculate_color(const Point3d &vector_start,
     if (material.Ks) {
         Color specular_color = background_color;
         if (light_sources.size()) {
-            specular_color = get_specular_color(point, reflected_ray, material.p);
+            specular_color = specular_light;
         }
 
         result_color = Color::add(result_color,
@@ -82,7 +123,7 @@ Color Scene::calculate_color(const Point3d &vector_start,
         Color reflected_color;
         if ((intensity > THRESHOLD_RAY_INTENSITY)
                 && (recursion_level < MAX_RAY_RECURSION_LEVEL)) {
-            reflected_color = trace_recursively(point, reflected_ray,
+            reflected_color = trace_recursively(front_point, reflected_ray,
                                                 intensity * material.Kr * (1 - fog_density),
                                                 recursion_level + 1);
         } else {
@@ -102,11 +143,12 @@ Color Scene::calculate_color(const Point3d &vector_start,
         if ((intensity > THRESHOLD_RAY_INTENSITY)
                 && (recursion_level < MAX_RAY_RECURSION_LEVEL)) {
             if (refracted) {
-                transparent_color = trace_recursively(point, transparent_ray,
+                transparent_color = trace_recursively(offset_ray_origin(point, front.mul(-1.)),
+                                                      transparent_ray,
                                                       intensity * material.Kt * (1 - fog_density),
                                                       recursion_level + 1);
             } else {
-                transparent_color = trace_recursively(point, reflected_ray,
+                transparent_color = trace_recursively(front_point, reflected_ray,
                                                     intensity * material.Kt * (1 - fog_density),
                                                     recursion_level + 1);
             }
@@ -126,95 +168,75 @@ Color Scene::calculate_color(const Point3d &vector_start,
     return result_color;
 }
 
-Color Scene::get_lighting_color(const Point3d &point, const Vector3d &norm_v) const {
-    Color light_color = Color(0, 0, 0);
-    for (size_t i = 0; i < light_sources.size(); i++) {
-        if (light_sources[i]) {
+/*
+ * Diffuse and specular light at the point in one pass over light sources,
+ * so every shadow ray is cast once and shared by both terms. Shadow rays
+ * are not cast for lights which add nothing to the needed terms. Secondary
+ * lights, reflected by objects, add to the specular term only.
+ */
+void Scene::get_lighting(const Point3d &point, const Vector3d &norm_v,
+                         const Vector3d &front, const Vector3d &reflected_ray,
+                         const Material &material,
+                         Color &diffuse_light, Color &specular_light) const {
+    diffuse_light = Color(0, 0, 0);
+    specular_light = Color(0, 0, 0);
 
-            LightSource3d * ls = light_sources[i];
-            if (is_viewable(ls->location, point)) {
-                Vector3d v_ls = Vector3d(point, ls->location);
-                Float cos_ls = fabs(Vector3d::cos(norm_v, v_ls));
-                Color color_ls = Color::multiply(ls->color, cos_ls);
-                light_color = Color::add(light_color, color_ls);
-            }
+    const bool diffuse = material.Kd;
+    const bool specular = material.Ks;
+    const Point3d front_point = offset_ray_origin(point, front);
+    const Point3d back_point = offset_ray_origin(point, front.mul(-1.));
 
-            if (SECONDARY_LIGHT && false) { // TODO CHECK
-                for (size_t j = 0; j < reflecting_objects.size(); ++j) {
-                    Object3d * obj = reflecting_objects[j];
-                    LightSource3d ls_secondary;
-                    if (obj->secondary_light(point, *ls, ls_secondary)) {
-                        if (is_viewable(ls_secondary.location, point)) {
-                            Vector3d v_ls_s = Vector3d(point, ls_secondary.location);
-                            Float cos_ls_s = fabs(Vector3d::cos(norm_v, v_ls_s));
-                            Color color_ls_s = Color::multiply(ls_secondary.color, cos_ls_s);
-                            light_color = Color::add(light_color, color_ls_s);
-                        }
-                    }
-                }
-            }
-        }
-    }
-    
-    return light_color;
-}
-
-Color Scene::get_specular_color(const Point3d &point, const Vector3d &reflected_ray,
-                                const Float &p) const {
-    Color light_color(0, 0, 0);
     for (size_t i = 0; i < light_sources.size(); i++) {
         if (light_sources[i]) {
             LightSource3d * ls = light_sources[i];
-            if (is_viewable(ls->location, point)) {
-                Vector3d v_ls = Vector3d(point, ls->location);
-                Float cos_ls = Vector3d::cos(reflected_ray, v_ls);
-                if (cos_ls > EPSILON) {
-                    Color color_ls = Color::multiply(ls->color, pow(cos_ls, p));
-                    light_color = Color::add(light_color, color_ls);
+            const Vector3d v_ls = Vector3d(point, ls->location);
+            const Float cos_specular = specular ? Vector3d::cos(reflected_ray, v_ls) : 0;
+
+            if ((diffuse || (cos_specular > EPSILON))
+                    && is_viewable(ls->location, (Vector3d::dot(front, v_ls) < 0.)
+                                                 ? back_point : front_point)) {
+                if (diffuse) {
+                    Float cos_ls = fabs(Vector3d::cos(norm_v, v_ls));
+                    Color color_ls = Color::multiply(ls->color, cos_ls);
+                    diffuse_light = Color::add(diffuse_light, color_ls);
+                }
+                if (cos_specular > EPSILON) {
+                    Color color_ls = Color::multiply(ls->color, pow(cos_specular, material.p));
+                    specular_light = Color::add(specular_light, color_ls);
                 }
             }
 
-            if (SECONDARY_LIGHT) { // TODO CHECK
+            if (SECONDARY_LIGHT && specular) {
                 for (size_t j = 0; j < reflecting_objects.size(); ++j) {
                     Object3d * obj = reflecting_objects[j];
                     LightSource3d ls_secondary;
-                    if (obj->secondary_light(point, *ls, ls_secondary)) {
-                        if (is_viewable(ls_secondary.location, point)) {
-                            Vector3d v_ls_s = Vector3d(point, ls_secondary.location);
-                            Float cos_ls_s = Vector3d::cos(reflected_ray, v_ls_s);
-                            if (cos_ls_s > EPSILON) {
-                                Color color_ls_s = Color::multiply(ls_secondary.color, pow(cos_ls_s, p));
-                                light_color = Color::add(light_color, color_ls_s);
-                            }
-                        }
+                    if (!obj->secondary_light(point, *ls, materials, ls_secondary)) {
+                        continue;
+                    }
+
+                    const Vector3d v_ls_s = Vector3d(point, ls_secondary.location);
+                    const Float cos_specular_s = Vector3d::cos(reflected_ray, v_ls_s);
+
+                    if ((cos_specular_s > EPSILON)
+                            && is_viewable(ls_secondary.location,
+                                           (Vector3d::dot(front, v_ls_s) < 0.)
+                                           ? back_point : front_point)) {
+                        Color color_ls_s = Color::multiply(ls_secondary.color,
+                                                           pow(cos_specular_s, material.p));
+                        specular_light = Color::add(specular_light, color_ls_s);
                     }
                 }
             }
         }
     }
-    
-    return light_color;
 }
 
 bool Scene::is_viewable(const Point3d &target_point, const Point3d &starting_point) const {
     const Vector3d ray = Vector3d(starting_point, target_point);
-    const Float target_dist = ray.module();
-    
-    Object3d * nearest_obj = NULL;
-    Point3d nearest_intersection_point;
-    Float nearest_intersection_point_dist = FLOAT_MAX;
-    
-    if (kd_tree->find_intersection_tree(starting_point,
-                                        ray,
-                                        nearest_obj,
-                                        nearest_intersection_point,
-                                        nearest_intersection_point_dist)) {
-
-        // Check if intersection point is closer than target_point
-        return (target_dist < nearest_intersection_point_dist);
-    }
-    // Ray doesn't intersect any of scene objects
-    return true;
+    ++tracing_statistics.shadow_rays;
+
+    // Visible unless some object is not farther than target_point, t = 1
+    return !accelerator->is_occluded(starting_point, ray, 1.);
 }
 
 bool Scene::refract(Vector3d& ray_dir, Vector3d a_normal, const Float &a_matIOR) const {
@@ -0,0 +1,23 @@
+#include <stdexcept>
+
+#include <include/transform.h>
+
+Transform Transform::inverse() const {
+    // columns of the inverse are the cross products of rows
+    // (Vector3d::cross(a, b) is b x a)
+    const Vector3d c0 = Vector3d::cross(rows[2], rows[1]);
+    const Vector3d c1 = Vector3d::cross(rows[0], rows[2]);
+    const Vector3d c2 = Vector3d::cross(rows[1], rows[0]);
+    const Float det = Vector3d::dot(rows[0], c0);
+    if (det == 0.) {
+        throw std::runtime_error("[Transform::inverse] Degenerate transform");
+    }
+
+    const Float k = 1. / det;
+    const Transform inverse(Vector3d(c0.x, c1.x, c2.x).mul(k),
+                            Vector3d(c0.y, c1.y, c2.y).mul(k),
+                            Vector3d(c0.z, c1.z, c2.z).mul(k),
+                            Vector3d());
+    return Transform(inverse.rows[0], inverse.rows[1], inverse.rows[2],
+                     inverse.apply_vector(translation).mul(-1.));
+}
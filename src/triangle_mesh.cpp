@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <include/triangle_mesh.h>
+
+const uint32_t TriangleMesh::NO_INDEX;
+
+TriangleMesh::TriangleMesh(const MaterialId material_id, const Canvas *texture)
+        : Object3d(material_id), texture(texture),
+          min_point(FLOAT_MAX, FLOAT_MAX, FLOAT_MAX),
+          max_point(-FLOAT_MAX, -FLOAT_MAX, -FLOAT_MAX) {
+}
+
+void TriangleMesh::reserve(const size_t vertexes_count, const size_t normals_count,
+                           const size_t texture_points_count, const size_t faces_count) {
+    xs.reserve(vertexes_count);
+    ys.reserve(vertexes_count);
+    zs.reserve(vertexes_count);
+    nxs.reserve(normals_count);
+    nys.reserve(normals_count);
+    nzs.reserve(normals_count);
+    tus.reserve(texture_points_count);
+    tvs.reserve(texture_points_count);
+    vertex_indexes.reserve(3 * faces_count);
+}
+
+uint32_t TriangleMesh::add_vertex(const Point3d &p) {
+    xs.push_back(p.x);
+    ys.push_back(p.y);
+    zs.push_back(p.z);
+    return xs.size() - 1;
+}
+
+uint32_t TriangleMesh::add_normal(const Vector3d &n) {
+    nxs.push_back(n.x);
+    nys.push_back(n.y);
+    nzs.push_back(n.z);
+    return nxs.size() - 1;
+}
+
+uint32_t TriangleMesh::add_texture_point(const Point2d &t) {
+    tus.push_back(t.x);
+    tvs.push_back(t.y);
+    return tus.size() - 1;
+}
+
+void TriangleMesh::add_face(const uint32_t v1, const uint32_t v2, const uint32_t v3,
+                            const uint32_t n1, const uint32_t n2, const uint32_t n3,
+                            const uint32_t t1, const uint32_t t2, const uint32_t t3) {
+    if ((v1 >= xs.size()) || (v2 >= xs.size()) || (v3 >= xs.size())) {
+        throw std::runtime_error("[TriangleMesh::add_face] Bad vertex index");
+    }
+
+    const bool normed = (n1 != NO_INDEX) && (n2 != NO_INDEX) && (n3 != NO_INDEX);
+    if (normed && ((n1 >= nxs.size()) || (n2 >= nxs.size()) || (n3 >= nxs.size()))) {
+        throw std::runtime_error("[TriangleMesh::add_face] Bad normal index");
+    }
+
+    const bool textured = (t1 != NO_INDEX) && (t2 != NO_INDEX) && (t3 != NO_INDEX);
+    if (textured && ((t1 >= tus.size()) || (t2 >= tus.size()) || (t3 >= tus.size()))) {
+        throw std::runtime_error("[TriangleMesh::add_face] Bad texture point index");
+    }
+
+    // Indexes of normals and texture points are kept since the first
+    // face which has them, the faces before get NO_INDEX
+    if (normed || !normal_indexes.empty()) {
+        normal_indexes.resize(vertex_indexes.size(), NO_INDEX);
+        normal_indexes.push_back(normed ? n1 : NO_INDEX);
+        normal_indexes.push_back(normed ? n2 : NO_INDEX);
+        normal_indexes.push_back(normed ? n3 : NO_INDEX);
+    }
+
+    if (textured || !texture_indexes.empty()) {
+        texture_indexes.resize(vertex_indexes.size(), NO_INDEX);
+        texture_indexes.push_back(textured ? t1 : NO_INDEX);
+        texture_indexes.push_back(textured ? t2 : NO_INDEX);
+        texture_indexes.push_back(textured ? t3 : NO_INDEX);
+    }
+
+    vertex_indexes.push_back(v1);
+    vertex_indexes.push_back(v2);
+    vertex_indexes.push_back(v3);
+
+    const uint32_t face = get_faces_count() - 1;
+    const Point3d p_min = get_face_min_boundary_point(face);
+    const Point3d p_max = get_face_max_boundary_point(face);
+    min_point = Point3d(std::min(min_point.x, p_min.x), std::min(min_point.y, p_min.y),
+                        std::min(min_point.z, p_min.z));
+    max_point = Point3d(std::max(max_point.x, p_max.x), std::max(max_point.y, p_max.y),
+                        std::max(max_point.z, p_max.z));
+}
+
+uint32_t TriangleMesh::get_vertexes_count() const {
+    return xs.size();
+}
+
+uint32_t TriangleMesh::get_normals_count() const {
+    return nxs.size();
+}
+
+uint32_t TriangleMesh::get_texture_points_count() const {
+    return tus.size();
+}
+
+uint32_t TriangleMesh::get_faces_count() const {
+    return vertex_indexes.size() / 3;
+}
+
+size_t TriangleMesh::get_memory() const {
+    return (xs.size() + ys.size() + zs.size()) * sizeof(Float)
+            + (nxs.size() + nys.size() + nzs.size()) * sizeof(Float)
+            + (tus.size() + tvs.size()) * sizeof(Float)
+            + (vertex_indexes.size() + normal_indexes.size()
+               + texture_indexes.size()) * sizeof(uint32_t)
+            + sizeof(TriangleMesh);
+}
+
+Point3d TriangleMesh::get_face_min_boundary_point(const uint32_t face) const {
+    const uint32_t * const v = &vertex_indexes[3 * face];
+    Float x_min = fast_min(xs[v[0]], xs[v[1]], xs[v[2]]);
+    Float y_min = fast_min(ys[v[0]], ys[v[1]], ys[v[2]]);
+    Float z_min = fast_min(zs[v[0]], zs[v[1]], zs[v[2]]);
+
+    return Point3d(x_min - EPSILON, y_min - EPSILON, z_min - EPSILON);
+}
+
+Point3d TriangleMesh::get_face_max_boundary_point(const uint32_t face) const {
+    const uint32_t * const v = &vertex_indexes[3 * face];
+    Float x_max = fast_max(xs[v[0]], xs[v[1]], xs[v[2]]);
+    Float y_max = fast_max(ys[v[0]], ys[v[1]], ys[v[2]]);
+    Float z_max = fast_max(zs[v[0]], zs[v[1]], zs[v[2]]);
+
+    return Point3d(x_max + EPSILON, y_max + EPSILON, z_max + EPSILON);
+}
+
+bool TriangleMesh::intersect(const Point3d &vector_start, const Vector3d &vector,
+                             HitRecord &hit) const {
+    const ShearedRay ray(vector_start, vector);
+    bool found = false;
+    for (uint32_t face = 0; face < get_faces_count(); ++face) {
+        HitRecord face_hit;
+        if (intersect_face(face, ray, face_hit)
+                && (!found || (face_hit.t < hit.t))) {
+            hit = face_hit;
+            hit.primitive = face;
+            found = true;
+        }
+    }
+    return found;
+}
+
+Primitive TriangleMesh::get_primitive() const {
+    return Primitive(this);
+}
+
+Color TriangleMesh::get_color(const HitRecord &hit, const MaterialTable &materials) const {
+    const uint32_t face = hit.primitive;
+    if (!has_face_texture(face)) {
+        return materials.get_color(material_id);
+    }
+
+    const Float w1 = 1. - hit.u - hit.v;
+    const Float w2 = hit.u;
+    const Float w3 = hit.v;
+
+    const uint32_t * const t = &texture_indexes[3 * face];
+    Float xf = w1 * tus[t[0]] + w2 * tus[t[1]] + w3 * tus[t[2]];
+    Float yf = w1 * tvs[t[0]] + w2 * tvs[t[1]] + w3 * tvs[t[2]];
+
+    // the texture is repeated
+    xf -= std::floor(xf);
+    yf -= std::floor(yf);
+
+    return texture->get_pixel((int)(xf * texture->width()), (int)(yf * texture->height()));
+}
+
+Vector3d TriangleMesh::get_normal_vector(const HitRecord &hit) const {
+    const uint32_t face = hit.primitive;
+    if (!has_face_normals(face)) {
+        return hit.normal;
+    }
+
+    const Float w1 = 1. - hit.u - hit.v;
+    const Float w2 = hit.u;
+    const Float w3 = hit.v;
+
+    const uint32_t * const n = &normal_indexes[3 * face];
+    return Vector3d(w1 * nxs[n[0]] + w2 * nxs[n[1]] + w3 * nxs[n[2]],
+                    w1 * nys[n[0]] + w2 * nys[n[1]] + w3 * nys[n[2]],
+                    w1 * nzs[n[0]] + w2 * nzs[n[1]] + w3 * nzs[n[2]]);
+}
+
+Point3d TriangleMesh::get_min_boundary_point() const {
+    return min_point;
+}
+
+Point3d TriangleMesh::get_max_boundary_point() const {
+    return max_point;
+}
+
+bool TriangleMesh::secondary_light(const Point3d &point, const LightSource3d &ls,
+                                   const MaterialTable &materials,
+                                   LightSource3d &ls_secondary) const {
+    (void) point;
+    (void) ls;
+    (void) materials;
+    (void) ls_secondary;
+    return false;
+}
+
+bool TriangleMesh::has_secondary_light() const {
+    return false;
+}
@@ -1,91 +1,56 @@
-#include <include/utils.h>
-
-Vector3d::Vector3d(const Point3d &start, const Point3d &end) :
-    Vector3d(end.x - start.x, end.y - start.y, end.z - start.z) {
-}
-
-Vector3d Vector3d::cross(const Vector3d &other) const {
-    return Vector3d(z * other.y - y * other.z,
-                    x * other.z - z * other.x,
-                    y * other.x - x * other.y);
-}
-
-Float Vector3d::dot(const Vector3d &other) const {
-    return x * other.x + y * other.y + z * other.z;
-}
-
-Float Vector3d::cos(const Vector3d &other) const {
-    return dot(other) / sqrt(module2() * other.module2());
-}
+#include <cstring>
 
-Vector3d Vector3d::cross(const Vector3d &a, const Vector3d &b) {
-    return Vector3d(a.z * b.y - a.y * b.z,
-                    a.x * b.z - a.z * b.x,
-                    a.y * b.x - a.x * b.y);
-}
-
-Float Vector3d::dot(const Vector3d &v1, const Vector3d &v2) {
-    return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
-}
-
-Float Vector3d::cos(const Vector3d &v1, const Vector3d &v2) {
-    return Vector3d::dot(v1, v2) / sqrt(v1.module2() * v2.module2());
-}
-
-bool Vector3d::check_same_clock_dir(const Vector3d &v1, const Vector3d &v2,
-                                    const Vector3d &norm) {
-    const Vector3d norm_v1_v2 = Vector3d::cross(v2, v1);
-    return !(Vector3d::dot(norm_v1_v2, norm) < 0);
-}
-
-Float Vector3d::module2() const {
-    return x * x + y * y + z * z;
-}
-
-Float Vector3d::module() const {
-    return sqrt(module2());
-}
-
-void Vector3d::normalize() {
-    const Float module = this->module();
-    x /= module;
-    y /= module;
-    z /= module;
-}
-
-Vector3d Vector3d::reflect(const Vector3d &norm) const {
-    const Float k = 2. * dot(norm) / norm.module2();
-    return Vector3d(x - norm.x * k,
-                    y - norm.y * k,
-                    z - norm.z * k);
-}
-
-Vector3d Vector3d::mul(const Float& k) const {
-    return Vector3d(x * k, y * k, z * k);
-}
-
-Vector3d Vector3d::rotate_x(const Float &sin_al, const Float &cos_al) const {
-    return Vector3d(x,
-                    y * cos_al - z * sin_al,
-                    y * sin_al + z * cos_al);
-}
-
-Vector3d Vector3d::rotate_y(const Float &sin_al, const Float &cos_al) const {
-    return Vector3d(x * cos_al - z * sin_al,
-                    y,
-                    x * sin_al + z * cos_al);
-}
-
-Vector3d Vector3d::rotate_z(const Float &sin_al, const Float &cos_al) const {
-    return Vector3d(x * cos_al - y * sin_al,
-                    x * sin_al + y * cos_al,
-                    z);
-}
-
-Vector3d operator+(const Vector3d &a, const Vector3d &b) {
-    return Vector3d(a.x + b.x, a.y + b.y, a.z + b.z);
-}
+#include <include/utils.h>
 
-Vector3d operator-(const Vector3d &a, const Vector3d &b) {
-    return Vector3d(a.x - b.x, a.y - b.y, a.z - b.z);
+// Coordinates nearer to 0 than OFFSET_ORIGIN are moved by
+// OFFSET_FLOAT_SCALE * n, units in the last place are too small there
+static const Float OFFSET_ORIGIN = 1. / 32;
+static const Float OFFSET_FLOAT_SCALE = 1. / 65536;
+static const Float OFFSET_INT_SCALE = 256;
+
+static Float offset_coordinate(const Float p, const Float n) {
+    if (fabs(p) < OFFSET_ORIGIN) {
+        return p + OFFSET_FLOAT_SCALE * n;
+    }
+
+    FloatBits bits;
+    memcpy(&bits, &p, sizeof(p));
+    const FloatBits ulps = (FloatBits)(OFFSET_INT_SCALE * n);
+    bits += (p < 0) ? -ulps : ulps;
+
+    Float moved;
+    memcpy(&moved, &bits, sizeof(moved));
+    return moved;
+}
+
+// Finalizer of splitmix64
+static uint64_t mix_bits(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+uint64_t hash_bytes(const void *data, const size_t size, const uint64_t seed) {
+    const char * const bytes = static_cast<const char *>(data);
+    uint64_t h = mix_bits(seed ^ size);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    return mix_bits(h ^ tail);
+}
+
+Point3d offset_ray_origin(const Point3d &point, const Vector3d &normal) {
+    const Float length = normal.module();
+    if (length == 0.) {
+        return point;
+    }
+    return Point3d(offset_coordinate(point.x, normal.x / length),
+                   offset_coordinate(point.y, normal.y / length),
+                   offset_coordinate(point.z, normal.z / length));
 }
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <chrono>
+
+#include <include/wide_bvh.h>
+
+template <int WIDTH>
+WideBVH<WIDTH>::Node::Node() {
+    for (int i = 0; i < WIDTH; ++i) {
+        set_box(i, Box());
+        children[i] = 0;
+        objects_counts[i] = 0;
+    }
+}
+
+template <int WIDTH>
+typename WideBVH<WIDTH>::Box WideBVH<WIDTH>::Node::box(const int child) const {
+    Box box;
+    for (int axis = 0; axis < 3; ++axis) {
+        box.min[axis] = min[axis][child / GROUP_SIZE][child % GROUP_SIZE];
+        box.max[axis] = max[axis][child / GROUP_SIZE][child % GROUP_SIZE];
+    }
+    return box;
+}
+
+template <int WIDTH>
+void WideBVH<WIDTH>::Node::set_box(const int child, const Box &box) {
+    for (int axis = 0; axis < 3; ++axis) {
+        min[axis][child / GROUP_SIZE][child % GROUP_SIZE] = box.min[axis];
+        max[axis][child / GROUP_SIZE][child % GROUP_SIZE] = box.max[axis];
+    }
+}
+
+template <int WIDTH>
+WideBVH<WIDTH>::WideBVH(std::vector<Object3d*> &objects) : BVH(objects) {
+}
+
+template <int WIDTH>
+WideBVH<WIDTH>::WideBVH(std::vector<Object3d*> &objects, const ThreadPool &pool)
+    : BVH(objects) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const std::vector<BuildItem> items = get_build_items();
+    std::vector<uint32_t> ids;
+    BuildNode * const root = build_tree(items, ids, pool);
+
+    std::vector<uint32_t> mesh_indexes = get_empty_mesh_indexes();
+    flatten(root, ids, items, mesh_indexes);
+    delete root;
+    built_cost = get_statistics().sah_cost;
+
+    const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    build_time = time.count();
+    build_threads_count = pool.get_threads_count();
+}
+
+template <int WIDTH>
+WideBVH<WIDTH>::~WideBVH() {
+}
+
+/*
+ * Children of the node are the nodes of the binary tree below it: the
+ * inner child with the largest surface area is replaced by its children
+ * while there are less than WIDTH of them. The root of the binary tree
+ * may be a leaf, then the root has one child.
+ */
+template <int WIDTH>
+uint32_t WideBVH<WIDTH>::flatten(const BuildNode * const node, const std::vector<uint32_t> &ids,
+                                 const std::vector<BuildItem> &items,
+                                 std::vector<uint32_t> &mesh_indexes) {
+    const BuildNode *children[WIDTH] = {node};
+    int children_count = 1;
+    while (children_count < WIDTH) {
+        int largest = -1;
+        Float largest_area = -1.;
+        for (int i = 0; i < children_count; ++i) {
+            const Float area = children[i]->box.surface_area();
+            if (children[i]->l && (area > largest_area)) {
+                largest = i;
+                largest_area = area;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        const BuildNode * const opened = children[largest];
+        children[largest] = opened->l;
+        children[children_count++] = opened->r;
+    }
+
+    // the empty tree, the root has no children
+    if ((children_count == 1) && !node->l && (node->begin == node->end)) {
+        children_count = 0;
+    }
+
+    const uint32_t index = nodes.size();
+    nodes.push_back(Node());
+    for (int i = 0; i < children_count; ++i) {
+        const BuildNode * const child = children[i];
+        uint32_t child_index;
+        uint32_t objects_count = 0;
+        if (child->l) {
+            child_index = flatten(child, ids, items, mesh_indexes);
+        } else {
+            child_index = primitive_refs.size();
+            objects_count = child->end - child->begin;
+            for (uint32_t j = child->begin; j < child->end; ++j) {
+                primitive_refs.push_back(add_primitive(items[ids[j]], mesh_indexes));
+            }
+        }
+
+        // nodes may be moved by the recursion
+        Node &n = nodes[index];
+        n.set_box(i, child->box);
+        n.children[i] = child_index;
+        n.objects_counts[i] = objects_count;
+    }
+    return index;
+}
+
+/*
+ * Slab test of BVH::Box::clip_ray() for all children at once. The near
+ * and the far sides of slabs are chosen by the signs of the ray once
+ * for all children.
+ */
+template <int WIDTH>
+PACKET_INLINE int WideBVH<WIDTH>::clip_children(const Node &node, const Float start[],
+                                                const Float inv_vector[],
+                                                const Float t_stop, Float t_min[]) const {
+    int children = 0;
+    for (int group = 0; group < GROUPS; ++group) {
+        Lanes t0 = Lanes{};
+        Lanes t1 = Lanes{} + t_stop;
+        for (int axis = 0; axis < 3; ++axis) {
+            const bool positive = (inv_vector[axis] >= 0.);
+            const FloatLanes &near = positive ? node.min[axis][group] : node.max[axis][group];
+            const FloatLanes &far = positive ? node.max[axis][group] : node.min[axis][group];
+            const Lanes t_near = (__builtin_convertvector(near, Lanes) - start[axis])
+                    * inv_vector[axis];
+            const Lanes t_far = (__builtin_convertvector(far, Lanes) - start[axis])
+                    * inv_vector[axis] * ROBUST_FACTOR;
+            t0 = (t_near > t0) ? t_near : t0;
+            t1 = (t_far < t1) ? t_far : t1;
+        }
+
+        for (int i = 0; i < GROUP_SIZE; ++i) {
+            t_min[group * GROUP_SIZE + i] = t0[i];
+            children |= (t0[i] <= t1[i]) ? (1 << (group * GROUP_SIZE + i)) : 0;
+        }
+    }
+    return children;
+}
+
+/*
+ * Depth-first traversal: children hit by the ray are sorted by the
+ * distance to their boxes, the nearest one is visited next, the others
+ * wait in the stack. Children starting after t_stop are skipped when
+ * they leave the stack.
+ *
+ * visit_leaf(offset, count) returns true to stop the search and may
+ * decrease t_stop.
+ */
+template <int WIDTH>
+template <class LeafVisitor>
+PACKET_INLINE void WideBVH<WIDTH>::traverse(const Point3d &vector_start,
+                                            const Vector3d &vector,
+                                            const Float &t_stop,
+                                            LeafVisitor visit_leaf) const {
+    const Float inv_vector[] = {Float(1.) / vector.x, Float(1.) / vector.y, Float(1.) / vector.z};
+    const Float start[] = {vector_start.x, vector_start.y, vector_start.z};
+
+    StackEntry stack[STACK_SIZE];
+    stack[0] = {0, 0, 0.};
+    int stack_size = 1;
+
+    while (stack_size) {
+        const StackEntry entry = stack[--stack_size];
+        if (t_stop < entry.t_min) {
+            continue;
+        }
+
+        if (entry.objects_count) {
+            if (visit_leaf(entry.child, entry.objects_count)) {
+                return;
+            }
+            continue;
+        }
+
+        const Node &node = nodes[entry.child];
+        Float t_min[WIDTH];
+        int children = clip_children(node, start, inv_vector, t_stop, t_min);
+
+        // the farthest children go first, the nearest one is on the top
+        const int first = stack_size;
+        while (children) {
+            const int i = __builtin_ctz(children);
+            children &= children - 1;
+
+            const StackEntry child = {node.children[i], node.objects_counts[i], t_min[i]};
+            int j = stack_size++;
+            while ((j > first) && (stack[j - 1].t_min < child.t_min)) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+}
+
+template <int WIDTH>
+PACKET_KERNEL
+bool WideBVH<WIDTH>::find_nearest(const Point3d &vector_start, const Vector3d &vector,
+                                  HitRecord &hit) const {
+    return find_nearest_hit(vector_start, vector, hit, [&](const Float &t_stop,
+                                                          const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
+
+template <int WIDTH>
+PACKET_KERNEL
+bool WideBVH<WIDTH>::find_any(const Point3d &vector_start, const Vector3d &vector,
+                              const Float max_t) const {
+    return find_any_hit(vector_start, vector, max_t, [&](const Float &t_stop,
+                                                         const auto &visit_leaf) {
+        traverse(vector_start, vector, t_stop, visit_leaf);
+    });
+}
+
+template <int WIDTH>
+bool WideBVH<WIDTH>::find_intersection_tree(const Point3d vector_start,
+                                            const Vector3d vector,
+                                            HitRecord &hit) const {
+    return find_nearest(vector_start, vector, hit);
+}
+
+template <int WIDTH>
+int WideBVH<WIDTH>::find_intersection_packet(const RayPacket &packet,
+                                             HitRecord hits[]) const {
+    int found = 0;
+    for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+        if (find_nearest(packet.start, packet.vector(lane), hits[lane])) {
+            found |= 1 << lane;
+        }
+    }
+    return found;
+}
+
+template <int WIDTH>
+bool WideBVH<WIDTH>::is_occluded(const Point3d vector_start, const Vector3d vector,
+                                 const Float max_t) const {
+    return find_any(vector_start, vector, max_t);
+}
+
+/*
+ * Boxes of leaf children are refitted in parallel, then the ones of inner
+ * children from the bottom: children are stored after their parents.
+ * Unused children are the ones without objects referencing the root,
+ * which is nobody's child.
+ */
+template <int WIDTH>
+bool WideBVH<WIDTH>::refit(const ThreadPool &pool) {
+    update_primitives();
+
+    const size_t chunks = chunks_for(nodes.size(), pool);
+    pool.parallel_for(chunks, [&](size_t c) {
+        const size_t end = chunk_begin(nodes.size(), chunks, c + 1);
+        for (size_t i = chunk_begin(nodes.size(), chunks, c); i < end; ++i) {
+            Node &n = nodes[i];
+            for (int j = 0; j < WIDTH; ++j) {
+                if (n.objects_counts[j]) {
+                    n.set_box(j, get_refs_box(n.children[j], n.objects_counts[j]));
+                }
+            }
+        }
+    });
+
+    for (size_t i = nodes.size(); i-- > 0;) {
+        Node &n = nodes[i];
+        for (int j = 0; j < WIDTH; ++j) {
+            if (n.objects_counts[j] || !n.children[j]) {
+                continue;
+            }
+            Box box;
+            for (int k = 0; k < WIDTH; ++k) {
+                box.extend(nodes[n.children[j]].box(k));
+            }
+            n.set_box(j, box);
+        }
+    }
+
+    return get_statistics().sah_cost <= built_cost * MAX_REFIT_COST_RATIO;
+}
+
+template <int WIDTH>
+typename WideBVH<WIDTH>::Statistics WideBVH<WIDTH>::get_statistics() const {
+    Statistics stats = {0, 0, 0, 0, 0, 0., 0, build_time, build_threads_count};
+    Box root;
+    for (int i = 0; i < WIDTH; ++i) {
+        root.extend(nodes[0].box(i));
+    }
+    collect_statistics(0, 0, root.surface_area(), stats);
+    stats.memory = nodes.size() * sizeof(Node)
+            + get_primitives_memory();
+    return stats;
+}
+
+template <int WIDTH>
+void WideBVH<WIDTH>::collect_statistics(const uint32_t node, const int depth,
+                                        const Float root_area, Statistics &stats) const {
+    const Node &n = nodes[node];
+
+    ++stats.nodes;
+    stats.depth = std::max(stats.depth, depth);
+
+    Box box;
+    for (int i = 0; i < WIDTH; ++i) {
+        const Box child = n.box(i);
+        box.extend(child);
+        if (child.min[0] > child.max[0]) {
+            continue;
+        }
+
+        const Float probability = root_area ? child.surface_area() / root_area : 1.;
+        if (n.objects_counts[i]) {
+            ++stats.leaves;
+            stats.references += n.objects_counts[i];
+            stats.sah_cost += probability * INTERSECTION_COST * n.objects_counts[i];
+        } else {
+            collect_statistics(n.children[i], depth + 1, root_area, stats);
+        }
+    }
+    stats.sah_cost += (root_area ? box.surface_area() / root_area : 1.) * TRAVERSAL_COST;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
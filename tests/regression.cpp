@@ -0,0 +1,284 @@
+/*
+ * Headless regression check of accelerators and rendering:
+ *
+ *  - nearest hits and occlusion of every Accelerator::Type are compared
+ *    with the brute force search over all objects for random rays;
+ *  - hits of ray packets are compared with the ones of single rays for
+ *    packets parallel to planes through vertexes of meshes, where the
+ *    kd-tree has split planes;
+ *  - the scene is rendered with every type, images must be identical to
+ *    each other and to the stored reference of the precision.
+ *
+ * Usage: regression [--update]
+ * --update writes the reference images again, after intended changes
+ * of the rendering.
+ */
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <include/camera.h>
+#include <include/canvas.h>
+#include <include/obj_loader.h>
+#include <include/quadrangle.h>
+#include <include/scene.h>
+#include <include/sphere.h>
+#include <include/transform.h>
+#include <include/triangle.h>
+
+#ifndef REGRESSION_DIR
+#define REGRESSION_DIR "."
+#endif
+
+static const char * const TYPE_NAMES[] = {"kd-tree", "BVH", "BVH4", "BVH8"};
+static const Accelerator::Type TYPES[] = {
+    Accelerator::KD_TREE, Accelerator::BVH2, Accelerator::BVH4, Accelerator::BVH8
+};
+static const int TYPES_COUNT = 4;
+
+static const int RAYS_COUNT = 5000;
+static const int PACKETS_COUNT = 2000;
+static const int WIDTH = 200;
+static const int HEIGHT = 150;
+
+// Scene with access to its objects and accelerator
+class RegressionScene : public Scene {
+public:
+    RegressionScene() : Scene(Color(240, 240, 240)) {
+    }
+
+    const std::vector<Object3d*> &get_objects() const {
+        return objects;
+    }
+
+    const Accelerator &get_accelerator() const {
+        return *accelerator;
+    }
+};
+
+// The demo scene without textures, with instances of the lamp
+static void fill_scene(RegressionScene &scene) {
+    const std::string models = REGRESSION_DIR "/../resources/";
+
+    scene.create_object<Quadrangle3d>(Point3d(-500, -500, -100), Point3d(+800, -0, -100),
+                                      Point3d(+800, -0, +300), Point3d(-500, -500, +300),
+                                      scene.add_material(Color(255, 0, 0),
+                                                         Material(15, 5, 50, 100, 0, 10)));
+    scene.create_object<Sphere>(Point3d(50, 100, 0), 50,
+                                scene.add_material(Color(100, 200, 30),
+                                                   Material(1, 5, 5, 0, 50, 10, 0.9)));
+    scene.create_object<Sphere>(Point3d(75, 125, -100), 50,
+                                scene.add_material(Color(250, 250, 50),
+                                                   Material(1, 3, 2, 0, 0, 10)));
+    scene.create_object<Sphere>(Point3d(100, 100, 100), 10,
+                                scene.add_material(Color(30, 30, 230),
+                                                   Material(1, 5, 5, 10, 0, 10)));
+    scene.create_object<Triangle3d>(Point3d(-700, -700, -130), Point3d(700, -700, -130),
+                                    Point3d(0, 500, -130),
+                                    scene.add_material(Color(255, 100, 30),
+                                                       Material(1, 6, 0, 2, 0, 0)));
+
+    SceneFaceHandler teapot(&scene, 20, 0, 0, -20, 0, 0, 20, Color(220, 220, 220),
+                            Material(1, 3, 5, 0, 0, 10));
+    teapot.set_mesh_cache(false);
+    teapot.load_obj((models + "teapot.obj").c_str());
+
+    SceneFaceHandler lamp(&scene, 40, -150, -100, 0, 0, 0, 0, Color(50, 50, 50),
+                          Material(3, 3, 1, 0, 0, 5));
+    lamp.set_mesh_cache(false);
+    lamp.load_obj((models + "lamp.obj").c_str());
+
+    SceneFaceHandler instanced(&scene, 1, 0, 0, 0, 0, 0, 0, Color(50, 50, 200),
+                               Material(3, 3, 1, 0, 0, 5));
+    instanced.set_mesh_cache(false);
+    const TriangleMesh * const mesh = instanced.load_mesh((models + "lamp.obj").c_str());
+    for (int i = 0; i < 4; ++i) {
+        scene.add_instance(mesh, Transform::rotate_y(i * 0.7)
+                                     .then(Transform::scale(15))
+                                     .then(Transform::translate(Vector3d(150 + i * 60, -150,
+                                                                         -60 + i * 40))));
+    }
+
+    scene.add_light_source(new LightSource3d(Point3d(-300, 300, 300), Color(255, 255, 255)));
+    scene.set_exponential_fog(0.00001);
+}
+
+static bool find_nearest(const std::vector<Object3d*> &objects, const Point3d &start,
+                         const Vector3d &vector, HitRecord &nearest) {
+    bool found = false;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        HitRecord hit;
+        if (objects[i]->intersect(start, vector, hit) && (!found || (hit.t < nearest.t))) {
+            nearest = hit;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Mismatches of the accelerator of the scene with the brute force search
+static int check_hits(const RegressionScene &scene) {
+    const std::vector<Object3d*> &objects = scene.get_objects();
+    const Accelerator &accelerator = scene.get_accelerator();
+    std::mt19937_64 random(1);
+    std::uniform_real_distribution<double> coordinate(-800., 800.);
+
+    int mismatches = 0;
+    for (int i = 0; i < RAYS_COUNT; ++i) {
+        const Point3d start(coordinate(random), coordinate(random) * 0.5, coordinate(random));
+        const Point3d end(coordinate(random), coordinate(random) * 0.5, coordinate(random));
+        const Vector3d vector(end.x - start.x, end.y - start.y, end.z - start.z);
+
+        HitRecord expected;
+        HitRecord hit;
+        const bool expected_found = find_nearest(objects, start, vector, expected);
+        const bool found = accelerator.find_intersection_tree(start, vector, hit);
+        if ((found != expected_found) || (found && (hit.t != expected.t))) {
+            ++mismatches;
+        }
+
+        const bool expected_occluded = expected_found && (expected.t <= 0.5);
+        if (accelerator.is_occluded(start, vector, 0.5) != expected_occluded) {
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Mismatches of packet hits with single ray hits, for packets starting
+// on the plane through a vertex of mesh along an axis, parallel to it.
+// Planes are the ones of kd-tree splits: bounds of faces rounded out to
+// float.
+static int check_packets(const RegressionScene &scene) {
+    std::vector<const TriangleMesh *> meshes;
+    const std::vector<Object3d*> &objects = scene.get_objects();
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Primitive primitive = objects[i]->get_primitive();
+        if (primitive.type == Primitive::MESH) {
+            meshes.push_back(primitive.mesh);
+        }
+    }
+
+    const Accelerator &accelerator = scene.get_accelerator();
+    std::mt19937_64 random(2);
+    std::uniform_real_distribution<double> coordinate(-800., 800.);
+    std::uniform_real_distribution<double> jitter(-0.01, 0.01);
+
+    int mismatches = 0;
+    for (int i = 0; i < PACKETS_COUNT; ++i) {
+        const TriangleMesh * const mesh = meshes[random() % meshes.size()];
+        Point3d vertex, p2, p3;
+        mesh->get_face_vertexes(random() % mesh->get_faces_count(), vertex, p2, p3);
+        const int axis = random() % 3;
+
+        Float start[] = {(Float) coordinate(random), (Float) coordinate(random),
+                         (Float) coordinate(random)};
+        const Float target[] = {vertex.x, vertex.y, vertex.z};
+        const float nearest = target[axis];
+        const float below = (nearest > target[axis]) ? std::nextafter(nearest, -FLT_MAX) : nearest;
+        const float above = (nearest < target[axis]) ? std::nextafter(nearest, FLT_MAX) : nearest;
+        start[axis] = (random() % 2) ? below : above;
+        RayPacket packet(Point3d(start[0], start[1], start[2]));
+        for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+            Float vector[3];
+            for (int j = 0; j < 3; ++j) {
+                vector[j] = (j == axis) ? 0 : (target[j] - start[j]) * (1 + jitter(random));
+            }
+            packet.set_vector(lane, Vector3d(vector[0], vector[1], vector[2]));
+        }
+        // lanes are sheared along the same axis
+        const ShearedRay::Coordinate kz = ShearedRay::largest_coordinate(packet.vector(0));
+        bool sheared_alike = true;
+        for (int lane = 1; lane < RayPacket::SIZE; ++lane) {
+            sheared_alike &= (ShearedRay::largest_coordinate(packet.vector(lane)) == kz);
+        }
+        if (!sheared_alike) {
+            continue;
+        }
+
+        HitRecord hits[RayPacket::SIZE];
+        const int found = accelerator.find_intersection_packet(packet, hits);
+        for (int lane = 0; lane < RayPacket::SIZE; ++lane) {
+            HitRecord hit;
+            const bool expected_found = accelerator.find_intersection_tree(
+                    packet.start, packet.vector(lane), hit);
+            if ((((found >> lane) & 1) != expected_found)
+                    || (expected_found && (hits[lane].t != hit.t))) {
+                ++mismatches;
+            }
+        }
+    }
+    return mismatches;
+}
+
+static size_t count_differences(const Canvas &a, const Canvas &b) {
+    if ((a.width() != b.width()) || (a.height() != b.height())) {
+        return std::max(a.width() * a.height(), b.width() * b.height());
+    }
+    size_t differences = 0;
+    for (size_t y = 0; y < a.height(); ++y) {
+        for (size_t x = 0; x < a.width(); ++x) {
+            differences += (a.row(y)[x] != b.row(y)[x]);
+        }
+    }
+    return differences;
+}
+
+int main(int argc, char *argv[]) {
+    const bool update = (argc > 1) && !strcmp(argv[1], "--update");
+    const std::string reference_name = std::string(REGRESSION_DIR "/reference_")
+            + ((sizeof(Float) == sizeof(float)) ? "float" : "double") + ".ppm";
+
+    RegressionScene scene;
+    scene.set_threads_count(0);
+    try {
+        fill_scene(scene);
+    } catch (const std::runtime_error &e) {
+        printf("FAILED: %s\n", e.what());
+        return 1;
+    }
+
+    const Camera camera(Point3d(0, 500, 0), -1.57, 0, 3.14, 160);
+    bool failed = false;
+    Canvas first(WIDTH, HEIGHT);
+    for (int i = 0; i < TYPES_COUNT; ++i) {
+        scene.set_accelerator(TYPES[i]);
+        scene.rebuild_kd_tree();
+
+        const int mismatches = check_hits(scene);
+        const int packet_mismatches = check_packets(scene);
+        Canvas canvas(WIDTH, HEIGHT);
+        scene.render(camera, canvas);
+        if (i == 0) {
+            first = canvas;
+        }
+        const size_t differences = count_differences(first, canvas);
+
+        printf("%-8s hits differing from brute force: %d of %d, packet hits differing "
+               "from single rays: %d, pixels differing from %s: %zu\n",
+               TYPE_NAMES[i], mismatches, 2 * RAYS_COUNT, packet_mismatches, TYPE_NAMES[0],
+               differences);
+        failed |= (mismatches != 0) || (packet_mismatches != 0) || (differences != 0);
+    }
+
+    if (update) {
+        first.write_png(reference_name.c_str());
+        printf("written %s\n", reference_name.c_str());
+    } else {
+        const Canvas reference(reference_name.c_str());
+        if (!reference.width()) {
+            printf("no reference image %s, run with --update\n", reference_name.c_str());
+        }
+        const size_t differences = count_differences(reference, first);
+        printf("pixels differing from %s: %zu\n", reference_name.c_str(), differences);
+        failed |= (differences != 0);
+    }
+
+    printf(failed ? "FAILED\n" : "OK\n");
+    return failed ? 1 : 0;
+}
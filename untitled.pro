@@ -8,6 +8,11 @@ QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+CONFIG   += c++17 thread
+
+# Single precision geometry, KDTree and tracing (see README.md)
+#DEFINES  += SINGLE_PRECISION
+
 TARGET = untitled
 TEMPLATE = app
 
@@ -21,18 +26,38 @@ SOURCES += main.cpp\
     src/sphere.cpp \
     src/tracer.cpp \
     src/triangle.cpp \
+    src/accelerator.cpp \
+    src/accelerator_cache.cpp \
+    src/cache_file.cpp \
+    src/bvh.cpp \
+    src/bvh_builder.cpp \
+    src/bvh_refit.cpp \
+    src/wide_bvh.cpp \
     src/kdtree.cpp \
+    src/kdtree_builder.cpp \
     src/color.cpp \
     src/utils.cpp \
     src/camera.cpp \
-    src/quadrangle.cpp
+    src/quadrangle.cpp \
+    src/thread_pool.cpp \
+    src/triangle_mesh.cpp \
+    src/arena.cpp \
+    src/material_table.cpp \
+    src/mapped_file.cpp \
+    src/mesh_cache.cpp \
+    src/transform.cpp \
+    src/mesh_instance.cpp
 
 HEADERS  += mainwindow.h \
     include/canvas.h \
     include/color.h \
+    include/accelerator.h \
+    include/accelerator_cache.h \
+    include/cache_file.h \
+    include/bvh.h \
+    include/wide_bvh.h \
     include/kdtree.h \
     include/obj_loader.h \
-    include/queue.h \
     engine.h \
     include/utils.h \
     include/objects.h \
@@ -41,7 +66,18 @@ HEADERS  += mainwindow.h \
     include/scene.h \
     include/fog.h \
     include/camera.h \
-    include/quadrangle.h
+    include/quadrangle.h \
+    include/thread_pool.h \
+    include/ray_packet.h \
+    include/primitives.h \
+    include/triangle_mesh.h \
+    include/hit_record.h \
+    include/arena.h \
+    include/material_table.h \
+    include/mapped_file.h \
+    include/mesh_cache.h \
+    include/transform.h \
+    include/mesh_instance.h
 
 FORMS    += mainwindow.ui
 